@@ -0,0 +1,113 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Cost of a log call on the calling thread:
+** synchronous vs. synchronous buffered (lines written in batches)
+** vs. asynchronous (formatted by the caller) vs. asynchronous deferred
+** (arguments captured by the caller, formatted by the writer thread)
+** vs. the binary log file (arguments captured, formatted by tinylog-decode).
+**
+** stderr is redirected to /dev/null, results go to stdout.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../src/tinylog.h"
+
+#define CALLS   100000
+
+static double now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double run( void )
+{
+    const char *path = "/api/v1/orders";
+
+    const double start = now_ns();
+    for( int i = 0; i < CALLS; i++ )
+    {
+        log_INFO( 0, "request %d for %s done, status %d, %.3f ms", i, path, 200, 1.25 );
+    }
+    const double stop = now_ns();
+
+    // not part of the measurement
+    tinylog_flush();
+
+    return ( stop - start ) / CALLS;
+}
+
+int main( void ) {
+
+    const int devnull = open( "/dev/null", O_WRONLY );
+    dup2( devnull, STDERR_FILENO );
+
+    set_log_threshold( LOG_INFO );
+
+    // large enough to never block
+    set_log_queue_size( CALLS );
+
+    const double sync_ns = run();
+
+    set_log_buffering( 1 << 16, 100 );
+    const double buffered_ns = run();
+    set_log_buffering( 0, 0 );
+
+    set_log_async( true );
+    const double async_ns = run();
+
+    set_log_deferred( true );
+    const double deferred_ns = run();
+
+    set_log_async( false );
+
+    // same lines as text and binary
+    open_tinylog_file( "bench_deferred.log", 0, 0, 0 );
+    set_log_dest( LOGFILE );
+    const double file_ns = run();
+    close_tinylog_file();
+
+    open_tinylog_binary( "bench_deferred.bin" );
+    set_log_dest( BINARY );
+    const double binary_ns = run();
+    close_tinylog_binary();
+
+    struct stat file_stat, binary_stat;
+    stat( "bench_deferred.log", &file_stat );
+    stat( "bench_deferred.bin", &binary_stat );
+    unlink( "bench_deferred.log" );
+    unlink( "bench_deferred.bin" );
+
+    printf( "%-24s %10s\n", "mode", "ns/call" );
+    printf( "%-24s %10.1f\n", "sync", sync_ns );
+    printf( "%-24s %10.1f\n", "sync buffered", buffered_ns );
+    printf( "%-24s %10.1f\n", "async", async_ns );
+    printf( "%-24s %10.1f\n", "async deferred", deferred_ns );
+    printf( "%-24s %10.1f %10ld bytes\n", "log file", file_ns, (long) file_stat.st_size );
+    printf( "%-24s %10.1f %10ld bytes\n", "binary log file", binary_ns, (long) binary_stat.st_size );
+
+    return 0;
+}
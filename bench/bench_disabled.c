@@ -0,0 +1,100 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Cost of a log call which is disabled by the log threshold:
+** the inline check of the tinylog() macro vs. calling is_enabled() and would_exit().
+**
+** Results go to stdout.
+*/
+
+#include "../src/tinylog.h"
+
+#define CALLS   100000000
+
+/**
+** Keeps the compiler from dropping the loop.
+*/
+static volatile unsigned sink;
+
+static double now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double run_empty( void )
+{
+    const double start = now_ns();
+    for( int i = 0; i < CALLS; i++ )
+    {
+        sink = i;
+    }
+    const double stop = now_ns();
+
+    return ( stop - start ) / CALLS;
+}
+
+static double run_inline( void )
+{
+    const double start = now_ns();
+    for( int i = 0; i < CALLS; i++ )
+    {
+        log_DEBUG( 0, "iteration %d of %d", i, CALLS );
+        sink = i;
+    }
+    const double stop = now_ns();
+
+    return ( stop - start ) / CALLS;
+}
+
+static double run_calls( void )
+{
+    const double start = now_ns();
+    for( int i = 0; i < CALLS; i++ )
+    {
+        // the check as done by the tinylog() macro before it was inlined
+        if( is_enabled( LOG_DEBUG ) || would_exit( LOG_DEBUG ) )
+        {
+            __tinylog( LOG_DEBUG, 0, __FUNCTION__, __LINE__, true, "iteration %d of %d", i, CALLS );
+        }
+        sink = i;
+    }
+    const double stop = now_ns();
+
+    return ( stop - start ) / CALLS;
+}
+
+int main( void ) {
+
+    set_log_threshold( LOG_WARNING );
+
+    const double empty_ns  = run_empty();
+    const double inline_ns = run_inline();
+    const double calls_ns  = run_calls();
+
+    printf( "%-24s %10s\n", "disabled site", "ns/call" );
+    printf( "%-24s %10.2f\n", "empty loop", empty_ns );
+    printf( "%-24s %10.2f\n", "inline gate", inline_ns - empty_ns );
+    printf( "%-24s %10.2f\n", "is_enabled/would_exit", calls_ns - empty_ns );
+
+    return 0;
+}
@@ -0,0 +1,343 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Formatting messages with the parsed format vs. vsnprintf().
+**
+** First the output of the formatter (and of rendering captured arguments) is compared
+** byte for byte with vsnprintf() for all kinds of conversions, random and extreme values,
+** truncated buffers and format strings in a buffer which is reused.
+** Any difference fails the benchmark.
+** Then the cost of formatting typical messages is measured.
+**
+** Results go to stdout.
+*/
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../src/tinylog_internal.h"
+
+#define CALLS       1000000
+
+/**
+** Count of random values per conversion
+*/
+#define VALUES      2000
+
+/**
+** Buffer sizes the output is checked with, besides the exact size
+*/
+static const size_t SIZES[] = { 0, 1, 2, 3, 5, 8, 13, 64 };
+
+static unsigned long checks;
+static unsigned long failures;
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t random64( void )
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+
+    return random_state;
+}
+
+/**
+** Random value with a random count of significant bits, so that all lengths occur
+*/
+static uint64_t random_bits( void )
+{
+    const unsigned bits = random64() % 65;
+
+    return bits == 64 ? random64() : random64() & ( ( 1ULL << bits ) - 1 );
+}
+
+static double now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//#################################################################################
+//  Differential check
+//#################################################################################
+
+static void compare( const char *what, const char *fmt, const char *expected, const int expected_len,
+        const char *actual, const int actual_len, const size_t size )
+{
+    checks++;
+
+    const size_t bytes = size == 0 ? 0 : ( (size_t) expected_len < size ? (size_t) expected_len : size - 1 ) + 1;
+
+    if( expected_len != actual_len || memcmp( expected, actual, bytes ) != 0 )
+    {
+        if( failures++ < 10 )
+        {
+            printf( "MISMATCH %s '%s' (size %zu): expected %d '%.*s', got %d '%.*s'\n",
+                    what, fmt, size, expected_len, (int) bytes, expected, actual_len, (int) bytes, actual );
+        }
+    }
+}
+
+/**
+** Compare vsnprintf() with the formatter and with rendering the captured arguments.
+*/
+static void check( const char *fmt, ... )
+{
+    log_format_t format;
+    __tinylog_parse_format( fmt, &format );
+
+    if( !format.deferrable )
+    {
+        printf( "Format can't be parsed: '%s'\n", fmt );
+        failures++;
+        return;
+    }
+
+    char expected[ 512 ];
+    char actual[ 512 ];
+    char captured[ 512 ];
+
+    va_list args;
+    va_start( args, fmt );
+
+    va_list copy;
+    va_copy( copy, args );
+    const int full = vsnprintf( expected, sizeof( expected ), fmt, copy );
+    va_end( copy );
+
+    va_copy( copy, args );
+    const int captured_len = __tinylog_capture( &format, captured, sizeof( captured ), copy );
+    va_end( copy );
+
+    for( size_t i = 0; i <= sizeof( SIZES ) / sizeof( SIZES[ 0 ] ); i++ )
+    {
+        const size_t size = i < sizeof( SIZES ) / sizeof( SIZES[ 0 ] ) ? SIZES[ i ] : (size_t) full + 1;
+
+        memset( expected, '#', sizeof( expected ) );
+        va_copy( copy, args );
+        const int expected_len = vsnprintf( size > 0 ? expected : NULL, size, fmt, copy );
+        va_end( copy );
+
+        memset( actual, '#', sizeof( actual ) );
+        va_copy( copy, args );
+        const int actual_len = __tinylog_vformat( &format, size > 0 ? actual : NULL, size, copy );
+        va_end( copy );
+
+        compare( "format", fmt, expected, expected_len, actual, actual_len, size );
+
+        if( captured_len >= 0 )
+        {
+            memset( actual, '#', sizeof( actual ) );
+            const int rendered_len = __tinylog_render( &format, captured, size > 0 ? actual : NULL, size );
+
+            compare( "render", fmt, expected, expected_len, actual, rendered_len, size );
+        }
+    }
+
+    va_end( args );
+}
+
+static const char *INT_FORMATS[] = {
+    "%d", "%i", "%u", "%x", "%X", "%o", "%c",
+    "%5d", "%-5d|", "%05d", "%+d", "% d", "%#x", "%#o", "%.3d", "%hd", "%hhu", "%hx",
+    "a%db%uc%xd", "[%d]"
+};
+
+static const char *LONG_FORMATS[] = { "%ld", "%lu", "%lx", "%lX", "%lo", "%-20ld|", "%+ld" };
+static const char *LLONG_FORMATS[] = { "%lld", "%llu", "%llx", "%llX", "%llo", "%#llx" };
+static const char *SIZE_FORMATS[] = { "%zu", "%zd", "%zx", "%zX", "%zo", "%8zu" };
+static const char *INTMAX_FORMATS[] = { "%jd", "%ju", "%jx" };
+static const char *PTRDIFF_FORMATS[] = { "%td", "%tu", "%tx" };
+static const char *DOUBLE_FORMATS[] = { "%f", "%.3f", "%e", "%g", "%10.2f", "%a" };
+static const char *STRING_FORMATS[] = { "%s", "%10s", "%-10s|", "%.2s", "%.0s", "<%s>" };
+static const char *POINTER_FORMATS[] = { "%p", "%20p", "%-20p|" };
+
+#define FOR_EACH( formats, value ) \
+    for( size_t f = 0; f < sizeof( formats ) / sizeof( formats[ 0 ] ); f++ ) \
+    { \
+        check( formats[ f ], value ); \
+    }
+
+static void check_all( void )
+{
+    static const long long EXTREMES[] = {
+        0, 1, -1, 9, 10, 99, 100, -100, 127, 128, 255, 256, 65535, 65536,
+        INT_MAX, INT_MIN, UINT_MAX, LONG_MAX, LONG_MIN, LLONG_MAX, LLONG_MIN
+    };
+
+    for( size_t i = 0; i < sizeof( EXTREMES ) / sizeof( EXTREMES[ 0 ] ) + VALUES; i++ )
+    {
+        const long long value = i < sizeof( EXTREMES ) / sizeof( EXTREMES[ 0 ] )
+                ? EXTREMES[ i ]
+                : (long long) random_bits() * ( random64() & 1 ? -1 : 1 );
+
+        for( size_t f = 0; f < sizeof( INT_FORMATS ) / sizeof( INT_FORMATS[ 0 ] ); f++ )
+        {
+            // the last formats take three arguments
+            check( INT_FORMATS[ f ], (int) value, (int) value, (int) value );
+        }
+        FOR_EACH( LONG_FORMATS, (long) value );
+        FOR_EACH( LLONG_FORMATS, value );
+        FOR_EACH( SIZE_FORMATS, (size_t) value );
+        FOR_EACH( INTMAX_FORMATS, (intmax_t) value );
+        FOR_EACH( PTRDIFF_FORMATS, (ptrdiff_t) value );
+        FOR_EACH( POINTER_FORMATS, (void *) (uintptr_t) value );
+        FOR_EACH( DOUBLE_FORMATS, (double) value / 7 );
+    }
+
+    static const char *STRINGS[] = { "", "a", "hello", "hello, world", "/api/v1/orders/4711", NULL };
+    for( size_t i = 0; i < sizeof( STRINGS ) / sizeof( STRINGS[ 0 ] ); i++ )
+    {
+        FOR_EACH( STRING_FORMATS, STRINGS[ i ] );
+    }
+
+    check( "%%" );
+    check( "100%% done" );
+    check( "no conversions at all" );
+    check( "%*d|%-*d|%.*s", 6, 42, 4, -7, 3, "truncated" );
+
+    // strings cut by the precision don't need a terminating '\0'
+    static const char UNTERMINATED[ 4 ] = { 'a', 'b', 'c', 'd' };
+    check( "%.4s|%.2s|%.*s|%-6.3s|%.*s", UNTERMINATED, UNTERMINATED, 3, UNTERMINATED, UNTERMINATED, -1, "all" );
+    check( "%Lf", (long double) 1.5 );
+    check( "request %d for %s done, status %u, id %x at %p: %c%%",
+            4711, "/api/v1/orders", 200u, 0xBEEFu, (void *) 0x7fff1234, 'x' );
+}
+
+/**
+** Format as a log call with a format string which isn't a literal.
+*/
+static int format_reused( char *str, const size_t size, const char *fmt, ... )
+{
+    va_list args;
+    va_start( args, fmt );
+    const int len = __tinylog_vsnprintf( str, size, fmt, false, args );
+    va_end( args );
+
+    return len;
+}
+
+/**
+** The same buffer holds different format strings, its address must not tell their text.
+*/
+static void check_reused( void )
+{
+    static const char *FORMATS[] = {
+        "hi", "a much longer message text", "hi", "n=%d", "%d of %d done", "n=%d"
+    };
+
+    char *fmt = malloc( 64 );
+    if( fmt == NULL )
+    {
+        failures++;
+        return;
+    }
+
+    for( size_t i = 0; i < sizeof( FORMATS ) / sizeof( FORMATS[ 0 ] ); i++ )
+    {
+        snprintf( fmt, 64, "%s", FORMATS[ i ] );
+
+        char expected[ 64 ];
+        char actual[ 64 ];
+        memset( actual, '#', sizeof( actual ) );
+
+        const int expected_len = snprintf( expected, sizeof( expected ), FORMATS[ i ], 42, 43 );
+        const int actual_len = format_reused( actual, sizeof( actual ), fmt, 42, 43 );
+
+        compare( "reused", FORMATS[ i ], expected, expected_len, actual, actual_len, sizeof( actual ) );
+    }
+
+    free( fmt );
+}
+
+//#################################################################################
+//  Benchmark
+//#################################################################################
+
+static int format_vsnprintf( char *str, const size_t size, const char *fmt, ... )
+{
+    va_list args;
+    va_start( args, fmt );
+    const int len = vsnprintf( str, size, fmt, args );
+    va_end( args );
+
+    return len;
+}
+
+static int format_tinylog( char *str, const size_t size, const char *fmt, ... )
+{
+    va_list args;
+    va_start( args, fmt );
+    // the formats below are literals
+    const int len = __tinylog_vsnprintf( str, size, fmt, true, args );
+    va_end( args );
+
+    return len;
+}
+
+/**
+** Keeps the compiler from dropping the loop.
+*/
+static volatile int sink;
+
+#define RUN( formatter, fmt, args... ) ( { \
+    char buf[ 256 ]; \
+    const double start = now_ns(); \
+    for( int i = 0; i < CALLS; i++ ) \
+    { \
+        sink = formatter( buf, sizeof( buf ), fmt, ##args ); \
+    } \
+    ( now_ns() - start ) / CALLS; \
+} )
+
+int main( void ) {
+
+    check_all();
+    check_reused();
+
+    printf( "%lu checks, %lu mismatches\n\n", checks, failures );
+    if( failures > 0 )
+    {
+        return 1;
+    }
+
+    const char *path = "/api/v1/orders";
+
+    printf( "%-32s %12s %12s\n", "message", "vsnprintf", "tinylog" );
+
+    printf( "%-32s %12.1f %12.1f\n", "integers",
+            RUN( format_vsnprintf, "request %d done, status %u, id %x", 4711, 200u, 0xBEEFu ),
+            RUN( format_tinylog, "request %d done, status %u, id %x", 4711, 200u, 0xBEEFu ) );
+
+    printf( "%-32s %12.1f %12.1f\n", "strings and pointer",
+            RUN( format_vsnprintf, "request for %s from %s at %p", path, "10.0.0.1", (void *) path ),
+            RUN( format_tinylog, "request for %s from %s at %p", path, "10.0.0.1", (void *) path ) );
+
+    printf( "%-32s %12.1f %12.1f\n", "mixed with width and double",
+            RUN( format_vsnprintf, "request %5d for %s took %.3f ms", 4711, path, 1.25 ),
+            RUN( format_tinylog, "request %5d for %s took %.3f ms", 4711, path, 1.25 ) );
+
+    return 0;
+}
@@ -0,0 +1,470 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Latency of the logging hot paths, at 1..N threads logging concurrently:
+** sites disabled by the threshold, lines to stderr (/dev/null), datagrams to a syslog
+** socket (a stand-in bound by the benchmark), messages with errno, long messages and
+** debug messages sampled 1 in 100.
+**
+** Each call is timed on its own (disabled and sampled sites in batches, they are too cheap for the clock),
+** the cost of reading the clock is subtracted. Reported are the mean cost per call and the
+** 50th, 99th and 99.9th percentile, as table, CSV or JSON to compare releases:
+**
+**     bench_latency [-f text|csv|json] [-t max_threads] [-n calls]
+**
+** stderr is redirected to /dev/null, results go to stdout.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../src/tinylog.h"
+
+/**
+** Default count of samples per thread and case
+*/
+#define SAMPLES         100000
+
+/**
+** Length of the long messages, beyond the buffer on the stack
+*/
+#define LONG_MSG_SIZE   900
+
+enum OutputFormat {
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSON
+};
+
+/**
+** A benchmarked path
+*/
+struct BenchCase {
+    const char     *name;
+    unsigned        batch;                      // calls per sample
+    void          (*setup)( void );
+    void          (*call)( const unsigned i );
+};
+typedef struct BenchCase bench_case_t;
+
+/**
+** Result of a case at a count of threads
+*/
+struct BenchResult {
+    double          ns_per_call;
+    double          p50;
+    double          p99;
+    double          p999;
+};
+typedef struct BenchResult bench_result_t;
+
+/**
+** State shared by the threads of a run
+*/
+struct BenchRun {
+    const bench_case_t *bench;
+    unsigned            samples;
+    pthread_barrier_t   start;
+    double             *latencies;              // samples of all threads, ns per call
+    double             *elapsed;                // per thread, ns
+};
+typedef struct BenchRun bench_run_t;
+
+struct BenchThread {
+    bench_run_t        *run;
+    unsigned            index;
+};
+typedef struct BenchThread bench_thread_t;
+
+/**
+** Cost of reading the clock, subtracted from each sample
+*/
+static double clock_ns;
+
+static char long_msg[ LONG_MSG_SIZE + 1 ];
+
+static char syslog_path[ sizeof( ((struct sockaddr_un *) 0)->sun_path ) ];
+
+/**
+** Keeps the compiler from dropping the loop.
+*/
+static volatile unsigned sink;
+
+
+static inline double now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//#################################################################################
+//  Cases
+//#################################################################################
+
+static void setup_disabled( void )
+{
+    set_log_dest( STDERR );
+    set_log_threshold( LOG_WARNING );
+}
+
+static void call_disabled( const unsigned i )
+{
+    log_DEBUG( 0, "request %u for %s done, status %d", i, "/api/v1/orders", 200 );
+    sink = i;
+}
+
+static void setup_stderr( void )
+{
+    set_log_dest( STDERR );
+    set_log_threshold( LOG_INFO );
+}
+
+static void call_stderr( const unsigned i )
+{
+    log_INFO( 0, "request %u for %s done, status %d, %.3f ms", i, "/api/v1/orders", 200, 1.25 );
+}
+
+static void setup_syslog( void )
+{
+    set_log_syslog_mode( SYSLOG_RFC5424 );
+    set_log_syslog_socket( syslog_path );
+    set_log_dest( SYSLOG );
+    set_log_threshold( LOG_INFO );
+}
+
+static void call_errno( const unsigned i )
+{
+    log_INFO( ECONNRESET, "request %u for %s failed", i, "/api/v1/orders" );
+}
+
+static void call_long( const unsigned i )
+{
+    log_INFO( 0, "request %u: %s", i, long_msg );
+}
+
+static void setup_sampled( void )
+{
+    set_log_dest( STDERR );
+    set_log_threshold( LOG_DEBUG );
+    set_log_sampling( LOG_DEBUG, 100 );
+}
+
+static void call_sampled( const unsigned i )
+{
+    log_DEBUG( 0, "request %u for %s done, status %d", i, "/api/v1/orders", 200 );
+    sink = i;
+}
+
+static const bench_case_t CASES[] = {
+    { "disabled",   100,    setup_disabled, call_disabled },
+    { "stderr",     1,      setup_stderr,   call_stderr },
+    { "syslog",     1,      setup_syslog,   call_stderr },
+    { "errno",      1,      setup_stderr,   call_errno },
+    { "long",       1,      setup_stderr,   call_long },
+    { "sampled",    100,    setup_sampled,  call_sampled }
+};
+
+//#################################################################################
+//  Syslog stand-in
+//#################################################################################
+
+/**
+** Receive and discard the datagrams, so that the socket doesn't fill up.
+*/
+static void *drain_syslog( void *arg )
+{
+    const int sock = *(int *) arg;
+
+    char buf[ 8192 ];
+    while( recv( sock, buf, sizeof( buf ), 0 ) >= 0 || errno == EINTR )
+    {
+    }
+
+    return NULL;
+}
+
+static int open_syslog_standin( pthread_t *drainer )
+{
+    snprintf( syslog_path, sizeof( syslog_path ), "/tmp/bench_latency.%d.sock", (int) getpid() );
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf( addr.sun_path, sizeof( addr.sun_path ), "%s", syslog_path );
+
+    static int sock;
+    sock = socket( AF_UNIX, SOCK_DGRAM, 0 );
+    if( sock < 0 || bind( sock, (struct sockaddr *) &addr, sizeof( addr ) ) < 0 )
+    {
+        perror( "bench_latency: syslog socket" );
+        return -1;
+    }
+
+    pthread_create( drainer, NULL, drain_syslog, &sock );
+
+    return sock;
+}
+
+//#################################################################################
+//  Measurement
+//#################################################################################
+
+static double measure_clock( void )
+{
+    double total = 0;
+    for( int i = 0; i < 100000; i++ )
+    {
+        const double start = now_ns();
+        total += now_ns() - start;
+    }
+
+    return total / 100000;
+}
+
+static void *run_thread( void *arg )
+{
+    const bench_thread_t *thread = arg;
+    bench_run_t *run = thread->run;
+    const bench_case_t *bench = run->bench;
+
+    double *latencies = run->latencies + (size_t) thread->index * run->samples;
+
+    pthread_barrier_wait( &run->start );
+
+    const double start = now_ns();
+    unsigned i = 0;
+    for( unsigned sample = 0; sample < run->samples; sample++ )
+    {
+        const double sample_start = now_ns();
+        for( unsigned call = 0; call < bench->batch; call++ )
+        {
+            bench->call( i++ );
+        }
+        const double latency = ( now_ns() - sample_start - clock_ns ) / bench->batch;
+
+        latencies[ sample ] = latency > 0 ? latency : 0;
+    }
+    run->elapsed[ thread->index ] = now_ns() - start;
+
+    return NULL;
+}
+
+static int compare_double( const void *a, const void *b )
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+
+    return ( x > y ) - ( x < y );
+}
+
+static double percentile( const double *sorted, const size_t count, const double p )
+{
+    size_t index = (size_t) ( p * count );
+
+    return sorted[ index < count ? index : count - 1 ];
+}
+
+static bench_result_t run_case( const bench_case_t *bench, const unsigned threads, const unsigned samples )
+{
+    bench_run_t run = {
+        .bench      = bench,
+        .samples    = samples,
+        .latencies  = malloc( sizeof( double ) * samples * threads ),
+        .elapsed    = calloc( threads, sizeof( double ) )
+    };
+    pthread_barrier_init( &run.start, NULL, threads );
+
+    bench->setup();
+
+    pthread_t tids[ threads ];
+    bench_thread_t args[ threads ];
+    for( unsigned t = 0; t < threads; t++ )
+    {
+        args[ t ] = (bench_thread_t) { .run = &run, .index = t };
+        pthread_create( &tids[ t ], NULL, run_thread, &args[ t ] );
+    }
+    for( unsigned t = 0; t < threads; t++ )
+    {
+        pthread_join( tids[ t ], NULL );
+    }
+
+    // not part of the measurement
+    tinylog_flush();
+
+    bench_result_t result = { 0 };
+
+    for( unsigned t = 0; t < threads; t++ )
+    {
+        result.ns_per_call += run.elapsed[ t ] / ( (double) samples * bench->batch );
+    }
+    result.ns_per_call /= threads;
+
+    const size_t count = (size_t) samples * threads;
+    qsort( run.latencies, count, sizeof( double ), compare_double );
+    result.p50  = percentile( run.latencies, count, 0.5 );
+    result.p99  = percentile( run.latencies, count, 0.99 );
+    result.p999 = percentile( run.latencies, count, 0.999 );
+
+    pthread_barrier_destroy( &run.start );
+    free( run.latencies );
+    free( run.elapsed );
+
+    return result;
+}
+
+//#################################################################################
+//  Output
+//#################################################################################
+
+static void print_header( const enum OutputFormat format )
+{
+    switch( format )
+    {
+        case FORMAT_TEXT:
+            printf( "%-12s %8s %12s %10s %10s %10s\n", "case", "threads", "ns/call", "p50", "p99", "p99.9" );
+            break;
+        case FORMAT_CSV:
+            printf( "case,threads,ns_per_call,p50_ns,p99_ns,p999_ns\n" );
+            break;
+        case FORMAT_JSON:
+            printf( "[\n" );
+            break;
+    }
+}
+
+static void print_result( const enum OutputFormat format, const char *name, const unsigned threads,
+        const bench_result_t *result, const bool first )
+{
+    switch( format )
+    {
+        case FORMAT_TEXT:
+            printf( "%-12s %8u %12.2f %10.1f %10.1f %10.1f\n",
+                    name, threads, result->ns_per_call, result->p50, result->p99, result->p999 );
+            break;
+        case FORMAT_CSV:
+            printf( "%s,%u,%.2f,%.1f,%.1f,%.1f\n",
+                    name, threads, result->ns_per_call, result->p50, result->p99, result->p999 );
+            break;
+        case FORMAT_JSON:
+            printf( "%s  {\"case\":\"%s\",\"threads\":%u,\"ns_per_call\":%.2f,\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"p999_ns\":%.1f}",
+                    first ? "" : ",\n", name, threads, result->ns_per_call, result->p50, result->p99, result->p999 );
+            break;
+    }
+    fflush( stdout );
+}
+
+static void print_footer( const enum OutputFormat format )
+{
+    if( format == FORMAT_JSON )
+    {
+        printf( "\n]\n" );
+    }
+}
+
+static void usage( void )
+{
+    fprintf( stdout, "usage: bench_latency [-f text|csv|json] [-t max_threads] [-n calls]\n" );
+}
+
+int main( int argc, char *argv[] ) {
+
+    enum OutputFormat format = FORMAT_TEXT;
+    long max_threads = sysconf( _SC_NPROCESSORS_ONLN );
+    unsigned samples = SAMPLES;
+
+    int opt;
+    while( ( opt = getopt( argc, argv, "f:t:n:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+            case 'f':
+                if( strcmp( optarg, "text" ) == 0 )         format = FORMAT_TEXT;
+                else if( strcmp( optarg, "csv" ) == 0 )     format = FORMAT_CSV;
+                else if( strcmp( optarg, "json" ) == 0 )    format = FORMAT_JSON;
+                else
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 't':
+                max_threads = atol( optarg );
+                break;
+            case 'n':
+                samples = atol( optarg );
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if( max_threads < 1 || samples < 1 )
+    {
+        usage();
+        return 1;
+    }
+
+    pthread_t drainer;
+    const int sock = open_syslog_standin( &drainer );
+    if( sock < 0 )
+    {
+        return 1;
+    }
+
+    const int devnull = open( "/dev/null", O_WRONLY );
+    dup2( devnull, STDERR_FILENO );
+
+    memset( long_msg, 'x', LONG_MSG_SIZE );
+
+    clock_ns = measure_clock();
+
+    print_header( format );
+
+    bool first = true;
+    for( size_t c = 0; c < sizeof( CASES ) / sizeof( CASES[ 0 ] ); c++ )
+    {
+        // 1, 2, 4, ... and max_threads itself
+        for( unsigned threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2 )
+        {
+            const bench_result_t result = run_case( &CASES[ c ], threads, samples );
+
+            print_result( format, CASES[ c ].name, threads, &result, first );
+            first = false;
+
+            if( threads == max_threads )
+            {
+                break;
+            }
+        }
+    }
+
+    print_footer( format );
+
+    shutdown( sock, SHUT_RDWR );
+    close( sock );
+    unlink( syslog_path );
+
+    return 0;
+}
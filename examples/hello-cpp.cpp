@@ -0,0 +1,42 @@
+    #include <string>
+    #include <string_view>
+    #include <vector>
+
+    #include <unistd.h>
+
+    #include "../src/tinylog.hpp"
+
+    int main() {
+
+        /* Set minimum log level to debug */
+        /* (default: LOG_WARNING) */
+        set_log_threshold(LOG_DEBUG);
+
+        /* Write a message, strings are taken as they are */
+        std::string world = "world";
+        tinylog(LOG_INFO, 0, "Hello, %s!", world);
+
+        /* std::string_view doesn't have to be terminated */
+        std::string_view greeting = "Hello, C++ world! (not logged)";
+        tinylog(LOG_INFO, 0, "%s", greeting.substr(0, 17));
+
+        /* the length modifier fitting the argument is added */
+        int64_t answer = 42;
+        log_DEBUG(0, "The answer is %d, or %x.", answer, answer);
+
+        /* same as with C */
+        static log_category_t cpp = tinylog_category("cpp");
+        tinylog_cat(cpp, LOG_NOTICE, 0, "%.3f ms", 1.25);
+
+        /* the flight recorder copies no more of a string_view than it holds */
+        set_log_recorder(LOG_DEBUG);
+        std::vector<char> raw = { 'r', 'a', 'w', ' ', 'b', 'y', 't', 'e', 's' };
+        std::string_view bytes(raw.data(), raw.size());
+        log_WARNING(0, "view %s", bytes);
+        tinylog_dump_recorder(STDERR_FILENO);
+
+        /* doesn't compile: "'%s' needs a string" */
+        /* tinylog(LOG_INFO, 0, "Hello, %s!", answer); */
+
+        return 0;
+    }
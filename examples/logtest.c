@@ -26,10 +26,11 @@ int main( const int argc, char* const argv[] ) {
 
     log_conf_t log_conf = parseopt (argc, argv, USAGE);
 
-    char* log_dest_str =
+    const char* log_dest_str =
             log_conf.log_dest == STDERR ?   "STDERR" :
             log_conf.log_dest == SYSLOG ?   "SYSLOG" :
             log_conf.log_dest == BOTH   ?   "BOTH" :
+            log_conf.log_dest & LOGFILE ?   strlog_dest( log_conf.log_dest ) :
                                             "unknown";
 
     fprintf( stderr, "Set log destination to '%s'\n", log_dest_str );
@@ -47,6 +48,13 @@ int main( const int argc, char* const argv[] ) {
         log_conf.dev_logging        // dev_logging - Should __FUNCTION__ & __LINE__ appear on stderr
     );
 
+    set_log_async( log_conf.async );
+
+    if( log_conf.log_file != NULL )
+    {
+        open_tinylog_file( log_conf.log_file, 0, 0, 5 );
+    }
+
     fprintf( stderr, "Starting log tests...\n" );
 
     // do test logging with given defaults
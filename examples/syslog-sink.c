@@ -0,0 +1,69 @@
+    #include <errno.h>
+    #include <stdio.h>
+    #include <unistd.h>
+
+    #include <sys/socket.h>
+    #include <sys/un.h>
+
+    #include "../src/tinylog.h"
+
+    /* print all datagrams received by the stand-in for the syslog daemon */
+    static void dump( const int sock ) {
+        char buf[ 4096 ];
+        ssize_t len;
+
+        while( ( len = recv( sock, buf, sizeof( buf ) - 1, MSG_DONTWAIT ) ) > 0 ) {
+            buf[ len ] = '\0';
+            printf( "received: %s\n", buf );
+        }
+    }
+
+    int main() {
+
+        /* a local socket standing in for /dev/log */
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        snprintf( addr.sun_path, sizeof( addr.sun_path ), "/tmp/tinylog-syslog-%d.sock", (int) getpid() );
+
+        const int sock = socket( AF_UNIX, SOCK_DGRAM, 0 );
+        if( sock < 0 || bind( sock, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 ) {
+            perror( "Could not create socket" );
+            return 1;
+        }
+
+        open_tinylog( "syslog-sink", LOG_PID, LOG_USER, LOG_DEBUG, SYSLOG, false, false );
+
+        /* send datagrams to the local socket instead of /dev/log */
+        set_log_syslog_socket( addr.sun_path );
+
+        /* RFC 5424 messages including function and line of the log call */
+        /* (default: SYSLOG_LIBC) */
+        set_log_syslog_mode( SYSLOG_RFC5424 );
+
+        tinylog(LOG_NOTICE, 0, "Hello, %s!", "RFC 5424 world");
+        dump( sock );
+
+        /* native journal protocol with CODE_FUNC, CODE_LINE and ERRNO fields */
+        set_log_syslog_mode( SYSLOG_JOURNAL );
+
+        tinylog(LOG_WARNING, ENOENT, "Hello, %s!", "journal world");
+        dump( sock );
+
+        /* the writer thread sends its messages in batches */
+        set_log_syslog_mode( SYSLOG_RFC5424 );
+        set_log_async( true );
+
+        for( int i = 0; i < 3; i++ ) {
+            tinylog(LOG_INFO, 0, "Hello, %s #%d!", "batched world", i);
+        }
+        tinylog_flush();
+        dump( sock );
+
+        set_log_async( false );
+
+        fprintf( stderr, "dropped: %lu\n", get_log_syslog_dropped() );
+
+        close( sock );
+        unlink( addr.sun_path );
+
+        return 0;
+    }
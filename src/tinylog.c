@@ -17,7 +17,10 @@
 **
 */
 
-#include "tinylog.h"
+#include <errno.h>      /* EINTR */
+#include <unistd.h>     /* write() */
+
+#include "tinylog_internal.h"
 
 /**
 ** Textual representation of log levels / severities
@@ -44,42 +47,73 @@ static const int SEVERITY_COUNT = ( int) sizeof( SEVERITIES ) / sizeof( SEVERITI
 /**
 ** Textual representation of log destination
 */
-static const char LOG_DEST[3][ 7 ] =
+static const char LOG_DEST[15][ 20 ] =
 {
         "stderr", 
         "syslog", 
-        "both"
+        "both",
+        "file",
+        "stderr+file",
+        "syslog+file",
+        "all",
+        "binary",
+        "stderr+binary",
+        "syslog+binary",
+        "both+binary",
+        "file+binary",
+        "stderr+file+binary",
+        "syslog+file+binary",
+        "all+binary"
 };
 
 
 /**
 ** Textual representation for unknown log destination
 */
-static const char UNKNOWN_LOG_DEST[ 7 ] = "******";
+static const char UNKNOWN_LOG_DEST[ 20 ] = "******";
+
 
 /**
-** Log threshold, LOG_WARNING .... LOG_DEBUG, LOG_TRACE, LOG_INIT
+** Textual representation of overflow policies
 */
-static int         __log_threshold = LOG_WARNING;    
+static const char LOG_OVERFLOW[3][ 12 ] =
+{
+        "block",
+        "drop-newest",
+        "drop-oldest"
+};
+
 
 /**
-** Whether the log should quit the program on errors
+** Textual representation for unknown overflow policies
 */
-static bool        __exit_on_error = false;          
+static const char UNKNOWN_OVERFLOW[ 12 ] = "***********";
 
 /**
-** Where the log should go to
+** Should the asynchronous logger capture arguments instead of formatting messages
 */
-static log_dest_t  __log_dest = STDERR;
+static bool        __deferred = false;          // atomic
 
 /**
-** Should __FUNCTION__ & __LINE__ appear on stderr
+** Maximum length of a log message (without the verbose name for errno)
 */
-static bool        __dev_logging = false;
+static size_t      __max_msg_size = 1024;       // atomic
 
 // internal prototypes
 
-static void __print_log_prefix( FILE *stream, const int severity, const char *func, const int line );
+static size_t __format_log_prefix( char *str, const size_t size, const log_record_t *rec );
+static inline uint64_t __load_config( void );
+static void __update_config( const uint64_t mask, const uint64_t value );
+static inline bool __would_exit( const uint64_t config, const int severity );
+static void __vtinylog( const log_category_t category, const int severity, const int err_no,
+        const char *func, const int line, const bool limit, const bool literal, const char *fmt_str, va_list *arg_pt,
+        const log_field_t *fields, const unsigned field_count );
+static void __copy_structured( log_record_t *rec, const bool queued, const char *msg,
+        const log_field_t *fields, const unsigned field_count );
+static void __tinylog_unlimited( const log_category_t category, const int severity,
+        const char *func, const int line, const char *fmt_str, ... ) __attribute__ (( format( printf, 5, 6 ) ));
+static void __report_suppressed( const log_suppressed_t *suppressed );
+static void __exit_on_error( void ) __attribute__ (( noreturn ));
 
 
 // functions
@@ -94,6 +128,11 @@ void setup_tinylog (
     set_log_dest( log_dest );
     set_exit_on_error( exit_on_error );
     set_dev_logging( dev_logging );
+
+    // the setters themselves don't log, so that they can be used by signal handlers
+    log_TRACE(0, "Set 'log_threshold' to: %s, 'log_dest' to: %s, 'exit_on_error' to: %s, 'dev_logging' to: %s",
+            strseverity( get_log_threshold() ), strlog_dest( get_log_dest() ),
+            exit_on_error ? "true" : "false", dev_logging ? "true" : "false" );
 }
 
 
@@ -105,21 +144,19 @@ void set_log_threshold( const int log_threshold )
         return;
     }
 
-    if( log_threshold != __log_threshold )
-    {
-        __log_threshold = log_threshold;
-        log_TRACE(0, "Set 'log_dest' to: %s", strseverity( log_threshold ) );
-    }
+    // thresholds beyond the known severities are all the same
+    const uint64_t threshold = log_threshold < CONFIG_THRESHOLD_MAX ? log_threshold : CONFIG_THRESHOLD_MAX;
+    __update_config( CONFIG_THRESHOLD_MASK, threshold << CONFIG_THRESHOLD_SHIFT );
 }
 
 int get_log_threshold( void )
 {
-    return __log_threshold;
+    return CONFIG_THRESHOLD( __load_config() );
 }
 
 bool is_enabled( const int severity )
 {
-    return (severity <= __log_threshold);
+    return (severity <= CONFIG_THRESHOLD( __load_config() ));
 }
 
 /**
@@ -129,17 +166,9 @@ bool is_enabled( const int severity )
 */
 void set_log_dest( const log_dest_t log_dest )
 {
-    if(     log_dest == STDERR ||
-            log_dest == SYSLOG || 
-            log_dest == BOTH
-    )
+    if( log_dest > 0 && log_dest <= ( STDERR | SYSLOG | LOGFILE | BINARY ) )
     {
-        if( log_dest != __log_dest )
-        {
-            __log_dest = log_dest;
-
-            log_TRACE(0, "Set 'log_dest' to: %s", strlog_dest( log_dest ) );
-        }
+        __update_config( CONFIG_DEST_MASK, (uint64_t) log_dest << CONFIG_DEST_SHIFT );
         return;
     }
 
@@ -148,7 +177,7 @@ void set_log_dest( const log_dest_t log_dest )
 
 log_dest_t get_log_dest( void )
 {
-    return __log_dest;
+    return CONFIG_DEST( __load_config() );
 }
 
 /**
@@ -158,17 +187,12 @@ log_dest_t get_log_dest( void )
 */
 void set_exit_on_error( const bool exit_on_error )
 {
-    if ( exit_on_error != __exit_on_error )
-    {
-        __exit_on_error = exit_on_error;
-
-        log_TRACE(0, "Set 'exit_on_error' to: %s", exit_on_error ? "true" : "false" );
-    }
+    __update_config( CONFIG_EXIT_ON_ERROR, exit_on_error ? CONFIG_EXIT_ON_ERROR : 0 );
 }
 
 bool get_exit_on_error( void )
 {
-    return __exit_on_error;
+    return __load_config() & CONFIG_EXIT_ON_ERROR;
 }
 
 /**
@@ -178,17 +202,89 @@ bool get_exit_on_error( void )
 */
 void set_dev_logging( const bool dev_logging )
 {
-    if( dev_logging != __dev_logging )
-    {   
-        __dev_logging = dev_logging;
+    __update_config( CONFIG_DEV_LOGGING, dev_logging ? CONFIG_DEV_LOGGING : 0 );
+}
+
+bool get_dev_logging( void )
+{
+    return __load_config() & CONFIG_DEV_LOGGING;
+}
+
+/**
+** Whether the stderr log should include the id and name of the thread
+**
+** default: false
+*/
+void set_log_thread_info( const bool thread_info )
+{
+    __update_config( CONFIG_THREAD_INFO, thread_info ? CONFIG_THREAD_INFO : 0 );
+}
+
+bool get_log_thread_info( void )
+{
+    return __load_config() & CONFIG_THREAD_INFO;
+}
 
-        log_TRACE(0, "Set 'dev_logging' to: %s", dev_logging ? "true" : "false" );
+/**
+** Level up to which the flight recorder keeps the messages of each thread,
+** independent of the threshold, -1 to turn it off.
+** The level counts for all log calls, so messages above the threshold
+** no longer return in the inline check.
+**
+** default: -1 (off)
+*/
+void set_log_recorder( const int level )
+{
+    if( level < -1 || LOG_INIT < level )
+    {
+        log_WARNING(0, "Unknown flight recorder level: %d. Ignoring.", level );
+        return;
     }
+
+    __update_config( CONFIG_RECORDER_MASK, (uint64_t) ( level + 1 ) << CONFIG_RECORDER_SHIFT );
 }
 
-bool get_dev_logging( void )
+int get_log_recorder( void )
+{
+    return CONFIG_RECORDER( __load_config() );
+}
+
+/**
+** Whether the asynchronous logger should capture the arguments of log calls
+** and leave formatting the message to the writer thread
+**
+** default: false
+*/
+void set_log_deferred( const bool deferred )
+{
+    __atomic_store_n( &__deferred, deferred, __ATOMIC_RELAXED );
+}
+
+bool get_log_deferred( void )
 {
-    return __dev_logging;
+    return __atomic_load_n( &__deferred, __ATOMIC_RELAXED );
+}
+
+/**
+** Maximum length of a log message (without the verbose name for errno).
+** Longer messages are truncated and marked with '[...]'.
+**
+** default: 1024
+*/
+void set_log_max_msg_size( const size_t max_msg_size )
+{
+    if( max_msg_size < TINYLOG_MSG_SIZE )
+    {
+        log_WARNING(0, "Maximum message size may not be less than %d, was: %zu. Ignoring", TINYLOG_MSG_SIZE, max_msg_size);
+        return;
+    }
+
+    __atomic_store_n( &__max_msg_size, max_msg_size, __ATOMIC_RELAXED );
+}
+
+size_t get_log_max_msg_size( void )
+{
+    return __atomic_load_n( &__max_msg_size, __ATOMIC_RELAXED );
 }
 
 /**
@@ -196,7 +292,12 @@ bool get_dev_logging( void )
 */
 bool would_exit( const int severity )
 {
-    return( severity <= LOG_ERR && __exit_on_error );
+    return __would_exit( __load_config(), severity );
+}
+
+static inline bool __would_exit( const uint64_t config, const int severity )
+{
+    return( severity <= LOG_ERR && ( config & CONFIG_EXIT_ON_ERROR ) );
 }
 
 /**
@@ -207,10 +308,27 @@ inline void do_exit_on_error( const int severity )
 {
     if( would_exit( severity ) )
     {
-        exit( -1 );
+        __exit_on_error();
     }
 }
 
+/**
+** Quit the program because of an error.
+*/
+static void __exit_on_error( void )
+{
+    // don't lose the queued messages, especially not the last one
+    tinylog_flush();
+
+    // show what led to the error
+    if( CONFIG_RECORDER( __load_config() ) >= 0 )
+    {
+        tinylog_dump_recorder( STDERR_FILENO );
+    }
+
+    exit( -1 );
+}
+
 void open_tinylog (
         const char *ident,
         const int options,
@@ -222,6 +340,8 @@ void open_tinylog (
 )
 {
     openlog( ident, options, facility );
+    __tinylog_syslog_open( ident, facility );
+    __tinylog_errno_init();
 
     setup_tinylog(
             log_threshold,
@@ -229,6 +349,38 @@ void open_tinylog (
             exit_on_error,
             dev_logging
     );
+
+    if( get_log_control() )
+    {
+        open_tinylog_control( ident );
+    }
+}
+
+void open_tinylog_async (
+        const char *ident,
+        const int options,
+        const int facility,
+        const int log_threshold,        // Log threshold, LOG_CRIT, ..., LOG_WARNING, ..., LOG_DEBUG, LOG_TRACE, LOG_INIT
+        const log_dest_t log_dest,      // Where the log messages should go to
+        const bool exit_on_error,       // Whether the log should quit the program on errors
+        const bool dev_logging,         // Whether __FUNCTION__ & __LINE__ should appear on stderr log
+        const unsigned queue_size,      // How many messages can be queued (rounded up to a power of two)
+        const log_overflow_t overflow   // What to do if the queue is full
+)
+{
+    open_tinylog(
+            ident,
+            options,
+            facility,
+            log_threshold,
+            log_dest,
+            exit_on_error,
+            dev_logging
+    );
+
+    set_log_queue_size( queue_size );
+    set_log_overflow( overflow );
+    set_log_async( true );
 }
 
 /**
@@ -236,61 +388,605 @@ void open_tinylog (
 */
 void __tinylog(
     const int severity,
-    const int errno,
+    const int err_no,
     const char *func,
     const int line,
+    const bool literal,
     const char *fmt_str, ... 
 )
 {
+    va_list arg_pt;
+    va_start( arg_pt, fmt_str );
+
+    __vtinylog( 0, severity, err_no, func, line, true, literal, fmt_str, &arg_pt, NULL, 0 );
+
+    va_end( arg_pt );
+}
+
+/**
+** Main routine handling the logging of categories.
+*/
+void __tinylog_cat(
+    const log_category_t category,
+    const int severity,
+    const int err_no,
+    const char *func,
+    const int line,
+    const bool literal,
+    const char *fmt_str, ...
+)
+{
+    va_list arg_pt;
+    va_start( arg_pt, fmt_str );
+
+    __vtinylog( category, severity, err_no, func, line, true, literal, fmt_str, &arg_pt, NULL, 0 );
+
+    va_end( arg_pt );
+}
+
+/**
+** Main routine handling structured log messages.
+*/
+void __tinylog_kv(
+    const int severity,
+    const int err_no,
+    const char *func,
+    const int line,
+    const char *msg,
+    const log_field_t *fields,
+    const unsigned field_count
+)
+{
+    __vtinylog( 0, severity, err_no, func, line, true, false, msg, NULL, fields, field_count );
+}
+
+/**
+** Log a message which is not subject to the rate limit.
+*/
+static void __tinylog_unlimited(
+    const log_category_t category,
+    const int severity,
+    const char *func,
+    const int line,
+    const char *fmt_str, ...
+)
+{
+    va_list arg_pt;
+    va_start( arg_pt, fmt_str );
+
+    __vtinylog( category, severity, 0, func, line, false, true, fmt_str, &arg_pt, NULL, 0 );
+
+    va_end( arg_pt );
+}
+
+static void __vtinylog(
+    const log_category_t category,
+    const int severity,
+    const int err_no,
+    const char *func,
+    const int line,
+    const bool limit,           // whether the message is subject to the rate limit
+    const bool literal,         // whether the format string is a literal (see TINYLOG_LITERAL())
+    const char *fmt_str,        // the message itself for structured messages
+    va_list *arg_pt,            // NULL for structured messages
+    const log_field_t *fields,  // NULL for printf style messages
+    const unsigned field_count
+)
+{
+    // all decisions of this call are based on the same configuration
+    const uint64_t config = __load_config();
+
+    // reports of suppressed messages don't quit the program, the message itself does
+    const bool exits = limit && __would_exit( config, severity );
+
+    // the flight recorder keeps messages below the threshold and before the rate limit
+    // (messages about suppressed ones would be redundant)
+    if( limit && severity <= CONFIG_RECORDER( config ) )
+    {
+        __tinylog_record( category, severity, err_no, func, line, literal, fmt_str, arg_pt );
+    }
+
+    const int threshold = category == 0
+            ? CONFIG_THRESHOLD( config )
+            : __tinylog_category_threshold( category, config );
+
     // nothing to log, return fast
-    if( __log_threshold < severity )
+    if( threshold < severity )
     {
-        if( severity <= LOG_ERR && __exit_on_error )
+        if( exits )
         {
-            exit( -1 );
+            __exit_on_error();
         }
 
         return;
     }
 
-    char log_msg[ 128 ];    // stores the log message
-    unsigned len;           // current length of thwe log message
+    if( limit )
+    {
+        log_suppressed_t suppressed;
+
+        // repeated messages are recognized by their hash only
+        uint64_t hash = 0;
+        if( __tinylog_dedupe() )
+        {
+            if( fields != NULL )
+            {
+                hash = __tinylog_hash_fields( severity, err_no, fmt_str, fields, field_count );
+            }
+            else
+            {
+                va_list args;
+                va_copy( args, *arg_pt );
+                hash = __tinylog_hash_args( severity, err_no, fmt_str, literal, args );
+                va_end( args );
+            }
+        }
 
-    va_list arg_pt;
-    va_start( arg_pt, fmt_str );
-    len = vsnprintf( log_msg, sizeof( log_msg ), fmt_str, arg_pt );
+        // the address of a format string which isn't a literal doesn't tell the call site
+        const bool pass = __tinylog_limit( literal ? fmt_str : func, func, line, category, severity, hash, &suppressed );
 
-    // get the verbose name for errno
-    if( errno > 0 )
+        if( !pass )
+        {
+            if( exits )
+            {
+                __exit_on_error();
+            }
+
+            return;
+        }
+
+        // report what was suppressed before the next message of the call site
+        __report_suppressed( &suppressed );
+    }
+
+    log_record_t  sync_rec;     // used if the message is written by the calling thread
+    log_record_t *rec = &sync_rec;
+
+    const int async = __tinylog_async_begin( &rec );
+    if( async == ASYNC_DROPPED )
     {
-        snprintf(
-                log_msg + len,
-                sizeof( log_msg ) - len,
-                "; Errno(%d): %s", errno, strerror( errno )
-        );
+        if( exits )
+        {
+            __exit_on_error();
+        }
+
+        return;
     }
-    va_end( arg_pt );
 
-    if(severity <= __log_threshold )
+    // short messages stay on the stack, long ones go to the arena of the thread
+    char sync_msg[ TINYLOG_MSG_SIZE ];
+    if( async != ASYNC_QUEUED )
     {
-        if( (__log_dest & STDERR) == STDERR )
+        rec->msg  = sync_msg;
+        rec->size = sizeof( sync_msg );
+    }
+
+    rec->stamp    = __tinylog_now( &rec->clock );
+    rec->func     = func;
+    rec->category = category;
+    rec->line     = line;
+    rec->severity = severity;
+    rec->flags    = CONFIG_DEST( config ) | ( config & CONFIG_DEV_LOGGING ? RECORD_DEV_LOGGING : 0 );
+
+    if( config & CONFIG_THREAD_INFO )
+    {
+        const log_thread_t *thread = __tinylog_thread();
+
+        rec->tid = thread->tid;
+        memcpy( rec->thread_name, thread->name, sizeof( rec->thread_name ) );
+        rec->flags |= RECORD_THREAD_INFO;
+    }
+
+    rec->err_no   = err_no;
+    rec->sample_rate = limit ? __tinylog_sample_rate( category, severity ) : 0;
+    rec->field_count = 0;
+
+    if( fields != NULL )
+    {
+        __copy_structured( rec, async == ASYNC_QUEUED, fmt_str, fields, field_count );
+    }
+    // capture the arguments only, the writer thread (or the decoder of the binary log) will format the message,
+    // the format string has to outlive the log call for that and keep its text
+    else if( literal
+        && ( ( async == ASYNC_QUEUED && __atomic_load_n( &__deferred, __ATOMIC_RELAXED ) )
+            || ( rec->flags & RECORD_BINARY ) )
+    )
+    {
+        const log_format_t *format = __tinylog_format( fmt_str );
+
+        if( format != NULL && format->deferrable )
+        {
+            va_list args;
+            va_copy( args, *arg_pt );
+            int len = __tinylog_capture( format, rec->msg, rec->size, args );
+            va_end( args );
+
+            if( len < 0 && async != ASYNC_QUEUED )
+            {
+                // too much for the stack, retry with the arena of the thread
+                const size_t size = get_log_max_msg_size() + 1;
+                char *arena = __tinylog_arena( ARENA_MSG, size );
+
+                if( arena != NULL )
+                {
+                    rec->msg  = arena;
+                    rec->size = size;
+
+                    va_copy( args, *arg_pt );
+                    len = __tinylog_capture( format, rec->msg, rec->size, args );
+                    va_end( args );
+                }
+            }
+
+            if( len >= 0 )
+            {
+                rec->format = format;
+                rec->len    = len;
+                rec->flags |= RECORD_DEFERRED;
+            }
+        }
+    }
+
+    if( fields == NULL && !( rec->flags & RECORD_DEFERRED ) )
+    {
+        va_list args;
+        va_copy( args, *arg_pt );
+        int len = __tinylog_vsnprintf( rec->msg, rec->size, fmt_str, literal, args );
+        va_end( args );
+
+        if( len < 0 )
         {
-            __print_log_prefix ( stderr, severity, func, line );
+            len = 0;
+            rec->msg[ 0 ] = '\0';
+        }
+        else if( (size_t) len >= rec->size && async != ASYNC_QUEUED )
+        {
+            // too long for the stack, retry with the arena of the thread
+            const size_t max_size = get_log_max_msg_size() + 1;
+            const size_t size = (size_t) len < max_size ? (size_t) len + 1 : max_size;
+            char *arena = __tinylog_arena( ARENA_MSG, size );
 
-            fprintf(stderr, "%s\n", log_msg);
+            if( arena != NULL )
+            {
+                rec->msg  = arena;
+                rec->size = size;
+                __tinylog_vsnprintf( rec->msg, rec->size, fmt_str, literal, *arg_pt );
+            }
         }
 
-        if( (__log_dest & SYSLOG) == SYSLOG 
-            && severity <= LOG_DEBUG
-        ) 
+        if( (size_t) len >= rec->size )
         {
-            // log only known severity levels to syslog
-            syslog( severity, "%s", log_msg );
+            len = __tinylog_truncated( rec->msg, rec->size );
         }
+        rec->len = len;
+    }
+
+    if( async == ASYNC_QUEUED )
+    {
+        __tinylog_async_commit( rec );
+    }
+    else
+    {
+        __tinylog_emit( rec );
     }
 
     // check severity an exit eventually
-    do_exit_on_error( severity );
+    if( exits )
+    {
+        __exit_on_error();
+    }
+}
+
+/**
+** Report the messages of a call site which were suppressed since its last message logged.
+*/
+static void __report_suppressed( const log_suppressed_t *suppressed )
+{
+    if( suppressed->repeated > 0 )
+    {
+        __tinylog_unlimited( suppressed->category, suppressed->severity, suppressed->func, suppressed->line,
+                "Last message repeated %lu times", suppressed->repeated );
+    }
+    if( suppressed->limited > 0 )
+    {
+        __tinylog_unlimited( suppressed->category, suppressed->severity, suppressed->func, suppressed->line,
+                "%lu messages suppressed by rate limit", suppressed->limited );
+    }
+}
+
+/**
+** Report the messages suppressed at all call sites which weren't reported yet,
+** so that they don't get lost if the call site never logs again.
+*/
+void __tinylog_report_suppressed( void )
+{
+    if( get_log_suppressed() == 0 )
+    {
+        return;
+    }
+
+    log_suppressed_t suppressed;
+    for( unsigned pos = 0; __tinylog_limit_pending( &pos, &suppressed ); )
+    {
+        __report_suppressed( &suppressed );
+    }
+}
+
+/**
+** Copy the message of a structured log call into the record and pack its fields behind it.
+** The message is not formatted, only truncated to the maximum message size.
+** Fields which don't fit into a record of the queue are dropped.
+*/
+static void __copy_structured(
+    log_record_t *rec,
+    const bool queued,
+    const char *msg,
+    const log_field_t *fields,
+    const unsigned field_count
+)
+{
+    const size_t max_size = get_log_max_msg_size() + 1;
+    size_t len = strlen( msg );
+
+    if( !queued )
+    {
+        const size_t size = ( len < max_size ? len + 1 : max_size ) + __tinylog_fields_size( fields, field_count );
+        if( size > rec->size )
+        {
+            // too long for the stack, use the arena of the thread
+            char *arena = __tinylog_arena( ARENA_MSG, size );
+            if( arena != NULL )
+            {
+                rec->msg  = arena;
+                rec->size = size;
+            }
+        }
+    }
+
+    const size_t msg_size = rec->size < max_size ? rec->size : max_size;
+    if( len < msg_size )
+    {
+        memcpy( rec->msg, msg, len + 1 );
+    }
+    else
+    {
+        memcpy( rec->msg, msg, msg_size - 1 );
+        len = __tinylog_truncated( rec->msg, msg_size );
+    }
+    rec->len = len;
+
+    __tinylog_pack_fields( rec->msg + len + 1, rec->size - len - 1, fields, field_count, &rec->field_count );
+}
+
+/**
+** Take a snapshot of the configuration.
+*/
+static inline uint64_t __load_config( void )
+{
+    return __atomic_load_n( &__log_control.config, __ATOMIC_RELAXED );
+}
+
+/**
+** Replace the bits of the configuration selected by the mask and update the gate.
+** Only atomics are used, so it is safe in signal handlers.
+*/
+static void __update_config( const uint64_t mask, const uint64_t value )
+{
+    uint64_t old = __load_config();
+    uint64_t config;
+
+    do
+    {
+        config = ( old & ~mask & ~CONFIG_GATE_MASK ) | value;
+        config |= (uint64_t) __tinylog_gate( CONFIG_THRESHOLD( config ), config );
+    }
+    while( !__atomic_compare_exchange_n( &__log_control.config, &old, config, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) );
+
+    // categories without a threshold of their own follow the configuration
+    __tinylog_update_categories();
+}
+
+/**
+** Mark a message cut to the buffer of the given size as truncated.
+** Returns the new length of the message.
+*/
+size_t __tinylog_truncated( char *msg, const size_t size )
+{
+    const size_t marker_len = sizeof( TRUNCATION_MARKER ) - 1;
+
+    if( size <= marker_len )
+    {
+        msg[ size - 1 ] = '\0';
+        return size - 1;
+    }
+
+    memcpy( msg + size - 1 - marker_len, TRUNCATION_MARKER, marker_len + 1 );
+
+    return size - 1;
+}
+
+/**
+** Format the message of the record including its fields and the verbose name for errno
+** into the buffer (no '\0' is appended).
+** Returns the length of the message (truncated to the buffer).
+*/
+static size_t __format_msg( char *str, const size_t size, const log_record_t *rec, const char *msg, const size_t msg_len )
+{
+    size_t len = msg_len < size ? msg_len : size;     // current length of the log message
+    memcpy( str, msg, len );
+
+    if( rec->field_count > 0 )
+    {
+        len = __tinylog_encode_fields( LOG_ENCODING_HUMAN, str, size, len, rec );
+    }
+
+    // get the verbose name for errno
+    if( rec->err_no > 0 && len < size )
+    {
+        char errno_buf[ 160 ];
+        size_t errno_len;
+        const char *errno_str = __tinylog_errno_text( rec->err_no, errno_buf, sizeof( errno_buf ), &errno_len );
+
+        if( errno_len > size - len )
+        {
+            errno_len = size - len;
+        }
+        memcpy( str + len, errno_str, errno_len );
+        len += errno_len;
+    }
+
+    return len;
+}
+
+/**
+** Turn captured arguments into the text of the message.
+** Returns the text, which is either in the given buffer or in the arena of the thread.
+*/
+static const char *__render_msg( const log_record_t *rec, char *buf, const size_t buf_size, size_t *len )
+{
+    // the rendered message may be longer than the captured arguments
+    size_t size = get_log_max_msg_size() + 1;
+
+    char *str = buf;
+    if( size > buf_size )
+    {
+        str = __tinylog_arena( ARENA_RENDER, size );
+        if( str == NULL )
+        {
+            str  = buf;
+            size = buf_size;
+        }
+    }
+    else
+    {
+        size = buf_size;
+    }
+
+    *len = __tinylog_render( rec->format, rec->msg, str, size );
+    if( *len >= size )
+    {
+        *len = __tinylog_truncated( str, size );
+    }
+
+    return str;
+}
+
+/**
+** Encode the record into the line (no '\n' is appended), the size has to leave room for it.
+** The offset of the message within the line is stored in 'msg_offset',
+** structured encodings have none.
+** Returns the length of the line.
+*/
+static size_t __encode_line(
+    const log_encoding_t encoding,
+    char *line,
+    const size_t size,
+    const log_record_t *rec,
+    const char *msg,
+    const size_t msg_len,
+    size_t *msg_offset
+)
+{
+    if( encoding != LOG_ENCODING_HUMAN )
+    {
+        *msg_offset = 0;
+
+        return __tinylog_encode_record( encoding, line, size - 1, rec, msg, msg_len );
+    }
+
+    const size_t prefix_len = __format_log_prefix( line, TINYLOG_PREFIX_SIZE, rec );
+    *msg_offset = prefix_len;
+
+    return prefix_len + __format_msg( line + prefix_len, size - prefix_len - 1, rec, msg, msg_len );
+}
+
+/**
+** Write the record to the binary log file and to all sinks taking it.
+** The record is encoded once for each encoding used by these sinks.
+*/
+void __tinylog_emit( const log_record_t *rec )
+{
+    // binary records take the captured arguments as they are
+    if( (rec->flags & BINARY) == BINARY )
+    {
+        __tinylog_binary_write( rec );
+    }
+
+    const unsigned sinks = __tinylog_sinks_select( rec );
+    if( sinks == 0 )
+    {
+        return;
+    }
+
+    const char *msg = rec->msg;
+    size_t msg_len  = rec->len;
+
+    char stack_msg[ TINYLOG_MSG_SIZE ];
+    if( rec->flags & RECORD_DEFERRED )
+    {
+        msg = __render_msg( rec, stack_msg, sizeof( stack_msg ), &msg_len );
+    }
+
+    // packed fields might grow when encoded, as does escaped text
+    const size_t fields_size = rec->field_count > 0 ? rec->size - rec->len - 1 + 32 * rec->field_count : 0;
+
+    // prefix, message, fields, errno suffix, '\n' and '\0'
+    const size_t size = TINYLOG_PREFIX_SIZE + 2 * ( msg_len + fields_size ) + TINYLOG_ERRNO_SIZE + 2;
+
+    char stack_line[ TINYLOG_LINE_SIZE ];
+    char *line = stack_line;
+    if( size > sizeof( stack_line ) )
+    {
+        line = __tinylog_arena( ARENA_LINE, size );
+        if( line == NULL )
+        {
+            line = stack_line;
+        }
+    }
+    const size_t line_size = line == stack_line ? sizeof( stack_line ) : size;
+
+    for( int encoding = LOG_ENCODING_HUMAN; encoding <= LOG_ENCODING_JSON; encoding++ )
+    {
+        const unsigned encoded = __tinylog_sinks_encoded( sinks, encoding );
+        if( encoded == 0 )
+        {
+            continue;
+        }
+
+        log_sink_line_t sink_line = {
+            .severity   = rec->severity,
+            .category   = rec->category,
+            .text       = line,
+            .record     = rec
+        };
+
+        // room for '\n' and '\0'
+        sink_line.len = __encode_line( encoding, line, line_size - 1, rec, msg, msg_len, &sink_line.msg_offset );
+        line[ sink_line.len ]     = '\n';
+        line[ sink_line.len + 1 ] = '\0';
+
+        __tinylog_sinks_write( encoded, &sink_line );
+    }
+}
+
+/**
+** Format the record as line for humans, as written to stderr (no '\n' is appended).
+** Returns the length of the line.
+*/
+size_t __tinylog_format_line( const log_record_t *rec, char *line, const size_t size )
+{
+    const char *msg = rec->msg;
+    size_t msg_len  = rec->len;
+
+    char stack_msg[ TINYLOG_MSG_SIZE ];
+    if( rec->flags & RECORD_DEFERRED )
+    {
+        msg = __render_msg( rec, stack_msg, sizeof( stack_msg ), &msg_len );
+    }
+
+    size_t msg_offset;
+
+    return __encode_line( LOG_ENCODING_HUMAN, line, size, rec, msg, msg_len, &msg_offset );
 }
 
 
@@ -312,17 +1008,15 @@ const char *strseverity( const int severity )
 
 
 /**
-** Retrieve the string representation (6 chars) of the given log destination.
+** Retrieve the string representation of the given log destination.
 ** If the given log destination is unknown UNKNOWN_LOG_DEST ('******') will be returned.
 */
 const char *strlog_dest( const log_dest_t log_dest )
 {
     // check for valid log destination
-    switch( log_dest ){
-        case STDERR:
-        case SYSLOG: 
-        case BOTH:
-            return LOG_DEST[ log_dest - 1 ];    // log_dest_t starts at 1
+    if( log_dest > 0 && log_dest <= ( STDERR | SYSLOG | LOGFILE | BINARY ) )
+    {
+        return LOG_DEST[ log_dest - 1 ];        // log_dest_t starts at 1
     }
 
     // return default for unknown log destination
@@ -330,35 +1024,98 @@ const char *strlog_dest( const log_dest_t log_dest )
 }
 
 
-static void __strtime ( char* str, const int str_len, const time_t *timep )
+/**
+** Retrieve the string representation of the given overflow policy.
+*/
+const char *strlog_overflow( const log_overflow_t overflow )
 {
-    struct tm result;
-
-    // Format as 14:37:52 
-    strftime(str, str_len, "%H:%M:%S", localtime_r(timep, &result));
+    switch( overflow ){
+        case OVERFLOW_BLOCK:
+        case OVERFLOW_DROP_NEWEST:
+        case OVERFLOW_DROP_OLDEST:
+            return LOG_OVERFLOW[ overflow ];
+    }
 
+    // return default for unknown overflow policy
+    return UNKNOWN_OVERFLOW;
 }
 
-static void __print_log_prefix (FILE *stream, const int severity, const char *func, const int line )
-{
-    const char *severity_str = strseverity( severity );
-
-    struct timeval cur_time;
-    gettimeofday(&cur_time, NULL);
-  
-    char cur_time_str[10];
-    __strtime( cur_time_str, 10, &cur_time.tv_sec );
 
-    const int millis = cur_time.tv_usec / 1000;
+/**
+** Format the prefix of a stderr line into the buffer.
+** Returns the length of the prefix (truncated to fit into the buffer including '\0').
+*/
+static size_t __format_log_prefix( char *str, const size_t size, const log_record_t *rec )
+{
+    struct timespec time;
+    __tinylog_wall_time( rec->stamp, rec->clock, &time );
 
     // looks like:
     // [Trace] 14:37:52,628 
-    fprintf( stream, "[%5s] %s,%03d ", severity_str, cur_time_str, millis );
+    char prefix[ 8 + TINYLOG_TIME_SIZE + 1 ];
 
-	if( __dev_logging )
+    prefix[ 0 ] = '[';
+    memcpy( prefix + 1, strseverity( rec->severity ), 5 );
+    prefix[ 6 ] = ']';
+    prefix[ 7 ] = ' ';
+    size_t len = 8 + __tinylog_format_time( prefix + 8, &time );
+    prefix[ len++ ] = ' ';
+
+    if( len > size - 1 )
     {
-        // append to stream:
+        len = size - 1;
+    }
+    memcpy( str, prefix, len );
+
+    if( rec->flags & RECORD_THREAD_INFO )
+    {
+        // append:
+        // [tid/name] or [tid] 
+        const int thread_len = rec->thread_name[ 0 ] != '\0'
+                ? snprintf( str + len, size - len, "[%d/%s] ", rec->tid, rec->thread_name )
+                : snprintf( str + len, size - len, "[%d] ", rec->tid );
+
+        if( thread_len > 0 )
+        {
+            len += (size_t) thread_len < size - len ? (size_t) thread_len : size - len - 1;
+        }
+    }
+
+    if( rec->sample_rate > 1 )
+    {
+        // append:
+        // [sampled 1/N] 
+        const int sample_len = snprintf( str + len, size - len, "[sampled 1/%u] ", rec->sample_rate );
+
+        if( sample_len > 0 )
+        {
+            len += (size_t) sample_len < size - len ? (size_t) sample_len : size - len - 1;
+        }
+    }
+
+    if( rec->category != 0 )
+    {
+        // append:
+        // category: 
+        const int cat_len = snprintf( str + len, size - len, "%s: ", strlog_category( rec->category ) );
+
+        if( cat_len > 0 )
+        {
+            len += (size_t) cat_len < size - len ? (size_t) cat_len : size - len - 1;
+        }
+    }
+
+    if( rec->flags & RECORD_DEV_LOGGING )
+    {
+        // append:
         // function_name():<line_number>: 
-        fprintf( stream, "%s():%03d: ", func, line );
+        const int dev_len = snprintf( str + len, size - len, "%s():%03d: ", rec->func, rec->line );
+
+        if( dev_len > 0 )
+        {
+            len += (size_t) dev_len < size - len ? (size_t) dev_len : size - len - 1;
+        }
     }
+
+    return len;
 }
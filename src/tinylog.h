@@ -26,9 +26,10 @@
 #include <stdio.h>      /* printf */
 #include <stdarg.h>     /* va_list, va_start, va_arg, va_end */
 #include <stdbool.h>    /* bool data type */
+#include <stdint.h>     /* uint64_t */
 
 #include <string.h>     /* strerror() */
-#include <time.h>       /* strftime(), localtime() */
+#include <time.h>       /* clock_gettime(), localtime_r() */
 
 #include <sys/time.h>   /* gettimeofday() */
 
@@ -48,15 +49,169 @@ extern "C" {
 #define LOG_INIT    (LOG_DEBUG+2)
 
 /**
-** Possible logging destinations
+** Count of severities, LOG_EMERG ... LOG_INIT
+*/
+#define TINYLOG_SEVERITIES  (LOG_INIT+1)
+
+/**
+** Possible logging destinations, may be combined (e.g. STDERR | LOGFILE)
 */
 enum LogDestination {
     STDERR=1,
     SYSLOG=2,
-    BOTH=3
+    BOTH=3,
+    LOGFILE=4,              // see open_tinylog_file()
+    BINARY=8                // see open_tinylog_binary()
 };
 typedef enum LogDestination log_dest_t;
 
+/**
+** How messages are sent to syslog
+*/
+enum LogSyslogMode {
+    SYSLOG_LIBC=0,          // syslog() of the C library
+    SYSLOG_RFC5424=1,       // RFC 5424 messages sent to /dev/log directly
+    SYSLOG_JOURNAL=2        // native protocol of the systemd journal with structured fields
+};
+typedef enum LogSyslogMode log_syslog_mode_t;
+
+/**
+** Handle of a log category, see tinylog_category()
+*/
+typedef unsigned char log_category_t;
+
+/**
+** Maximum count of log categories (including the default category 0)
+*/
+#define TINYLOG_MAX_CATEGORIES  64
+
+/**
+** Threshold of categories which follow the log threshold
+*/
+#define LOG_THRESHOLD_DEFAULT   (-1)
+
+/**
+** What the asynchronous logger should do if its queue is full
+*/
+enum LogOverflow {
+    OVERFLOW_BLOCK=0,           // wait until the writer thread made room
+    OVERFLOW_DROP_NEWEST=1,     // discard the message which should be queued
+    OVERFLOW_DROP_OLDEST=2      // discard the oldest message in the queue
+};
+typedef enum LogOverflow log_overflow_t;
+
+/**
+** Clocks to take the timestamps of log messages from.
+** Timestamps are always shown as wall clock time.
+*/
+enum LogClock {
+    LOG_CLOCK_REALTIME=0,       // wall clock
+    LOG_CLOCK_MONOTONIC=1,      // not affected by changes of the wall clock after it was selected
+    LOG_CLOCK_TSC=2             // CPU time stamp counter (x86 only), cheapest to read, calibrated when selected
+};
+typedef enum LogClock log_clock_t;
+
+/**
+** Layouts of the timestamps on stderr
+*/
+enum LogTimeLayout {
+    LOG_TIME_OF_DAY=0,          // 14:37:52,628
+    LOG_TIME_ISO8601=1,         // 2016-07-03T14:37:52.628+02:00
+    LOG_TIME_EPOCH=2            // 1467549472628 (units since the epoch, depending on the precision)
+};
+typedef enum LogTimeLayout log_time_layout_t;
+
+/**
+** Precision of the timestamps on stderr (count of fractional digits)
+*/
+enum LogTimePrecision {
+    LOG_TIME_MILLIS=3,
+    LOG_TIME_MICROS=6,
+    LOG_TIME_NANOS=9
+};
+typedef enum LogTimePrecision log_time_precision_t;
+
+/**
+** Encodings of log lines, selected per destination
+*/
+enum LogEncoding {
+    LOG_ENCODING_HUMAN=0,       // [Info ] 14:37:52,628 request done path=/index.html status=200
+    LOG_ENCODING_LOGFMT=1,      // time=14:37:52,628 level=info msg="request done" func=serve line=42 path=/index.html status=200
+    LOG_ENCODING_JSON=2         // {"time":"14:37:52,628","level":"info","msg":"request done",...,"status":200}
+};
+typedef enum LogEncoding log_encoding_t;
+
+/**
+** Types of the fields of structured log messages
+*/
+enum LogFieldType {
+    TL_FIELD_STR=0,
+    TL_FIELD_INT=1,
+    TL_FIELD_UINT=2,
+    TL_FIELD_DOUBLE=3,
+    TL_FIELD_BOOL=4,
+    TL_FIELD_DUR=5              // duration in nanoseconds
+};
+
+/**
+** A key/value field of a structured log message, see tinylog_kv()
+*/
+struct LogField {
+    const char         *key;
+    unsigned char       type;   // LogFieldType
+    union {
+        const char         *s;
+        long long           i;
+        unsigned long long  u;
+        double              d;
+        bool                b;
+    } value;
+};
+typedef struct LogField log_field_t;
+
+/**
+** Handle of a log sink, see open_tinylog_sink()
+*/
+typedef int log_sink_t;
+
+/**
+** Built-in sinks, written to as selected by the log destination
+*/
+#define LOG_SINK_STDERR     0
+#define LOG_SINK_SYSLOG     1
+#define LOG_SINK_LOGFILE    2
+
+/**
+** Maximum count of sinks (including the built-in ones)
+*/
+#define TINYLOG_MAX_SINKS   16
+
+/**
+** An encoded line handed to a sink
+*/
+struct LogSinkLine {
+    int                     severity;
+    log_category_t          category;
+    const char             *text;           // the line, followed by '\n' and '\0'
+    size_t                  len;            // length of the line without '\n'
+    size_t                  msg_offset;     // start of the message, behind the prefix of LOG_ENCODING_HUMAN
+    const struct LogRecord *record;         // the record the line was encoded from (internal)
+};
+typedef struct LogSinkLine log_sink_line_t;
+
+/**
+** Operations of a sink, all but 'write' may be NULL.
+** 'write' and 'flush' are called by any thread logging (or the writer thread
+** of the asynchronous logger), sinks have to serialize them on their own.
+*/
+struct LogSinkOps {
+    bool  (*open)( void *arg );                                 // when the sink is opened, false to refuse
+    void  (*write)( void *arg, const log_sink_line_t *line );
+    void  (*flush)( void *arg );                                // write what the sink collected
+    void  (*close)( void *arg );
+};
+typedef struct LogSinkOps log_sink_ops_t;
+
 //#################################################################################
 //  Lib function prototypes.
 //#################################################################################
@@ -87,6 +242,31 @@ void open_tinylog (
 );
 
 
+/**
+** Setup tinylog like open_tinylog() and start the asynchronous logger,
+** so that log messages are written by a background thread.
+*/
+void open_tinylog_async (
+        const char *ident,              // the identifier to use for syslog
+        const int options,
+        const int facility,
+        const int log_threshold,        // Log threshold, LOG_CRIT, ..., LOG_WARNING, ..., LOG_DEBUG, LOG_TRACE, LOG_INIT
+        const log_dest_t log_dest,      // Where the log messages should go to
+        const bool exit_on_error,       // Whether the log should quit the program on errors
+        const bool dev_logging,         // Whether __FUNCTION__ & __LINE__ should appear on stderr log
+        const unsigned queue_size,      // How many messages can be queued (rounded up to a power of two)
+        const log_overflow_t overflow   // What to do if the queue is full
+);
+
+
+/**
+** set_log_threshold(), set_log_dest(), set_exit_on_error(), set_dev_logging(),
+** set_log_thread_info(), set_log_recorder(), set_log_deferred() and set_log_max_msg_size()
+** (and their getters) only update atomics and don't log the change, so they may be called
+** from signal handlers (e.g. to raise the verbosity on SIGUSR1). Only invalid arguments
+** are logged as a warning. The other setters take locks or log, so they may not.
+*/
+
 /**
 ** Log threshold, LOG_CRIT, ..., LOG_WARNING, ..., LOG_DEBUG, LOG_TRACE, LOG_INIT
 **
@@ -138,9 +318,188 @@ void set_dev_logging( const bool dev_logging );
 bool get_dev_logging( void );
 
 
+/**
+** Whether the stderr log should include the id of the thread and its name,
+** e.g. '[4711/worker-1]' or just '[4711]' for threads without a name.
+** The id is taken once per thread, so log calls don't need a system call for it.
+**
+** default: false
+*/
+void set_log_thread_info( const bool thread_info );
+bool get_log_thread_info( void );
+
+
+/**
+** Name of the calling thread shown with set_log_thread_info() (up to 15 chars).
+*/
+void        set_log_thread_name( const char *name );
+const char *get_log_thread_name( void );
+
+
+/**
+** Id of the calling thread (gettid()), as shown with set_log_thread_info()
+*/
+int get_log_thread_id( void );
+
+
+/**
+** Whether messages should show the symbolic name of errno instead of its number,
+** e.g. '; Errno(ECONNRESET): Connection reset by peer' instead of '; Errno(104): ...'.
+** logfmt and JSON lines get an additional 'errno_name' field.
+**
+** default: false
+*/
+void set_log_errno_names( const bool errno_names );
+bool get_log_errno_names( void );
+
+
+/**
+** Retrieve the message of the given errno value, as strerror() would (but thread-safe).
+** The messages are looked up once, by open_tinylog() or the first call needing them.
+*/
+const char *strlog_errno( const int err_no );
+
+
+/**
+** Retrieve the symbolic name of the given errno value, e.g. 'ECONNRESET'.
+** Returns NULL for unknown values.
+*/
+const char *strlog_errno_name( const int err_no );
+
+
+/**
+** Whether log messages should be queued and written by a background thread
+** instead of being written by the calling thread.
+** Switching it off drains the queue and stops the background thread.
+**
+** default: false
+*/
+void set_log_async( const bool async );
+bool get_log_async( void );
+
+
+/**
+** Maximum length of a log message (without the verbose name for errno).
+** Longer messages are truncated and marked with '[...]'.
+** Short messages are formatted on the stack, longer ones into a buffer owned by the thread,
+** which is only reallocated when it has to grow.
+** The asynchronous logger reserves room for messages of the maximum length
+** for each entry of its queue when it is started.
+**
+** default: 1024
+*/
+void   set_log_max_msg_size( const size_t max_msg_size );
+size_t get_log_max_msg_size( void );
+
+
+/**
+** Whether the asynchronous logger should capture the raw arguments of log calls
+** and leave formatting the message to the writer thread.
+** Arguments which can't be captured (e.g. '%n', '%m', wide strings, or too much data)
+** are formatted by the calling thread as usual.
+** String arguments are copied, so they may be freed after the log call.
+** The format string is not copied, only string literals (see TINYLOG_LITERAL()) are deferred,
+** which live as long as the program. Messages with other format strings are formatted
+** by the calling thread, so their buffer may be reused or freed after the log call.
+**
+** default: false
+*/
+void set_log_deferred( const bool deferred );
+bool get_log_deferred( void );
+
+
+/**
+** How many messages the asynchronous logger can queue.
+** Rounded up to a power of two, takes effect when the asynchronous logger is started.
+**
+** default: 1024
+*/
+void     set_log_queue_size( const unsigned queue_size );
+unsigned get_log_queue_size( void );
+
+
+/**
+** What the asynchronous logger should do if its queue is full
+**
+** default: OVERFLOW_BLOCK
+*/
+void            set_log_overflow( const log_overflow_t overflow );
+log_overflow_t  get_log_overflow( void );
+
+
+/**
+** Count of messages discarded by the asynchronous logger because its queue was full.
+*/
+unsigned long get_log_dropped( void );
+
+
+/**
+** Report the messages suppressed by the protection against log storms,
+** wait until all messages queued so far have been written
+** and write the lines collected by the buffered output.
+*/
+void tinylog_flush( void );
+
+
+/**
+** Collect lines for stderr in a buffer of the given size (shared by all threads)
+** and write them with a single system call when the buffer is full or
+** the oldest line waited for 'latency_ms'. 0 bytes turns buffering off.
+** Larger buffers favor throughput, shorter latencies get lines out faster.
+**
+** default: 0 (off)
+*/
+void     set_log_buffering( const size_t size, const unsigned latency_ms );
+size_t   get_log_buffer_size( void );
+unsigned get_log_buffer_latency( void );
+
+
+/**
+** Lines of this severity or more critical are written right away, together with the buffer.
+** The buffer is also written before 'exit_on_error' quits the program.
+**
+** default: LOG_ERR
+*/
+void set_log_flush_level( const int severity );
+int  get_log_flush_level( void );
+
+
+/**
+** Clock to take the timestamps of log messages from.
+** Log calls only read the clock, the conversion to wall clock time is done
+** when the message is written.
+**
+** default: LOG_CLOCK_REALTIME
+*/
+void        set_log_clock( const log_clock_t clock );
+log_clock_t get_log_clock( void );
+
+
+/**
+** Whether timestamps should be taken from CLOCK_REALTIME_COARSE (or CLOCK_MONOTONIC_COARSE),
+** which is much cheaper to read but has a resolution of a few milliseconds only.
+**
+** default: false
+*/
+void set_log_coarse_clock( const bool coarse_clock );
+bool get_log_coarse_clock( void );
+
+
+/**
+** Layout and precision of the timestamps on stderr.
+** The formatter is selected once, so that log calls don't have to decide on it.
+**
+** default: LOG_TIME_OF_DAY, LOG_TIME_MILLIS
+*/
+void                 set_log_time_format( const log_time_layout_t layout, const log_time_precision_t precision );
+log_time_layout_t    get_log_time_layout( void );
+log_time_precision_t get_log_time_precision( void );
+
+
 /**
 ** Exit if a 'LOG_ERROR' or anything more critical was reported
 ** and 'exit_on_error' is set.
+** Queued messages are written before the program quits.
 */
 void do_exit_on_error( const int severity );
 
@@ -153,31 +512,520 @@ const char *strseverity( const int severity );
 
 
 /**
-** Retrieve the string representation (6 chars) of the given log destination.
+** Retrieve the string representation of the given log destination.
 ** If the given log destination is unknown UNKNOWN_LOG_DEST ('******') will be returned.
 */
 const char *strlog_dest( const log_dest_t log_dest );
 
 
+/**
+** Retrieve the string representation of the given overflow policy.
+*/
+const char *strlog_overflow( const log_overflow_t overflow );
+
+
+/**
+** How messages are sent to syslog.
+** SYSLOG_RFC5424 and SYSLOG_JOURNAL send datagrams to the socket of the daemon directly,
+** including the function and line of the log call (and errno for the journal).
+** The socket is non-blocking, messages which can't be sent right away are dropped.
+** The asynchronous logger sends its messages in batches.
+**
+** default: SYSLOG_LIBC
+*/
+void              set_log_syslog_mode( const log_syslog_mode_t mode );
+log_syslog_mode_t get_log_syslog_mode( void );
+
+
+/**
+** Socket the messages are sent to by SYSLOG_RFC5424 and SYSLOG_JOURNAL,
+** e.g. a local socket for testing. NULL for the default of the mode
+** ('/dev/log' or '/run/systemd/journal/socket').
+*/
+void set_log_syslog_socket( const char *path );
+
+
+/**
+** Count of messages which couldn't be sent to the syslog socket
+*/
+unsigned long get_log_syslog_dropped( void );
+
+
+/**
+** Retrieve the string representation of the given syslog mode.
+*/
+const char *strlog_syslog_mode( const log_syslog_mode_t mode );
+
+
+/**
+** Log file for the LOGFILE destination.
+** Lines are copied into a memory mapped segment of the file which is allocated up front,
+** so writing a line doesn't take a system call.
+** The file is rotated when the segment is full or 'rotate_seconds' passed (0 = only by size):
+** 'path' is renamed to 'path.1', 'path.1' to 'path.2' and so on, up to 'max_files' old files are kept.
+** 'segment_size' defaults to 16 MiB if 0 is passed.
+** If the disk is too full for a new segment, the error goes to stderr and no more lines are written to the file.
+** Returns false if the file can't be created.
+*/
+bool open_tinylog_file( const char *path, const size_t segment_size, const unsigned rotate_seconds, const unsigned max_files );
+void close_tinylog_file( void );
+
+
+/**
+** Binary log file for the BINARY destination, decoded by 'tinylog-decode'.
+** Records hold the raw arguments of the log call and ids of its format string and call site,
+** which are written to the file once, the first time they are used.
+** Formatting the message is left to the decoder, unless the arguments can't be captured.
+** Records are collected in a buffer and written when it is full, for messages
+** of the flush level (see set_log_flush_level()), by tinylog_flush() and when the program exits.
+** Returns false if the file can't be created.
+*/
+bool open_tinylog_binary( const char *path );
+void close_tinylog_binary( void );
+
+
+/**
+** Flight recorder: each thread keeps its last messages up to the given level in memory,
+** independent of the threshold, -1 turns it off.
+** The messages are dumped when the program quits because of 'exit_on_error',
+** on fatal signals (see set_log_crash_dump()) or by tinylog_dump_recorder().
+** Messages above the threshold are no longer dropped by the inline check of the macros.
+** Their arguments are only captured, which is cheap compared to formatting them. Messages whose format
+** isn't a string literal keep just the text of the format, without the arguments.
+**
+** default: -1 (off)
+*/
+void set_log_recorder( const int level );
+int  get_log_recorder( void );
+
+
+/**
+** Count of messages kept per thread, for threads which start recording afterwards.
+**
+** default: 256
+*/
+void     set_log_recorder_size( const unsigned size );
+unsigned get_log_recorder_size( void );
+
+
+/**
+** Whether the flight recorder is dumped to stderr on SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT,
+** before the signal is handed over to the action set before (e.g. the handler of the application,
+** or the default action). Turning the dump off restores these actions.
+**
+** default: false
+*/
+void set_log_crash_dump( const bool crash_dump );
+bool get_log_crash_dump( void );
+
+
+/**
+** Write the messages of the flight recorder to the file descriptor, oldest first for each thread.
+** Only write() is used, so it may be called from signal handlers.
+** Times are UTC, floating point numbers are shown with 6 decimals and
+** flags, width and precision of conversions are ignored.
+*/
+void tinylog_dump_recorder( const int fd );
+
+
+/**
+** How often the log file is synchronized to disk by a background thread (msync), 0 for never
+**
+** default: 1000 ms
+*/
+void     set_log_file_sync( const unsigned interval_ms );
+unsigned get_log_file_sync( void );
+
+
+/**
+** Protection against log storms, per call site (off by default).
+** Each call site may log up to 'per_second' messages per second, and 'burst' messages at once.
+** Further messages are dropped. 0 messages per second turns the rate limit off.
+*/
+void     set_log_rate_limit( const unsigned per_second, const unsigned burst );
+unsigned get_log_rate_limit( void );
+unsigned get_log_rate_burst( void );
+
+
+/**
+** Whether a message identical to the last one logged by the same call site should be suppressed.
+** Messages are identical if severity, errno, format string and arguments are.
+** How often it was repeated is logged before the next different message of the call site,
+** by tinylog_flush() and when the program exits.
+**
+** default: false
+*/
+void set_log_dedupe( const bool dedupe );
+bool get_log_dedupe( void );
+
+
+/**
+** Share the configuration with other processes: the threshold, destination, dev_logging
+** and the thresholds of the categories are kept in /dev/shm/tinylog.<ident>.<pid>
+** (ident defaults to the program name), which bin/tinylogctl lists and changes while the
+** process keeps running. Log calls read the shared block directly, it costs them nothing.
+** Best called before other threads are started, the file is removed at exit.
+** Children forked later on get a private copy.
+** Returns false if the block can't be shared.
+*/
+bool open_tinylog_control( const char *ident );
+void close_tinylog_control( void );
+
+
+/**
+** Whether open_tinylog() should share the configuration (see open_tinylog_control()).
+**
+** default: false
+*/
+void set_log_control( const bool control );
+bool get_log_control( void );
+
+
+/**
+** Log only 1 in 'one_in' calls of the given severity, chosen at random (0 or 1 for all).
+** The log macros decide before any argument is evaluated, each message logged
+** carries the rate (e.g. 'sample_rate=100'), so that counts can be scaled up again.
+** Errors and anything more critical are never sampled.
+** Calls which aren't sampled don't reach the flight recorder either.
+**
+** default: 0 (all)
+*/
+void     set_log_sampling( const int severity, const unsigned one_in );
+unsigned get_log_sampling( const int severity );
+
+
+/**
+** Log only 1 in 'one_in' calls of the category (less important than LOG_ERR),
+** instead of the rate of their severity. 0 follows the sampling of the severity again.
+**
+** default: 0
+*/
+void     set_log_category_sampling( const log_category_t category, const unsigned one_in );
+unsigned get_log_category_sampling( const log_category_t category );
+
+
+/**
+** Count of messages suppressed by the rate limit or as repetitions so far
+*/
+unsigned long get_log_suppressed( void );
+
+
+/**
+** Encoding of the lines written to the given destinations (may be combined, e.g. STDERR | LOGFILE).
+** Syslog gets the message without the prefix for LOG_ENCODING_HUMAN and the whole line otherwise.
+**
+** default: LOG_ENCODING_HUMAN
+*/
+void           set_log_encoding( const log_dest_t log_dest, const log_encoding_t encoding );
+log_encoding_t get_log_encoding( const log_dest_t log_dest );
+
+
+/**
+** Retrieve the string representation of the given encoding.
+*/
+const char *strlog_encoding( const log_encoding_t encoding );
+
+
+/**
+** Open a sink the log lines are written to, in addition to the log destination.
+** 'write' gets each line encoded for the sink, 'flush' is called when the writer thread of the
+** asynchronous logger emptied the queue, by tinylog_flush() and before the sink is closed.
+** Sinks still open are closed when the program exits.
+** Returns the id of the sink or -1 if no more sinks can be opened or 'open' failed.
+*/
+log_sink_t open_tinylog_sink( const char *name, const log_sink_ops_t *ops, void *arg );
+void       close_tinylog_sink( const log_sink_t sink );
+
+
+/**
+** Retrieve the id of the sink with the given name ("stderr", "syslog" and "file" for
+** the built-in ones), -1 if there is none.
+*/
+log_sink_t get_log_sink( const char *name );
+
+
+/**
+** Threshold of the sink, applied after the log threshold (or the threshold of the category),
+** e.g. to send only warnings to syslog while stderr gets everything.
+**
+** default: LOG_THRESHOLD_DEFAULT (all messages passing the log threshold)
+*/
+void set_log_sink_threshold( const log_sink_t sink, const int threshold );
+int  get_log_sink_threshold( const log_sink_t sink );
+
+
+/**
+** Encoding of the lines written to the sink, see set_log_encoding() for the built-in sinks.
+** Each record is encoded once per encoding, sinks using the same encoding share the line.
+**
+** default: LOG_ENCODING_HUMAN
+*/
+void           set_log_sink_encoding( const log_sink_t sink, const log_encoding_t encoding );
+log_encoding_t get_log_sink_encoding( const log_sink_t sink );
+
+
+/**
+** Retrieve the name of the given sink.
+*/
+const char *strlog_sink( const log_sink_t sink );
+
+
+/**
+** Register a log category (e.g. "net" or "db.pool") and retrieve its handle.
+** Registering the same name again returns the same handle.
+** The threshold of a new category is taken from the last rule set with
+** set_log_category_threshold() matching its name, without one it follows the log threshold.
+** Returns the default category 0 if no more categories can be registered.
+*/
+log_category_t tinylog_category( const char *name );
+
+
+/**
+** Log threshold for all categories whose names match the glob pattern (see fnmatch()),
+** including categories registered later on.
+** LOG_THRESHOLD_DEFAULT makes them follow the log threshold again.
+** Takes a lock, so it may not be called from signal handlers.
+*/
+void set_log_category_threshold( const char *pattern, const int log_threshold );
+int  get_log_category_threshold( const log_category_t category );
+
+
+/**
+** Retrieve the name of the given log category ("" for the default category 0).
+*/
+const char *strlog_category( const log_category_t category );
+
+
+/**
+** Whether the format string is a literal, which lives as long as the program and never changes.
+** Only literals are parsed once and cached by their address, formats in buffers which might
+** be reused are handed to vsnprintf() each time.
+*/
+#define TINYLOG_LITERAL( fmt_str )  __builtin_constant_p( fmt_str )
+
+
 /**
 ** Main routine handling the logging.
+** Kept out of line and marked as cold, so that log sites stay small
+** and the compiler moves them out of the hot path.
+*/
+void __tinylog( const int severity, const int err_no, const char *func, const int line,
+        const bool literal, const char *fmt_str, ... )
+    __attribute__ (( cold, noinline, format( printf, 6, 7 ) ));
+
+
+/**
+** Main routine handling the logging of categories.
+*/
+void __tinylog_cat( const log_category_t category, const int severity, const int err_no, const char *func, const int line,
+        const bool literal, const char *fmt_str, ... )
+    __attribute__ (( cold, noinline, format( printf, 7, 8 ) ));
+
+
+/**
+** Main routine handling structured log messages.
+*/
+void __tinylog_kv( const int severity, const int err_no, const char *func, const int line,
+        const char *msg, const log_field_t *fields, const unsigned field_count )
+    __attribute__ (( cold, noinline ));
+
+
+/**
+** Size of the control block, a page
+*/
+#define TINYLOG_CONTROL_SIZE        4096
+
+/**
+** Maximum length of category names (including '\0')
+*/
+#define TINYLOG_CATEGORY_NAME_SIZE  32
+
+/**
+** Everything checked by log calls, kept in a page of its own, so that it can be
+** shared with other processes (see open_tinylog_control()). Not to be used directly.
+**
+** The configuration is packed into a single word (see tinylog_internal.h).
+** Its lowest 32 bits are the gate: the highest severity which has to be handled by __tinylog(),
+** which is the log threshold or LOG_ERR if 'exit_on_error' is set and the threshold is lower.
+** The gates of the log categories are kept in a single cache line.
+*/
+struct LogControl {
+    uint64_t        config;                 // the configuration word
+    uint32_t        magic;                  // TINYLOG_CONTROL_MAGIC once shared
+    uint32_t        size;                   // sizeof( struct LogControl )
+    int32_t         pid;                    // process the block belongs to
+    char            ident[ 32 ];            // as passed to open_tinylog_control()
+    signed char     category_gates[ TINYLOG_MAX_CATEGORIES ] __attribute__ (( aligned( 64 ) ));
+    int32_t         category_thresholds[ TINYLOG_MAX_CATEGORIES ];  // LOG_THRESHOLD_DEFAULT to follow the log threshold
+    uint32_t        category_count;         // registered categories including the default category
+    uint64_t        category_generation;    // incremented for every change the gates depend on
+    char            category_names[ TINYLOG_MAX_CATEGORIES ][ TINYLOG_CATEGORY_NAME_SIZE ];
+} __attribute__ (( aligned( TINYLOG_CONTROL_SIZE ) ));
+
+extern struct LogControl __log_control;
+
+#define TINYLOG_GATE_MASK   0xFFFFFFFFull
+
+#define TINYLOG_GATE()      ( (int) ( __atomic_load_n( &__log_control.config, __ATOMIC_RELAXED ) & TINYLOG_GATE_MASK ) )
+
+#define TINYLOG_CATEGORY_GATE( category ) \
+    ( __atomic_load_n( &__log_control.category_gates[ (log_category_t) (category) % TINYLOG_MAX_CATEGORIES ], __ATOMIC_RELAXED ) )
+
+
+/**
+** Sampling limits per severity and per category, see set_log_sampling().
+** Calls pass if the next random number of the thread is at most the limit, 0 lets all pass.
+** Not to be used directly.
+*/
+extern uint32_t __log_sampling[ TINYLOG_SEVERITIES ];
+extern uint32_t __log_category_sampling[ TINYLOG_MAX_CATEGORIES ];
+extern __thread uint32_t __log_sample_state;
+
+uint32_t __tinylog_sample_seed( void ) __attribute__ (( cold, noinline ));
+
+/**
+** Limit of a log call, the one of the category if set.
+*/
+static inline uint32_t __tinylog_sampling( const log_category_t category, const int severity )
+{
+    if( severity <= LOG_ERR || severity >= TINYLOG_SEVERITIES )
+    {
+        return 0;
+    }
+
+    const uint32_t limit = category != 0
+            ? __atomic_load_n( &__log_category_sampling[ category % TINYLOG_MAX_CATEGORIES ], __ATOMIC_RELAXED )
+            : 0;
+
+    return limit != 0 ? limit : __atomic_load_n( &__log_sampling[ severity ], __ATOMIC_RELAXED );
+}
+
+/**
+** Whether the log call passes the sampling: the next number of the xorshift
+** generator of the thread is compared with the limit.
+*/
+static inline bool __tinylog_sampled( const log_category_t category, const int severity )
+{
+    const uint32_t limit = __tinylog_sampling( category, severity );
+    if( __builtin_expect( limit == 0, 1 ) )
+    {
+        return true;
+    }
+
+    uint32_t x = __log_sample_state;
+    if( __builtin_expect( x == 0, 0 ) )
+    {
+        x = __tinylog_sample_seed();
+    }
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    __log_sample_state = x;
+
+    return x <= limit;
+}
+
+#define TINYLOG_SAMPLED( category, severity )   __tinylog_sampled( (category), (severity) )
+
+
+/**
+** Log calls less important than TINYLOG_MIN_LEVEL are removed at compile time,
+** e.g. -DTINYLOG_MIN_LEVEL=LOG_INFO drops all log_DEBUG(), log_TRACE() and log_INIT() calls
+** from release builds. Their format strings and arguments are still checked by the compiler,
+** but neither evaluated nor emitted.
+** Errors and anything more critical can't be removed, they might have to quit the program.
+**
+** default: LOG_INIT (nothing is removed)
 */
-void __tinylog( const int severity, const int errno, const char *func, const int line, const char *fmt_str, ... );
+#ifndef TINYLOG_MIN_LEVEL
+#define TINYLOG_MIN_LEVEL   LOG_INIT
+#endif
+
+#if TINYLOG_MIN_LEVEL < LOG_ERR
+#error "TINYLOG_MIN_LEVEL may not remove errors (must be LOG_ERR or higher)"
+#endif
 
 
 /**
 ** Short circuit log level evaluation to avoid unnecessary function calls
 ** for argruments pretty printing, etc.
+** A disabled log call costs a single load, a compare and a branch which is predicted as not taken.
+** Calls less important than TINYLOG_MIN_LEVEL are removed at compile time (for constant severities).
 */
 #define tinylog(severity, errno, fmt_str, args...)  do \
 {   /* return fast if no message would be logged to avoid unnecessary function calls */ \
     /* but only if would not exit, so the last error message ist still shown */ \
     /* the logging routine will take care of the exit */ \
-    if( !is_enabled( (severity) ) && !would_exit( (severity) ) ) \
+    if( (severity) <= TINYLOG_MIN_LEVEL && \
+        __builtin_expect( (severity) <= TINYLOG_GATE(), 0 ) && TINYLOG_SAMPLED( 0, (severity) ) ) \
+    { \
+        __tinylog((severity), (errno), __FUNCTION__, __LINE__, TINYLOG_LITERAL( fmt_str ), (fmt_str), ##args); \
+    } \
+} while (0)
+
+
+/**
+** Log call for a category, e.g.
+**     static log_category_t net = tinylog_category( "net" );
+**     tinylog_cat(net, LOG_DEBUG, 0, "connected to %s", host);
+** Like tinylog(), the check whether the message would be logged is done inline.
+** Calls less important than TINYLOG_MIN_LEVEL are removed at compile time (for constant severities).
+*/
+#define tinylog_cat(category, severity, errno, fmt_str, args...)  do \
+{ \
+    if( (severity) <= TINYLOG_MIN_LEVEL && \
+        __builtin_expect( (severity) <= TINYLOG_CATEGORY_GATE( (category) ), 0 ) && \
+        TINYLOG_SAMPLED( (category), (severity) ) ) \
+    { \
+        __tinylog_cat((category), (severity), (errno), __FUNCTION__, __LINE__, TINYLOG_LITERAL( fmt_str ), (fmt_str), ##args); \
+    } \
+} while (0)
+
+
+/**
+** Fields of structured log messages
+*/
+#define TL_STR(key, val)     { (key), TL_FIELD_STR,    { .s = (val) } }
+#define TL_INT(key, val)     { (key), TL_FIELD_INT,    { .i = (long long) (val) } }
+#define TL_UINT(key, val)    { (key), TL_FIELD_UINT,   { .u = (unsigned long long) (val) } }
+#define TL_DOUBLE(key, val)  { (key), TL_FIELD_DOUBLE, { .d = (double) (val) } }
+#define TL_BOOL(key, val)    { (key), TL_FIELD_BOOL,   { .b = (val) != 0 } }
+#define TL_DUR(key, nanos)   { (key), TL_FIELD_DUR,    { .i = (long long) (nanos) } }
+
+/**
+** Structured log call, e.g.
+**     tinylog_kv(LOG_INFO, 0, "request done", TL_STR("path", path), TL_INT("status", 200), TL_DUR("latency", ns));
+** The message is taken as it is (no printf() formatting), the fields are written
+** as selected by set_log_encoding(): ' key=value' for humans, as logfmt or as JSON.
+** Like tinylog(), the check whether the message would be logged is done inline
+** and the fields are only built if it is.
+*/
+#define tinylog_kv(severity, errno, msg, fields...)  do \
+{ \
+    if( (severity) <= TINYLOG_MIN_LEVEL && \
+        __builtin_expect( (severity) <= TINYLOG_GATE(), 0 ) && TINYLOG_SAMPLED( 0, (severity) ) ) \
+    { \
+        const log_field_t __tinylog_fields[] = { fields }; \
+        __tinylog_kv((severity), (errno), __FUNCTION__, __LINE__, (msg), \
+                __tinylog_fields, sizeof( __tinylog_fields ) / sizeof( log_field_t )); \
+    } \
+} while (0)
+
+
+/**
+** Type checks the arguments of removed log calls, never called.
+*/
+static inline void __tinylog_discard( const char *fmt_str, ... ) __attribute__ (( format( printf, 1, 2 ) ));
+static inline void __tinylog_discard( const char *fmt_str, ... ) { (void) fmt_str; }
+
+#define tinylog_discarded(severity, errno, fmt_str, args...)  do \
+{ \
+    if( 0 ) \
     { \
-        break; \
+        (void) (errno); \
+        __tinylog_discard((fmt_str), ##args); \
     } \
-   __tinylog((severity), (errno), __FUNCTION__, __LINE__, (fmt_str), ##args); \
 } while (0)
 
 
@@ -188,12 +1036,42 @@ void __tinylog( const int severity, const int errno, const char *func, const int
 #define log_ALERT(   errno, fmt_str, args...)  tinylog(LOG_ALERT,   (errno), (fmt_str), ##args)
 #define log_CRIT(    errno, fmt_str, args...)  tinylog(LOG_CRIT,    (errno), (fmt_str), ##args)
 #define log_ERR(     errno, fmt_str, args...)  tinylog(LOG_ERR,     (errno), (fmt_str), ##args)
+
+#if TINYLOG_MIN_LEVEL >= LOG_WARNING
 #define log_WARNING( errno, fmt_str, args...)  tinylog(LOG_WARNING, (errno), (fmt_str), ##args)
+#else
+#define log_WARNING( errno, fmt_str, args...)  tinylog_discarded(LOG_WARNING, (errno), (fmt_str), ##args)
+#endif
+
+#if TINYLOG_MIN_LEVEL >= LOG_NOTICE
 #define log_NOTICE(  errno, fmt_str, args...)  tinylog(LOG_NOTICE,  (errno), (fmt_str), ##args)
+#else
+#define log_NOTICE(  errno, fmt_str, args...)  tinylog_discarded(LOG_NOTICE,  (errno), (fmt_str), ##args)
+#endif
+
+#if TINYLOG_MIN_LEVEL >= LOG_INFO
 #define log_INFO(    errno, fmt_str, args...)  tinylog(LOG_INFO,    (errno), (fmt_str), ##args)
+#else
+#define log_INFO(    errno, fmt_str, args...)  tinylog_discarded(LOG_INFO,    (errno), (fmt_str), ##args)
+#endif
+
+#if TINYLOG_MIN_LEVEL >= LOG_DEBUG
 #define log_DEBUG(   errno, fmt_str, args...)  tinylog(LOG_DEBUG,   (errno), (fmt_str), ##args)
+#else
+#define log_DEBUG(   errno, fmt_str, args...)  tinylog_discarded(LOG_DEBUG,   (errno), (fmt_str), ##args)
+#endif
+
+#if TINYLOG_MIN_LEVEL >= LOG_TRACE
 #define log_TRACE(   errno, fmt_str, args...)  tinylog(LOG_TRACE,   (errno), (fmt_str), ##args)
+#else
+#define log_TRACE(   errno, fmt_str, args...)  tinylog_discarded(LOG_TRACE,   (errno), (fmt_str), ##args)
+#endif
+
+#if TINYLOG_MIN_LEVEL >= LOG_INIT
 #define log_INIT(    errno, fmt_str, args...)  tinylog(LOG_INIT,    (errno), (fmt_str), ##args)
+#else
+#define log_INIT(    errno, fmt_str, args...)  tinylog_discarded(LOG_INIT,    (errno), (fmt_str), ##args)
+#endif
 
 
 #ifdef __cplusplus
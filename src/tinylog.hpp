@@ -0,0 +1,637 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Type safe log calls for C++ (C++20 or later), header only.
+**
+** Include this header instead of tinylog.h. The log macros keep their names and their
+** levels (tinylog(), tinylog_cat(), log_ERR(), ..., TINYLOG_MIN_LEVEL), but the format string
+** is checked against the types of the arguments at compile time:
+**
+**     std::string_view path = ...;
+**     log_INFO( 0, "request %d for %s took %.3f ms", id, path, millis );     // fine
+**     log_INFO( 0, "request %s", id );                                         // doesn't compile
+**
+** Conversions take arguments of their kind:
+**  - d i u o x X c: integers, bool and enums; the length modifier may be left out,
+**    it's added for the size of the argument (e.g. "%d" for an int64_t becomes "%ld")
+**  - f F e E g G a A: float, double and long double ("L" is added for long double)
+**  - s: const char *, std::string and std::string_view (passed as "%.*s", no copies)
+**  - p: pointers
+**
+** For each log call (and argument types) the format string is rewritten once at compile
+** time and kept as a constant, so a wrong format can't reach the runtime. The message is
+** logged by __tinylog() / __tinylog_cat() as from C, which parse the rewritten format
+** on its first use and cache it, the output is the same.
+**
+** The format string has to be a string literal (or another constant expression).
+*/
+
+#ifndef _TINYLOG_HPP
+#define _TINYLOG_HPP
+
+#if __cplusplus < 202002L
+#error "tinylog.hpp requires C++20 (e.g. -std=c++20)"
+#endif
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "tinylog.h"
+
+namespace tinylog {
+
+//#################################################################################
+//  Argument types
+//#################################################################################
+
+/**
+** Kinds of arguments, as far as printf() is concerned
+*/
+enum class __kind {
+    UNSUPPORTED,
+    INTEGER,
+    FLOATING,
+    LONG_DOUBLE,
+    C_STRING,
+    STRING_VIEW,
+    POINTER
+};
+
+template<typename T>
+consteval __kind __kind_of()
+{
+    using U = std::remove_cv_t<T>;
+
+    if constexpr( std::is_same_v<U, std::string> || std::is_same_v<U, std::string_view> )
+    {
+        return __kind::STRING_VIEW;
+    }
+    else if constexpr( std::is_integral_v<U> || std::is_enum_v<U> )
+    {
+        return __kind::INTEGER;
+    }
+    else if constexpr( std::is_same_v<U, long double> )
+    {
+        return __kind::LONG_DOUBLE;
+    }
+    else if constexpr( std::is_floating_point_v<U> )
+    {
+        return __kind::FLOATING;
+    }
+    else if constexpr( std::is_pointer_v<U> && std::is_same_v<std::remove_cv_t<std::remove_pointer_t<U>>, char> )
+    {
+        return __kind::C_STRING;
+    }
+    else if constexpr( std::is_pointer_v<U> || std::is_null_pointer_v<U> )
+    {
+        return __kind::POINTER;
+    }
+    else
+    {
+        return __kind::UNSUPPORTED;
+    }
+}
+
+template<typename T>
+consteval std::size_t __size_of()
+{
+    if constexpr( std::is_enum_v<T> )
+    {
+        return sizeof( std::underlying_type_t<T> );
+    }
+    else
+    {
+        return sizeof( T );
+    }
+}
+
+/**
+** Argument as seen by the format check
+*/
+struct __arg {
+    __kind      kind;
+    std::size_t size;
+};
+
+//#################################################################################
+//  Format check
+//#################################################################################
+
+/**
+** Not constexpr: calling it while checking a format fails the compilation,
+** the compiler shows the reason in its notes.
+*/
+inline void __format_error( const char *reason ) { (void) reason; }
+
+/**
+** How an argument is passed to __tinylog()
+*/
+enum : int {
+    __PASS_VALUE = -1,      // as it is (integers, floating point and pointers)
+    __PASS_VIEW  = -2       // as length and pointer for "%.*s"
+                            // (>= 0: the same, length limited to the precision of the format)
+};
+
+/**
+** Result of checking a format string: the size of the format for __tinylog()
+** and how the arguments have to be passed.
+*/
+template<std::size_t ARGS>
+struct __checked {
+    std::size_t size = 0;
+    int         pass[ ARGS ? ARGS : 1 ] = {};
+};
+
+consteval bool __is_digit( const char c )
+{
+    return c >= '0' && c <= '9';
+}
+
+consteval bool __contains( const char *set, const char c )
+{
+    for( ; *set; set++ )
+    {
+        if( *set == c )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+** Check the format string against the arguments and write the format for __tinylog() into 'out'
+** (if not nullptr, it has to have the size returned).
+*/
+template<std::size_t ARGS>
+consteval __checked<ARGS> __check( const char *fmt, const __arg ( &args )[ ARGS ? ARGS : 1 ], char *out )
+{
+    __checked<ARGS> checked;
+
+    std::size_t len = 0;
+    std::size_t next = 0;
+
+    const auto put = [ & ]( const char c ) {
+        if( out )
+        {
+            out[ len ] = c;
+        }
+        len++;
+    };
+
+    const auto take = [ & ]() -> const __arg & {
+        if( next >= ARGS )
+        {
+            __format_error( "too few arguments for the format" );
+        }
+        return args[ next++ ];
+    };
+
+    // '*' takes an int
+    const auto take_int = [ & ]() {
+        const __arg &arg = take();
+        if( arg.kind != __kind::INTEGER || arg.size > sizeof( int ) )
+        {
+            __format_error( "'*' needs an int" );
+        }
+    };
+
+    for( const char *p = fmt; *p; )
+    {
+        if( *p != '%' )
+        {
+            put( *p++ );
+            continue;
+        }
+        put( *p++ );
+
+        if( *p == '%' )
+        {
+            put( *p++ );
+            continue;
+        }
+
+        // flags
+        while( __contains( "-+ #0'", *p ) && *p )
+        {
+            put( *p++ );
+        }
+
+        // width
+        if( *p == '*' )
+        {
+            take_int();
+            put( *p++ );
+        }
+        while( __is_digit( *p ) )
+        {
+            put( *p++ );
+        }
+
+        // precision
+        const char *precision = nullptr;
+        int precision_value = 0;
+        if( *p == '.' )
+        {
+            precision = p++;
+            if( *p == '*' )
+            {
+                take_int();
+                p++;
+            }
+            while( __is_digit( *p ) )
+            {
+                precision_value = precision_value * 10 + ( *p++ - '0' );
+            }
+        }
+
+        // length modifier
+        const char *modifier = p;
+        while( __contains( "hlLqjzt", *p ) && *p )
+        {
+            p++;
+        }
+        const std::string_view length( modifier, p - modifier );
+
+        const char conversion = *p++;
+        if( conversion == '\0' )
+        {
+            __format_error( "incomplete conversion at the end of the format" );
+        }
+
+        // copies the precision as it is
+        const auto put_precision = [ & ]() {
+            for( const char *q = precision; q && q < modifier; q++ )
+            {
+                put( *q );
+            }
+        };
+
+        if( conversion == 'm' )
+        {
+            // strerror( errno ), no argument
+            put_precision();
+            put( conversion );
+            continue;
+        }
+
+        const std::size_t index = next;
+        const __arg &arg = take();
+        checked.pass[ index ] = __PASS_VALUE;
+
+        if( __contains( "diouxXc", conversion ) )
+        {
+            if( arg.kind != __kind::INTEGER || arg.size > sizeof( long long ) )
+            {
+                __format_error( "integer conversion needs an integer" );
+            }
+            if( conversion == 'c' && arg.size > sizeof( int ) )
+            {
+                __format_error( "'%c' needs a char or an int" );
+            }
+            put_precision();
+
+            if( length.empty() )
+            {
+                // fitting the argument
+                if( arg.size > sizeof( int ) && conversion != 'c' )
+                {
+                    put( 'l' );
+                    if( arg.size > sizeof( long ) )
+                    {
+                        put( 'l' );
+                    }
+                }
+            }
+            else
+            {
+                std::size_t expected = 0;
+                if( length == "hh" || length == "h" )
+                {
+                    expected = sizeof( int );   // narrowed by printf()
+                }
+                else if( length == "l" )
+                {
+                    expected = sizeof( long );
+                }
+                else if( length == "ll" || length == "q" )
+                {
+                    expected = sizeof( long long );
+                }
+                else if( length == "j" )
+                {
+                    expected = sizeof( intmax_t );
+                }
+                else if( length == "z" )
+                {
+                    expected = sizeof( size_t );
+                }
+                else if( length == "t" )
+                {
+                    expected = sizeof( ptrdiff_t );
+                }
+                else
+                {
+                    __format_error( "unknown length modifier for integer conversion" );
+                }
+
+                if( conversion == 'c' && length != "hh" && length != "h" )
+                {
+                    __format_error( "wide characters are not supported" );
+                }
+                if( expected == sizeof( int ) ? arg.size > expected : arg.size != expected )
+                {
+                    __format_error( "length modifier doesn't match the size of the argument" );
+                }
+                for( const char c : length )
+                {
+                    put( c );
+                }
+            }
+        }
+        else if( __contains( "fFeEgGaA", conversion ) )
+        {
+            if( arg.kind == __kind::FLOATING )
+            {
+                if( !length.empty() && length != "l" )
+                {
+                    __format_error( "length modifier doesn't match double" );
+                }
+                put_precision();
+            }
+            else if( arg.kind == __kind::LONG_DOUBLE )
+            {
+                if( !length.empty() && length != "L" )
+                {
+                    __format_error( "length modifier doesn't match long double" );
+                }
+                put_precision();
+                put( 'L' );
+            }
+            else
+            {
+                __format_error( "floating point conversion needs a floating point number" );
+            }
+        }
+        else if( conversion == 's' )
+        {
+            if( !length.empty() )
+            {
+                __format_error( "wide strings are not supported" );
+            }
+
+            if( arg.kind == __kind::C_STRING )
+            {
+                put_precision();
+            }
+            else if( arg.kind == __kind::STRING_VIEW )
+            {
+                if( precision && precision[ 1 ] == '*' )
+                {
+                    __format_error( "'%.*s' needs a const char *" );
+                }
+                checked.pass[ index ] = precision ? precision_value : __PASS_VIEW;
+                put( '.' );
+                put( '*' );
+            }
+            else
+            {
+                __format_error( "'%s' needs a string" );
+            }
+        }
+        else if( conversion == 'p' )
+        {
+            if( arg.kind != __kind::POINTER && arg.kind != __kind::C_STRING )
+            {
+                __format_error( "'%p' needs a pointer" );
+            }
+            if( !length.empty() )
+            {
+                __format_error( "'%p' takes no length modifier" );
+            }
+            put_precision();
+        }
+        else if( conversion == 'n' )
+        {
+            __format_error( "'%n' is not supported" );
+        }
+        else
+        {
+            __format_error( "unknown conversion" );
+        }
+        put( conversion );
+    }
+
+    if( next != ARGS )
+    {
+        __format_error( "too many arguments for the format" );
+    }
+
+    put( '\0' );
+    checked.size = len;
+
+    return checked;
+}
+
+/**
+** The format string of a log call, checked and rewritten for the types of its arguments.
+** Format is a type providing the format string as Format::str().
+*/
+template<typename Format, typename... Args>
+struct __compiled {
+    static constexpr __arg args[ sizeof...( Args ) ? sizeof...( Args ) : 1 ] = {
+        { __kind_of<Args>(), __size_of<Args>() }...
+    };
+
+    static constexpr __checked<sizeof...( Args )> checked = __check<sizeof...( Args )>( Format::str(), args, nullptr );
+
+    static consteval std::array<char, checked.size> __rewrite()
+    {
+        std::array<char, checked.size> str {};
+        __check<sizeof...( Args )>( Format::str(), args, str.data() );
+
+        return str;
+    }
+
+    // a single copy per log call, its address doesn't change (see the format cache)
+    static constexpr std::array<char, checked.size> str = __rewrite();
+
+    static_assert( ( ( __kind_of<Args>() != __kind::UNSUPPORTED ) && ... ),
+        "argument type can't be logged (integers, floating point numbers, strings and pointers only)" );
+};
+
+//#################################################################################
+//  Passing the arguments
+//#################################################################################
+
+template<int PASS, typename T>
+inline auto __pass( const T &value )
+{
+    using D = std::decay_t<T>;
+
+    if constexpr( std::is_same_v<D, std::string> || std::is_same_v<D, std::string_view> )
+    {
+        const std::size_t len = PASS >= 0 && (std::size_t) PASS < value.size() ? PASS : value.size();
+        return std::tuple<int, const char *>( (int) len, value.data() );
+    }
+    else if constexpr( std::is_enum_v<D> )
+    {
+        return std::tuple( static_cast<std::underlying_type_t<D>>( value ) );
+    }
+    else if constexpr( std::is_null_pointer_v<D> )
+    {
+        return std::tuple( (const void *) nullptr );
+    }
+    else
+    {
+        // arrays as pointers
+        return std::tuple<std::decay_t<const T>>( value );
+    }
+}
+
+template<typename Compiled, typename... Args, std::size_t... I>
+inline auto __pass_all( std::index_sequence<I...>, const Args &...args )
+{
+    return std::tuple_cat( __pass<Compiled::checked.pass[ I ]>( args )... );
+}
+
+/**
+** Log a message with a format checked at compile time.
+*/
+template<typename Format, typename... Args>
+inline void __log(
+    const log_category_t category,
+    const int severity,
+    const int err_no,
+    const char *func,
+    const int line,
+    const Args &...args
+)
+{
+    using compiled = __compiled<Format, std::decay_t<Args>...>;
+
+    // the format has been checked already, it's a constant like a literal
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+    std::apply( [ & ]( const auto &...values ) {
+        if( category )
+        {
+            __tinylog_cat( category, severity, err_no, func, line, true, compiled::str.data(), values... );
+        }
+        else
+        {
+            __tinylog( severity, err_no, func, line, true, compiled::str.data(), values... );
+        }
+    }, __pass_all<compiled>( std::index_sequence_for<Args...>(), args... ) );
+#pragma GCC diagnostic pop
+}
+
+/**
+** Check the format of a removed log call, never called.
+** The rewritten format is only looked at in an unevaluated context, so it isn't emitted.
+*/
+template<typename Format, typename... Args>
+inline void __discard( const Args &... )
+{
+    static_assert( sizeof( __compiled<Format, std::decay_t<Args>...>::checked ) > 0 );
+}
+
+} // namespace tinylog
+
+
+//#################################################################################
+//  Log macros
+//#################################################################################
+
+/**
+** The format string as type, so that it can be checked and rewritten at compile time.
+*/
+#define __TINYLOG_FORMAT(fmt_str) \
+    struct __tinylog_format { static consteval const char *str() { return (fmt_str); } }
+
+#undef tinylog
+#undef tinylog_cat
+#undef tinylog_discarded
+
+/**
+** Whether the log call is removed at compile time: its severity is a constant less important
+** than TINYLOG_MIN_LEVEL. The call is a discarded statement then, so not even its rewritten
+** format is emitted (also without optimization), the format is still checked.
+*/
+#define __TINYLOG_REMOVED(severity) \
+    ( __builtin_constant_p( (severity) ) && (severity) > TINYLOG_MIN_LEVEL )
+
+/**
+** Like tinylog() of tinylog.h, with the format checked at compile time.
+*/
+#define tinylog(severity, errno, fmt_str, args...)  do \
+{   /* return fast if no message would be logged to avoid unnecessary function calls */ \
+    if constexpr( __TINYLOG_REMOVED( severity ) ) \
+    { \
+        tinylog_discarded((severity), (errno), (fmt_str), ##args); \
+    } \
+    else if( (severity) <= TINYLOG_MIN_LEVEL && \
+        __builtin_expect( (severity) <= TINYLOG_GATE(), 0 ) && TINYLOG_SAMPLED( 0, (severity) ) ) \
+    { \
+        __TINYLOG_FORMAT(fmt_str); \
+        ::tinylog::__log<__tinylog_format>(0, (severity), (errno), __FUNCTION__, __LINE__, ##args); \
+    } \
+} while (0)
+
+/**
+** Like tinylog_cat() of tinylog.h, with the format checked at compile time.
+*/
+#define tinylog_cat(category, severity, errno, fmt_str, args...)  do \
+{ \
+    if constexpr( __TINYLOG_REMOVED( severity ) ) \
+    { \
+        tinylog_discarded((severity), (errno), (fmt_str), ##args); \
+    } \
+    else if( (severity) <= TINYLOG_MIN_LEVEL && \
+        __builtin_expect( (severity) <= TINYLOG_CATEGORY_GATE( (category) ), 0 ) && \
+        TINYLOG_SAMPLED( (category), (severity) ) ) \
+    { \
+        __TINYLOG_FORMAT(fmt_str); \
+        ::tinylog::__log<__tinylog_format>((category), (severity), (errno), __FUNCTION__, __LINE__, ##args); \
+    } \
+} while (0)
+
+/**
+** Log calls removed by TINYLOG_MIN_LEVEL, their formats are still checked.
+*/
+#define tinylog_discarded(severity, errno, fmt_str, args...)  do \
+{ \
+    if( 0 ) \
+    { \
+        __TINYLOG_FORMAT(fmt_str); \
+        (void) (errno); \
+        ::tinylog::__discard<__tinylog_format>(args); \
+    } \
+} while (0)
+
+
+#endif // _TINYLOG_HPP
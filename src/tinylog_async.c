@@ -0,0 +1,644 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Asynchronous logger.
+**
+** Log calls reserve a slot in a bounded lock-free queue (multi-producer,
+** based on per slot sequence numbers), fill the record in place and commit it.
+** A background thread takes the records out of the queue and writes them
+** to their destinations.
+*/
+
+#include <pthread.h>
+#include <sched.h>      /* sched_yield() */
+
+#include "tinylog_internal.h"
+
+/**
+** A slot of the queue, followed by the buffer for the message.
+** 'seq' equals the enqueue position while the slot is free,
+** the enqueue position + 1 while it holds a committed record.
+*/
+struct LogSlot {
+    unsigned long   seq;
+    log_record_t    rec;
+};
+typedef struct LogSlot log_slot_t;
+
+/**
+** The queue, allocated when the asynchronous logger is started.
+** Slots are 'slot_size' bytes apart, to make room for messages
+** of the maximum length.
+*/
+static char            *__queue = NULL;
+static unsigned long    __queue_mask;
+static size_t           __slot_size;
+
+/**
+** Positions of producers and consumers, kept apart to avoid false sharing
+*/
+static unsigned long    __enqueue_pos __attribute__((aligned(64)));
+static unsigned long    __dequeue_pos __attribute__((aligned(64)));
+
+/**
+** Count of records which have been written or discarded after being queued
+*/
+static unsigned long    __done __attribute__((aligned(64)));
+
+/**
+** Count of messages discarded because the queue was full
+*/
+static unsigned long    __dropped;
+
+/**
+** Count of log calls currently using the queue
+*/
+static unsigned long    __producers;
+
+/**
+** Whether the asynchronous logger is running
+*/
+static bool             __async = false;
+
+/**
+** How many messages can be queued (atomic)
+*/
+static unsigned         __log_queue_size = 1024;
+
+/**
+** What to do if the queue is full (atomic)
+*/
+static log_overflow_t   __log_overflow = OVERFLOW_BLOCK;
+
+/**
+** Serializes starting and stopping the background thread
+*/
+static pthread_mutex_t  __async_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+** The background thread and everything needed to wake it up or wait for it
+*/
+static pthread_t        __writer;
+static pthread_mutex_t  __lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   __wakeup  = PTHREAD_COND_INITIALIZER;   // writer waits for records
+static pthread_cond_t   __drained = PTHREAD_COND_INITIALIZER;   // flush waits for the writer
+static bool             __writer_sleeping = false;
+static bool             __stop = false;
+static unsigned         __flush_waiters = 0;
+
+// internal prototypes
+
+static log_slot_t *__take( unsigned long *pos );
+static void __release( log_slot_t *slot, const unsigned long pos );
+static void __wake_writer( void );
+static void __drain_queue( void );
+
+
+// functions
+
+static inline log_slot_t *__slot_at( const unsigned long pos )
+{
+    return (log_slot_t *) ( __queue + ( pos & __queue_mask ) * __slot_size );
+}
+
+static inline log_slot_t *__slot_of( log_record_t *rec )
+{
+    return (log_slot_t *) ( (char *) rec - __builtin_offsetof( log_slot_t, rec ) );
+}
+
+/**
+** Reserve a free slot, returns NULL if the queue is full.
+*/
+static log_slot_t *__reserve( void )
+{
+    unsigned long pos = __atomic_load_n( &__enqueue_pos, __ATOMIC_RELAXED );
+
+    for( ;; )
+    {
+        log_slot_t *slot = __slot_at( pos );
+        const unsigned long seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+        const long diff = (long) seq - (long) pos;
+
+        if( diff == 0 )
+        {
+            if( __atomic_compare_exchange_n( &__enqueue_pos, &pos, pos + 1, true,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+            {
+                return slot;
+            }
+        }
+        else if( diff < 0 )
+        {
+            // slot still holds a record of the previous round
+            return NULL;
+        }
+        else
+        {
+            pos = __atomic_load_n( &__enqueue_pos, __ATOMIC_RELAXED );
+        }
+    }
+}
+
+/**
+** Take the oldest committed record, returns NULL if there is none.
+*/
+static log_slot_t *__take( unsigned long *pos_out )
+{
+    unsigned long pos = __atomic_load_n( &__dequeue_pos, __ATOMIC_RELAXED );
+
+    for( ;; )
+    {
+        log_slot_t *slot = __slot_at( pos );
+        const unsigned long seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+        const long diff = (long) seq - (long) ( pos + 1 );
+
+        if( diff == 0 )
+        {
+            if( __atomic_compare_exchange_n( &__dequeue_pos, &pos, pos + 1, true,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+            {
+                *pos_out = pos;
+                return slot;
+            }
+        }
+        else if( diff < 0 )
+        {
+            // empty or not yet committed
+            return NULL;
+        }
+        else
+        {
+            pos = __atomic_load_n( &__dequeue_pos, __ATOMIC_RELAXED );
+        }
+    }
+}
+
+/**
+** Hand a taken slot back to the producers.
+*/
+static void __release( log_slot_t *slot, const unsigned long pos )
+{
+    __atomic_store_n( &slot->seq, pos + __queue_mask + 1, __ATOMIC_RELEASE );
+    __atomic_add_fetch( &__done, 1, __ATOMIC_RELEASE );
+}
+
+/**
+** Whether a committed record is waiting at the head of the queue
+*/
+static bool __has_records( void )
+{
+    const unsigned long pos = __atomic_load_n( &__dequeue_pos, __ATOMIC_SEQ_CST );
+    const log_slot_t *slot = __slot_at( pos );
+
+    return __atomic_load_n( &slot->seq, __ATOMIC_SEQ_CST ) == pos + 1;
+}
+
+/**
+** Report messages discarded since the last report.
+*/
+static void __report_dropped( unsigned long *reported )
+{
+    const unsigned long dropped = __atomic_load_n( &__dropped, __ATOMIC_RELAXED );
+
+    if( dropped == *reported )
+    {
+        return;
+    }
+
+    char msg[ TINYLOG_MSG_SIZE ];
+
+    log_record_t rec;
+    rec.msg      = msg;
+    rec.size     = sizeof( msg );
+    rec.stamp    = __tinylog_now( &rec.clock );
+    rec.func     = __FUNCTION__;
+    rec.category = 0;
+    rec.line     = __LINE__;
+    rec.severity = LOG_WARNING;
+    rec.err_no   = 0;
+    rec.sample_rate = 0;
+    rec.flags    = get_log_dest() | ( get_dev_logging() ? RECORD_DEV_LOGGING : 0 );
+    rec.field_count = 0;
+    rec.len      = snprintf( rec.msg, rec.size,
+            "Log queue full, dropped %lu message(s)", dropped - *reported );
+
+    __tinylog_emit( &rec );
+
+    *reported = dropped;
+}
+
+/**
+** Whether the calling thread is the writer thread
+*/
+bool __tinylog_is_writer( void )
+{
+    return __log_thread.writer;
+}
+
+/**
+** Background thread writing the queued records.
+*/
+static void *__writer_main( void *arg )
+{
+    (void) arg;
+
+    __tinylog_thread()->writer = true;
+
+    unsigned long reported = __atomic_load_n( &__dropped, __ATOMIC_RELAXED );
+
+    for( ;; )
+    {
+        unsigned long pos;
+        log_slot_t *slot;
+
+        while( ( slot = __take( &pos ) ) != NULL )
+        {
+            __tinylog_emit( &slot->rec );
+
+            const bool flushing = __atomic_load_n( &__flush_waiters, __ATOMIC_RELAXED );
+            if( flushing )
+            {
+                // don't report records as written which are still waiting for the batch
+                __tinylog_syslog_flush();
+                __tinylog_sinks_flush();
+            }
+            __release( slot, pos );
+
+            if( flushing )
+            {
+                pthread_mutex_lock( &__lock );
+                pthread_cond_broadcast( &__drained );
+                pthread_mutex_unlock( &__lock );
+            }
+        }
+
+        __report_dropped( &reported );
+        __tinylog_syslog_flush();
+        __tinylog_sinks_flush();
+
+        pthread_mutex_lock( &__lock );
+        pthread_cond_broadcast( &__drained );
+
+        if( __stop )
+        {
+            pthread_mutex_unlock( &__lock );
+            break;
+        }
+
+        // producers only signal if they see the writer sleeping,
+        // so check again for records after announcing it
+        __atomic_store_n( &__writer_sleeping, true, __ATOMIC_SEQ_CST );
+        if( !__has_records() )
+        {
+            struct timespec timeout;
+            clock_gettime( CLOCK_REALTIME, &timeout );
+            timeout.tv_nsec += 100 * 1000 * 1000;
+            if( timeout.tv_nsec >= 1000 * 1000 * 1000 )
+            {
+                timeout.tv_sec++;
+                timeout.tv_nsec -= 1000 * 1000 * 1000;
+            }
+
+            pthread_cond_timedwait( &__wakeup, &__lock, &timeout );
+        }
+        __atomic_store_n( &__writer_sleeping, false, __ATOMIC_RELAXED );
+
+        pthread_mutex_unlock( &__lock );
+    }
+
+    return NULL;
+}
+
+static void __wake_writer( void )
+{
+    pthread_mutex_lock( &__lock );
+    pthread_cond_signal( &__wakeup );
+    pthread_mutex_unlock( &__lock );
+}
+
+/**
+** Reserve a record in the queue of the asynchronous logger.
+*/
+int __tinylog_async_begin( log_record_t **rec )
+{
+    if( !__atomic_load_n( &__async, __ATOMIC_RELAXED ) || __log_thread.writer )
+    {
+        return ASYNC_OFF;
+    }
+
+    // announce the use of the queue, so that it won't be freed while in use
+    __atomic_add_fetch( &__producers, 1, __ATOMIC_SEQ_CST );
+    if( !__atomic_load_n( &__async, __ATOMIC_SEQ_CST ) )
+    {
+        __atomic_sub_fetch( &__producers, 1, __ATOMIC_RELEASE );
+        return ASYNC_OFF;
+    }
+
+    log_slot_t *slot;
+    while( ( slot = __reserve() ) == NULL )
+    {
+        switch( __atomic_load_n( &__log_overflow, __ATOMIC_RELAXED ) )
+        {
+            case OVERFLOW_DROP_NEWEST:
+                __atomic_add_fetch( &__dropped, 1, __ATOMIC_RELAXED );
+                __atomic_sub_fetch( &__producers, 1, __ATOMIC_RELEASE );
+                return ASYNC_DROPPED;
+
+            case OVERFLOW_DROP_OLDEST:
+            {
+                unsigned long pos;
+                log_slot_t *oldest = __take( &pos );
+                if( oldest != NULL )
+                {
+                    __release( oldest, pos );
+                    __atomic_add_fetch( &__dropped, 1, __ATOMIC_RELAXED );
+                }
+                break;
+            }
+
+            case OVERFLOW_BLOCK:
+            default:
+                __wake_writer();
+                sched_yield();
+                break;
+        }
+    }
+
+    *rec = &slot->rec;
+
+    return ASYNC_QUEUED;
+}
+
+/**
+** Hand the filled record over to the background thread.
+*/
+void __tinylog_async_commit( log_record_t *rec )
+{
+    log_slot_t *slot = __slot_of( rec );
+
+    // while reserved, 'seq' holds the enqueue position
+    __atomic_store_n( &slot->seq, slot->seq + 1, __ATOMIC_SEQ_CST );
+
+    if( __atomic_load_n( &__writer_sleeping, __ATOMIC_SEQ_CST ) )
+    {
+        __wake_writer();
+    }
+
+    __atomic_sub_fetch( &__producers, 1, __ATOMIC_RELEASE );
+}
+
+static void __async_atexit( void )
+{
+    set_log_async( false );
+}
+
+/**
+** Allocate the queue and start the background thread.
+** Has to be called with the async lock held.
+*/
+static bool __start_writer( void )
+{
+    static bool atexit_registered = false;
+
+    const unsigned queue_size = __atomic_load_n( &__log_queue_size, __ATOMIC_RELAXED );
+    unsigned long size = 1;
+    while( size < queue_size )
+    {
+        size <<= 1;
+    }
+
+    // room for the message and its '\0', aligned to cache lines
+    const size_t msg_size = get_log_max_msg_size() + 1;
+    __slot_size = ( sizeof( log_slot_t ) + msg_size + 63 ) & ~ (size_t) 63;
+
+    __queue = malloc( size * __slot_size );
+    if( __queue == NULL )
+    {
+        log_ERR(0, "Could not allocate log queue for %lu messages", size);
+        return false;
+    }
+    __queue_mask  = size - 1;
+
+    for( unsigned long i = 0; i < size; i++ )
+    {
+        log_slot_t *slot = __slot_at( i );
+        slot->seq      = i;
+        slot->rec.msg  = (char *) slot + sizeof( log_slot_t );
+        slot->rec.size = msg_size;
+    }
+    __enqueue_pos = 0;
+    __dequeue_pos = 0;
+    __done        = 0;
+    __stop        = false;
+
+    if( pthread_create( &__writer, NULL, __writer_main, NULL ) != 0 )
+    {
+        free( __queue );
+        __queue = NULL;
+
+        log_ERR(0, "Could not start log writer thread");
+        return false;
+    }
+
+    if( !atexit_registered )
+    {
+        atexit( __async_atexit );
+        atexit_registered = true;
+    }
+
+    __atomic_store_n( &__async, true, __ATOMIC_SEQ_CST );
+
+    return true;
+}
+
+/**
+** Drain the queue, stop the background thread and free the queue.
+** Has to be called with the async lock held.
+*/
+static void __stop_writer( void )
+{
+    __atomic_store_n( &__async, false, __ATOMIC_SEQ_CST );
+
+    // wait for log calls which still got a slot
+    while( __atomic_load_n( &__producers, __ATOMIC_SEQ_CST ) )
+    {
+        sched_yield();
+    }
+
+    pthread_mutex_lock( &__lock );
+    __stop = true;
+    pthread_cond_signal( &__wakeup );
+    pthread_mutex_unlock( &__lock );
+
+    pthread_join( __writer, NULL );
+
+    free( __queue );
+    __queue = NULL;
+}
+
+/**
+** Whether log messages should be queued and written by a background thread
+**
+** default: false
+*/
+void set_log_async( const bool async )
+{
+    if( __log_thread.writer )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &__async_lock );
+
+    if( async == __atomic_load_n( &__async, __ATOMIC_RELAXED ) )
+    {
+        pthread_mutex_unlock( &__async_lock );
+        return;
+    }
+
+    bool changed = true;
+    if( async )
+    {
+        changed = __start_writer();
+    }
+    else
+    {
+        __stop_writer();
+    }
+    const unsigned long queue_size = __queue_mask + 1;
+
+    pthread_mutex_unlock( &__async_lock );
+
+    if( changed && async )
+    {
+        log_TRACE(0, "Set 'async' to: true, queue size: %lu", queue_size );
+    }
+    else if( changed )
+    {
+        log_TRACE(0, "Set 'async' to: false" );
+    }
+}
+
+bool get_log_async( void )
+{
+    return __atomic_load_n( &__async, __ATOMIC_RELAXED );
+}
+
+/**
+** How many messages the asynchronous logger can queue
+**
+** default: 1024
+*/
+void set_log_queue_size( const unsigned queue_size )
+{
+    if( queue_size == 0 )
+    {
+        log_WARNING(0, "Log queue size may not be zero. Ignoring.");
+        return;
+    }
+
+    if( queue_size != __atomic_exchange_n( &__log_queue_size, queue_size, __ATOMIC_RELAXED ) )
+    {
+        log_TRACE(0, "Set 'queue_size' to: %u", queue_size );
+    }
+}
+
+unsigned get_log_queue_size( void )
+{
+    return __atomic_load_n( &__log_queue_size, __ATOMIC_RELAXED );
+}
+
+/**
+** What the asynchronous logger should do if its queue is full
+**
+** default: OVERFLOW_BLOCK
+*/
+void set_log_overflow( const log_overflow_t overflow )
+{
+    if(     overflow == OVERFLOW_BLOCK ||
+            overflow == OVERFLOW_DROP_NEWEST ||
+            overflow == OVERFLOW_DROP_OLDEST
+    )
+    {
+        if( overflow != __atomic_exchange_n( &__log_overflow, overflow, __ATOMIC_RELAXED ) )
+        {
+            log_TRACE(0, "Set 'overflow' to: %s", strlog_overflow( overflow ) );
+        }
+        return;
+    }
+
+    log_WARNING(0, "Unknown overflow policy: %d. Ignoring.", overflow);
+}
+
+log_overflow_t get_log_overflow( void )
+{
+    return __atomic_load_n( &__log_overflow, __ATOMIC_RELAXED );
+}
+
+unsigned long get_log_dropped( void )
+{
+    return __atomic_load_n( &__dropped, __ATOMIC_RELAXED );
+}
+
+/**
+** Wait until all messages queued so far have been written.
+*/
+void tinylog_flush( void )
+{
+    // messages suppressed since the last one of their call site
+    __tinylog_report_suppressed();
+
+    if( __atomic_load_n( &__async, __ATOMIC_ACQUIRE ) && !__log_thread.writer )
+    {
+        __drain_queue();
+    }
+
+    // lines collected by the buffered output and the sinks
+    __tinylog_buffer_flush();
+    __tinylog_binary_flush();
+    __tinylog_sinks_flush();
+}
+
+/**
+** Wait until the writer thread wrote all records queued so far.
+*/
+static void __drain_queue( void )
+{
+    const unsigned long queued = __atomic_load_n( &__enqueue_pos, __ATOMIC_ACQUIRE );
+
+    pthread_mutex_lock( &__lock );
+    __atomic_add_fetch( &__flush_waiters, 1, __ATOMIC_RELAXED );
+
+    while( __atomic_load_n( &__done, __ATOMIC_ACQUIRE ) < queued
+        && __atomic_load_n( &__async, __ATOMIC_ACQUIRE )
+    )
+    {
+        pthread_cond_signal( &__wakeup );
+
+        struct timespec timeout;
+        clock_gettime( CLOCK_REALTIME, &timeout );
+        timeout.tv_sec++;
+
+        pthread_cond_timedwait( &__drained, &__lock, &timeout );
+    }
+
+    __atomic_sub_fetch( &__flush_waiters, 1, __ATOMIC_RELAXED );
+    pthread_mutex_unlock( &__lock );
+}
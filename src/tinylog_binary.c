@@ -0,0 +1,440 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Binary log file.
+**
+** Instead of text, records hold the raw arguments of the log call together with
+** ids of its format string and call site. Format strings and call sites are
+** interned by their address and written to the file the first time they are used,
+** so a record costs a few bytes more than its arguments.
+** Only string literals are interned, the same address might hold another text otherwise:
+** messages of other format strings are formatted and written as text of their record.
+** Turning records back into text is left to tools/tinylog-decode.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "tinylog_internal.h"
+
+/**
+** Size of the buffer the entries are collected in
+*/
+#define BINARY_BUFFER_SIZE  ( 128 * 1024 )
+
+/**
+** Maximum length of the arguments of a record and of strings of the dictionary
+*/
+#define BINARY_ARGS_MAX     UINT16_MAX
+
+/**
+** Count of format strings and call sites which are interned, has to be a power of two.
+** If the table is full, further ones are written for each record.
+*/
+#define BINARY_DICT_SIZE    4096
+
+/**
+** Format string of records whose arguments couldn't be captured, their text is the argument
+*/
+static const char BINARY_TEXT_FORMAT[] = "%s";
+
+/**
+** An interned format string or call site
+*/
+struct BinaryEntry {
+    const void     *key;
+    int             line;
+    uint32_t        id;
+};
+typedef struct BinaryEntry binary_entry_t;
+
+static pthread_mutex_t  __binary_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int              __binary_fd = -1;
+
+static char             __buffer[ BINARY_BUFFER_SIZE ];
+static size_t           __buffer_len = 0;
+
+/**
+** Time of the last record written
+*/
+static uint64_t         __last_time = 0;
+
+static binary_entry_t   __formats[ BINARY_DICT_SIZE ];
+static binary_entry_t   __sites[ BINARY_DICT_SIZE ];
+static uint32_t         __format_count = 0;
+static uint32_t         __site_count = 0;
+
+/**
+** Categories whose names were written, one bit per category
+*/
+static uint64_t         __categories = 0;
+
+/**
+** Names of threads written last, has to be a power of two.
+** If the table is full, the name is written for each record.
+*/
+#define BINARY_THREAD_COUNT 256
+
+struct BinaryThread {
+    int             tid;
+    char            name[ TINYLOG_THREAD_NAME_SIZE ];
+};
+
+static struct BinaryThread  __threads[ BINARY_THREAD_COUNT ];
+
+
+// internal prototypes
+
+static void __flush_locked( void );
+
+
+// functions
+
+/**
+** Make room for an entry of the given size, writing the buffer if needed.
+** Returns where the entry goes.
+*/
+static char *__reserve( const size_t size )
+{
+    if( __buffer_len + size > sizeof( __buffer ) )
+    {
+        __flush_locked();
+    }
+
+    return __buffer + __buffer_len;
+}
+
+/**
+** Write the buffer to the file. Entries which can't be written are lost.
+*/
+static void __flush_locked( void )
+{
+    size_t pos = 0;
+    while( pos < __buffer_len && __binary_fd >= 0 )
+    {
+        const ssize_t written = write( __binary_fd, __buffer + pos, __buffer_len - pos );
+        if( written < 0 )
+        {
+            if( errno == EINTR )
+            {
+                continue;
+            }
+            break;
+        }
+        pos += written;
+    }
+
+    __buffer_len = 0;
+}
+
+/**
+** Append an entry of the dictionary.
+*/
+static void __put_string( const uint8_t type, const uint32_t id, const int line, const char *text )
+{
+    const size_t text_len = strlen( text );
+    const binary_string_t entry =
+    {
+        .type   = type,
+        .id     = id,
+        .line   = line,
+        .len    = text_len < BINARY_ARGS_MAX ? text_len : BINARY_ARGS_MAX
+    };
+
+    char *pos = __reserve( sizeof( entry ) + entry.len );
+    memcpy( pos, &entry, sizeof( entry ) );
+    memcpy( pos + sizeof( entry ), text, entry.len );
+
+    __buffer_len += sizeof( entry ) + entry.len;
+}
+
+/**
+** Retrieve the id of the format string or call site, which is added to the dictionary
+** of the file if it is new.
+*/
+static uint32_t __intern( binary_entry_t *table, uint32_t *count, const uint8_t type,
+        const void *key, const int line, const char *text )
+{
+    const unsigned long hash = ( ( (unsigned long) key >> 3 ) ^ (unsigned long) line ) * 0x9E3779B97F4A7C15UL;
+
+    binary_entry_t *entry = NULL;
+    for( unsigned i = 0; i < BINARY_DICT_SIZE; i++ )
+    {
+        entry = &table[ ( hash + i ) & ( BINARY_DICT_SIZE - 1 ) ];
+        if( entry->key == NULL )
+        {
+            break;
+        }
+        if( entry->key == key && entry->line == line )
+        {
+            return entry->id;
+        }
+        entry = NULL;
+    }
+
+    const uint32_t id = (*count)++;
+    if( entry != NULL )
+    {
+        entry->key  = key;
+        entry->line = line;
+        entry->id   = id;
+    }
+
+    __put_string( type, id, line, text );
+
+    return id;
+}
+
+/**
+** Write the name of the thread, unless it was written already.
+*/
+static void __put_thread( const int tid, const char *name )
+{
+    struct BinaryThread *thread = NULL;
+    for( unsigned i = 0; i < BINARY_THREAD_COUNT; i++ )
+    {
+        thread = &__threads[ ( tid + i ) & ( BINARY_THREAD_COUNT - 1 ) ];
+        if( thread->tid == tid || thread->tid == 0 )
+        {
+            break;
+        }
+        thread = NULL;
+    }
+
+    if( thread != NULL )
+    {
+        if( thread->tid == tid && strcmp( thread->name, name ) == 0 )
+        {
+            return;
+        }
+
+        thread->tid = tid;
+        memcpy( thread->name, name, sizeof( thread->name ) );
+    }
+
+    __put_string( BINARY_THREAD, tid, 0, name );
+}
+
+/**
+** Append the record to the binary log file.
+*/
+void __tinylog_binary_write( const log_record_t *rec )
+{
+    pthread_mutex_lock( &__binary_lock );
+
+    if( __binary_fd < 0 )
+    {
+        pthread_mutex_unlock( &__binary_lock );
+        return;
+    }
+
+    const char *fmt = rec->flags & RECORD_DEFERRED ? rec->format->fmt : BINARY_TEXT_FORMAT;
+
+    binary_record_t entry =
+    {
+        .type       = BINARY_RECORD,
+        .severity   = rec->severity,
+        .category   = rec->category,
+        .flags      = ( rec->flags & RECORD_DEV_LOGGING ? BINARY_DEV_LOGGING : 0 )
+                    | ( rec->flags & RECORD_THREAD_INFO ? BINARY_THREAD_INFO : 0 ),
+        .format     = __intern( __formats, &__format_count, BINARY_FORMAT, fmt, 0, fmt ),
+        .site       = __intern( __sites, &__site_count, BINARY_SITE, rec->func, rec->line, rec->func ),
+        .err_no     = rec->err_no > 0 && rec->err_no <= UINT16_MAX ? rec->err_no : 0
+    };
+
+    if( rec->category != 0 && !( __categories & ( 1ull << ( rec->category % 64 ) ) ) )
+    {
+        __put_string( BINARY_CATEGORY, rec->category, 0, strlog_category( rec->category ) );
+        __categories |= 1ull << ( rec->category % 64 );
+    }
+
+    // the thread id is part of the record, its name is written when it changes
+    const int32_t tid = rec->tid;
+    const size_t tid_size = rec->flags & RECORD_THREAD_INFO ? sizeof( tid ) : 0;
+    if( tid_size > 0 )
+    {
+        __put_thread( tid, rec->thread_name );
+    }
+
+    // time relative to the previous record, if it fits
+    struct timespec time;
+    __tinylog_wall_time( rec->stamp, rec->clock, &time );
+    const uint64_t now = (uint64_t) time.tv_sec * 1000000000ULL + time.tv_nsec;
+
+    if( now < __last_time || now - __last_time > UINT32_MAX )
+    {
+        const binary_time_t stamp = { .type = BINARY_TIME, .time = now };
+
+        memcpy( __reserve( sizeof( stamp ) ), &stamp, sizeof( stamp ) );
+        __buffer_len += sizeof( stamp );
+        __last_time = now;
+    }
+    entry.delta = now - __last_time;
+    __last_time = now;
+
+    if( ( rec->flags & RECORD_DEFERRED ) && rec->len <= BINARY_ARGS_MAX )
+    {
+        entry.args_len = rec->len;
+
+        char *pos = __reserve( sizeof( entry ) + tid_size + entry.args_len );
+        memcpy( pos, &entry, sizeof( entry ) );
+        memcpy( pos + sizeof( entry ), &tid, tid_size );
+        memcpy( pos + sizeof( entry ) + tid_size, rec->msg, entry.args_len );
+    }
+    else
+    {
+        // the text is the argument of "%s": a flag for NULL and the text including its '\0'
+        char *pos = __reserve( sizeof( entry ) + tid_size + BINARY_ARGS_MAX );
+        char *args = pos + sizeof( entry ) + tid_size;
+        const size_t size = BINARY_ARGS_MAX - 1;
+
+        size_t len;
+        if( rec->flags & RECORD_DEFERRED )
+        {
+            len = __tinylog_render( rec->format, rec->msg, args + 1, size - 1 );
+            if( len >= size - 1 )
+            {
+                len = __tinylog_truncated( args + 1, size - 1 );
+            }
+        }
+        else
+        {
+            len = rec->len < size - 1 ? rec->len : size - 1;
+            memcpy( args + 1, rec->msg, len );
+
+            if( rec->field_count > 0 )
+            {
+                len = __tinylog_encode_fields( LOG_ENCODING_HUMAN, args + 1, size - 1, len, rec );
+            }
+        }
+
+        args[ 0 ] = 1;
+        args[ len + 1 ] = '\0';
+        entry.args_len = len + 2;
+
+        memcpy( pos, &entry, sizeof( entry ) );
+        memcpy( pos + sizeof( entry ), &tid, tid_size );
+    }
+    __buffer_len += sizeof( entry ) + tid_size + entry.args_len;
+
+    if( rec->severity <= get_log_flush_level() )
+    {
+        __flush_locked();
+    }
+
+    pthread_mutex_unlock( &__binary_lock );
+}
+
+/**
+** Write the records collected so far.
+*/
+void __tinylog_binary_flush( void )
+{
+    pthread_mutex_lock( &__binary_lock );
+    __flush_locked();
+    pthread_mutex_unlock( &__binary_lock );
+}
+
+/**
+** Binary log file for the BINARY destination.
+*/
+bool open_tinylog_binary( const char *path )
+{
+    if( path == NULL )
+    {
+        log_WARNING(0, "Invalid binary log file name. Ignoring");
+        return false;
+    }
+
+    close_tinylog_binary();
+
+    const int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+    if( fd < 0 )
+    {
+        log_ERR(errno, "Could not create binary log file: %s", path);
+        return false;
+    }
+
+    struct timespec time;
+    clock_gettime( CLOCK_REALTIME, &time );
+
+    const uint16_t byte_order = 1;
+    binary_header_t header =
+    {
+        .version        = BINARY_VERSION,
+        .long_size      = sizeof( long ),
+        .pointer_size   = sizeof( void * ),
+        .ldouble_size   = sizeof( long double ),
+        .little_endian  = *(const uint8_t *) &byte_order,
+        .time_layout    = get_log_time_layout(),
+        .time_precision = get_log_time_precision(),
+        .time           = (uint64_t) time.tv_sec * 1000000000ULL + time.tv_nsec
+    };
+    memcpy( header.magic, BINARY_MAGIC, sizeof( header.magic ) );
+
+    pthread_mutex_lock( &__binary_lock );
+
+    // the dictionary starts over with each file
+    memset( __formats, 0, sizeof( __formats ) );
+    memset( __sites, 0, sizeof( __sites ) );
+    memset( __threads, 0, sizeof( __threads ) );
+    __format_count = 0;
+    __site_count   = 0;
+    __categories   = 0;
+    __last_time    = header.time;
+
+    memcpy( __buffer, &header, sizeof( header ) );
+    __buffer_len = sizeof( header );
+    __binary_fd  = fd;
+
+    pthread_mutex_unlock( &__binary_lock );
+
+    static bool registered = false;
+    if( !registered )
+    {
+        // write the records still collected when the program exits
+        atexit( close_tinylog_binary );
+        registered = true;
+    }
+
+    log_TRACE(0, "Opened binary log file: %s", path);
+
+    return true;
+}
+
+void close_tinylog_binary( void )
+{
+    // records still queued for the asynchronous logger go to the file as well
+    tinylog_flush();
+
+    pthread_mutex_lock( &__binary_lock );
+
+    if( __binary_fd >= 0 )
+    {
+        __flush_locked();
+        close( __binary_fd );
+        __binary_fd = -1;
+    }
+
+    pthread_mutex_unlock( &__binary_lock );
+}
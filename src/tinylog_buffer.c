@@ -0,0 +1,343 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Output to stderr, optionally buffered.
+**
+** With buffering turned on, lines are collected in a buffer shared by all
+** threads (so that they stay in order) which is written with a single writev()
+** when it is full, when important messages are logged or when the oldest line
+** waited for the maximum latency. The latency is enforced by a flusher thread.
+*/
+
+#include <errno.h>      /* EINTR */
+#include <pthread.h>    /* pthread_mutex_lock() */
+#include <unistd.h>     /* write() */
+
+#include <sys/uio.h>    /* writev() */
+
+#include "tinylog_internal.h"
+
+/**
+** Whether lines are buffered (atomic)
+*/
+static bool             __buffering = false;
+
+/**
+** Buffer shared by all threads and its settings
+*/
+static char            *__buffer = NULL;
+static size_t           __buffer_len = 0;
+static size_t           __buffer_size = 0;
+static unsigned         __latency_ms = 0;
+
+/**
+** When the oldest line in the buffer was added (CLOCK_MONOTONIC)
+*/
+static struct timespec  __buffer_since;
+
+/**
+** Lines this severity or more critical are written right away (atomic)
+*/
+static int              __flush_level = LOG_ERR;
+
+/**
+** Protects the buffer, signals the flusher thread when the buffer stops being empty
+*/
+static pthread_mutex_t  __buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   __buffer_pending;
+
+/**
+** Thread writing lines which waited for the maximum latency
+*/
+static pthread_t        __flusher;
+static bool             __flusher_running = false;
+
+// internal prototypes
+
+static void *__flusher_main( void *arg );
+
+
+// functions
+
+/**
+** Write all buffers, retrying on interrupts and partial writes.
+*/
+static void __writev_all( const int fd, struct iovec *iov, int count )
+{
+    while( count > 0 )
+    {
+        ssize_t written = writev( fd, iov, count );
+        if( written < 0 )
+        {
+            if( errno == EINTR )
+            {
+                continue;
+            }
+
+            // nowhere to report the error to
+            return;
+        }
+
+        // skip what was written
+        while( count > 0 && (size_t) written >= iov->iov_len )
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if( count > 0 )
+        {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+/**
+** Write the buffer followed by the line (if any).
+** Has to be called with the lock held.
+*/
+static void __flush_locked( const char *line, const size_t len )
+{
+    struct iovec iov[ 2 ];
+    int count = 0;
+
+    if( __buffer_len > 0 )
+    {
+        iov[ count ].iov_base = __buffer;
+        iov[ count ].iov_len  = __buffer_len;
+        count++;
+    }
+    if( len > 0 )
+    {
+        iov[ count ].iov_base = (char *) line;
+        iov[ count ].iov_len  = len;
+        count++;
+    }
+
+    __writev_all( STDERR_FILENO, iov, count );
+    __buffer_len = 0;
+}
+
+/**
+** Write a line to stderr, collecting it in the buffer if buffering is turned on.
+*/
+void __tinylog_stderr_write( const int severity, const char *line, const size_t len )
+{
+    if( !__atomic_load_n( &__buffering, __ATOMIC_RELAXED ) )
+    {
+        struct iovec iov = { (char *) line, len };
+        __writev_all( STDERR_FILENO, &iov, 1 );
+
+        return;
+    }
+
+    pthread_mutex_lock( &__buffer_lock );
+
+    if( __buffer == NULL )
+    {
+        // buffering was just turned off
+        struct iovec iov = { (char *) line, len };
+        __writev_all( STDERR_FILENO, &iov, 1 );
+    }
+    else if( severity <= __atomic_load_n( &__flush_level, __ATOMIC_RELAXED )
+        || __buffer_len + len > __buffer_size
+    )
+    {
+        // the line is written together with the buffer, without being copied
+        __flush_locked( line, len );
+    }
+    else
+    {
+        if( __buffer_len == 0 )
+        {
+            clock_gettime( CLOCK_MONOTONIC, &__buffer_since );
+            pthread_cond_signal( &__buffer_pending );
+        }
+
+        memcpy( __buffer + __buffer_len, line, len );
+        __buffer_len += len;
+    }
+
+    pthread_mutex_unlock( &__buffer_lock );
+}
+
+/**
+** Write the lines collected so far.
+*/
+void __tinylog_buffer_flush( void )
+{
+    if( !__atomic_load_n( &__buffering, __ATOMIC_RELAXED ) )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &__buffer_lock );
+    __flush_locked( NULL, 0 );
+    pthread_mutex_unlock( &__buffer_lock );
+}
+
+/**
+** Write the lines which waited for the maximum latency.
+*/
+static void *__flusher_main( void *arg )
+{
+    (void) arg;
+
+    pthread_mutex_lock( &__buffer_lock );
+
+    while( __flusher_running )
+    {
+        if( __buffer_len == 0 )
+        {
+            pthread_cond_wait( &__buffer_pending, &__buffer_lock );
+            continue;
+        }
+
+        struct timespec deadline = __buffer_since;
+        deadline.tv_sec  += __latency_ms / 1000;
+        deadline.tv_nsec += ( __latency_ms % 1000 ) * 1000000L;
+        if( deadline.tv_nsec >= 1000000000L )
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        if( pthread_cond_timedwait( &__buffer_pending, &__buffer_lock, &deadline ) == ETIMEDOUT )
+        {
+            __flush_locked( NULL, 0 );
+        }
+    }
+
+    pthread_mutex_unlock( &__buffer_lock );
+
+    return NULL;
+}
+
+static void __init_pending( void )
+{
+    // deadlines are taken from the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &__buffer_pending, &attr );
+    pthread_condattr_destroy( &attr );
+}
+
+static void __buffering_atexit( void )
+{
+    set_log_buffering( 0, 0 );
+}
+
+/**
+** Collect lines for stderr and write them at once.
+*/
+void set_log_buffering( const size_t size, const unsigned latency_ms )
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    static bool atexit_registered = false;
+
+    pthread_once( &once, __init_pending );
+
+    // stop buffering with the old settings
+    pthread_mutex_lock( &__buffer_lock );
+
+    const bool running = __flusher_running;
+    __flusher_running = false;
+    pthread_cond_signal( &__buffer_pending );
+
+    pthread_mutex_unlock( &__buffer_lock );
+
+    if( running )
+    {
+        pthread_join( __flusher, NULL );
+    }
+
+    pthread_mutex_lock( &__buffer_lock );
+
+    __flush_locked( NULL, 0 );
+    __atomic_store_n( &__buffering, false, __ATOMIC_RELAXED );
+    free( __buffer );
+    __buffer = NULL;
+    __buffer_size = 0;
+
+    if( size > 0 )
+    {
+        __buffer = malloc( size );
+        if( __buffer != NULL )
+        {
+            __buffer_size = size;
+            __latency_ms  = latency_ms > 0 ? latency_ms : 1;
+            __flusher_running = pthread_create( &__flusher, NULL, __flusher_main, NULL ) == 0;
+
+            if( !__flusher_running )
+            {
+                // without the flusher lines could wait forever
+                free( __buffer );
+                __buffer = NULL;
+                __buffer_size = 0;
+            }
+        }
+        __atomic_store_n( &__buffering, __buffer != NULL, __ATOMIC_RELAXED );
+    }
+
+    pthread_mutex_unlock( &__buffer_lock );
+
+    if( size > 0 && !__atomic_load_n( &__buffering, __ATOMIC_RELAXED ) )
+    {
+        log_ERR(0, "Could not set up buffering of %zu bytes", size);
+        return;
+    }
+
+    if( size > 0 && !atexit_registered )
+    {
+        // write the lines left when the program exits
+        atexit( __buffering_atexit );
+        atexit_registered = true;
+    }
+
+    log_TRACE(0, "Set 'buffering' to: %zu bytes, %u ms", size, latency_ms );
+}
+
+size_t get_log_buffer_size( void )
+{
+    return __atomic_load_n( &__buffering, __ATOMIC_RELAXED ) ? __buffer_size : 0;
+}
+
+unsigned get_log_buffer_latency( void )
+{
+    return __latency_ms;
+}
+
+/**
+** Lines of this severity or more critical are written right away.
+*/
+void set_log_flush_level( const int severity )
+{
+    if( severity != __atomic_exchange_n( &__flush_level, severity, __ATOMIC_RELAXED ) )
+    {
+        log_TRACE(0, "Set 'flush_level' to: %s", strseverity( severity ) );
+    }
+}
+
+int get_log_flush_level( void )
+{
+    return __atomic_load_n( &__flush_level, __ATOMIC_RELAXED );
+}
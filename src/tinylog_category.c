@@ -0,0 +1,269 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Log categories with thresholds of their own.
+**
+** Log calls only check the gate of their category, a single byte of a table
+** which fits into one cache line. Gates, thresholds and names are part of the
+** control block (see tinylog_control.c). The gates are recomputed whenever the threshold
+** of a category or the configuration changes. Recomputing is lock-free, so the
+** setters of the configuration may still be called from signal handlers.
+** Registering categories and setting rules is rare and takes a lock.
+*/
+
+#include <fnmatch.h>    /* fnmatch() */
+#include <pthread.h>    /* pthread_mutex_lock() */
+
+#include "tinylog_internal.h"
+
+/**
+** Maximum length of category names and patterns (including '\0')
+*/
+#define CATEGORY_NAME_SIZE  TINYLOG_CATEGORY_NAME_SIZE
+
+/**
+** Maximum count of rules set by set_log_category_threshold()
+*/
+#define CATEGORY_MAX_RULES  32
+
+/**
+** Highest gate which can be stored in the table
+*/
+#define CATEGORY_GATE_MAX   127
+
+/**
+** A threshold for all categories matching the pattern
+*/
+struct LogCategoryRule {
+    char    pattern[ CATEGORY_NAME_SIZE ];
+    int     threshold;
+};
+typedef struct LogCategoryRule log_category_rule_t;
+
+static log_category_rule_t  __category_rules[ CATEGORY_MAX_RULES ];
+static unsigned             __category_rule_count;
+
+/**
+** Names of the registered categories and their count (atomic), a copy of those in
+** the control block: once it is shared (see open_tinylog_control()) other processes
+** might rewrite them, so log calls only use this copy.
+*/
+static char                 __category_names[ TINYLOG_MAX_CATEGORIES ][ CATEGORY_NAME_SIZE ];
+static unsigned             __category_count = 1;
+
+/**
+** Serializes registration of categories and rules
+*/
+static pthread_mutex_t      __category_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// functions
+
+/**
+** Retrieve the log threshold of the category for the given configuration.
+*/
+int __tinylog_category_threshold( const log_category_t category, const uint64_t config )
+{
+    const int threshold = __atomic_load_n( &__log_control.category_thresholds[ category % TINYLOG_MAX_CATEGORIES ], __ATOMIC_RELAXED );
+
+    return threshold == LOG_THRESHOLD_DEFAULT ? CONFIG_THRESHOLD( config ) : threshold;
+}
+
+/**
+** Recompute the gates of all categories.
+** Concurrent updates are detected by the generation, whoever sees a change
+** which happened while computing the gates computes them again.
+*/
+void __tinylog_update_categories( void )
+{
+    uint64_t generation = __atomic_add_fetch( &__log_control.category_generation, 1, __ATOMIC_SEQ_CST );
+
+    for( ;; )
+    {
+        const uint64_t config = __atomic_load_n( &__log_control.config, __ATOMIC_SEQ_CST );
+        unsigned count        = __atomic_load_n( &__log_control.category_count, __ATOMIC_SEQ_CST );
+
+        // the control block might have been rewritten by another process
+        if( count > TINYLOG_MAX_CATEGORIES )
+        {
+            count = TINYLOG_MAX_CATEGORIES;
+        }
+
+        for( unsigned i = 0; i < count; i++ )
+        {
+            int gate = __tinylog_gate( i == 0 ? CONFIG_THRESHOLD( config ) : __tinylog_category_threshold( i, config ), config );
+
+            if( gate > CATEGORY_GATE_MAX )
+            {
+                gate = CATEGORY_GATE_MAX;
+            }
+
+            __atomic_store_n( &__log_control.category_gates[ i ], (signed char) gate, __ATOMIC_RELAXED );
+        }
+
+        const uint64_t current = __atomic_load_n( &__log_control.category_generation, __ATOMIC_SEQ_CST );
+        if( current == generation )
+        {
+            return;
+        }
+        generation = current;
+    }
+}
+
+/**
+** Retrieve the threshold the rules define for the name.
+** The last matching rule wins. Has to be called with the lock held.
+*/
+static int __rule_threshold( const char *name )
+{
+    int threshold = LOG_THRESHOLD_DEFAULT;
+
+    for( unsigned i = 0; i < __category_rule_count; i++ )
+    {
+        if( fnmatch( __category_rules[ i ].pattern, name, 0 ) == 0 )
+        {
+            threshold = __category_rules[ i ].threshold;
+        }
+    }
+
+    return threshold;
+}
+
+/**
+** Register a log category and retrieve its handle.
+*/
+log_category_t tinylog_category( const char *name )
+{
+    if( name == NULL || name[ 0 ] == '\0' || strlen( name ) >= CATEGORY_NAME_SIZE )
+    {
+        log_WARNING(0, "Invalid log category name: '%s'. Using default category", name ? name : "(null)");
+        return 0;
+    }
+
+    pthread_mutex_lock( &__category_lock );
+
+    const unsigned count = __category_count;
+    for( unsigned i = 1; i < count; i++ )
+    {
+        if( strcmp( __category_names[ i ], name ) == 0 )
+        {
+            pthread_mutex_unlock( &__category_lock );
+
+            return i;
+        }
+    }
+
+    if( count == TINYLOG_MAX_CATEGORIES )
+    {
+        pthread_mutex_unlock( &__category_lock );
+
+        log_WARNING(0, "Too many log categories, can't register: '%s'. Using default category", name);
+        return 0;
+    }
+
+    strcpy( __category_names[ count ], name );
+    strcpy( __log_control.category_names[ count ], name );
+    __atomic_store_n( &__log_control.category_thresholds[ count ], __rule_threshold( name ), __ATOMIC_SEQ_CST );
+
+    // publish the category only when it is complete
+    __atomic_store_n( &__category_count, count + 1, __ATOMIC_SEQ_CST );
+    __atomic_store_n( &__log_control.category_count, count + 1, __ATOMIC_SEQ_CST );
+
+    pthread_mutex_unlock( &__category_lock );
+
+    __tinylog_update_categories();
+
+    log_TRACE(0, "Registered log category '%s' as: %u", name, count );
+
+    return count;
+}
+
+/**
+** Log threshold for all categories whose names match the glob pattern.
+*/
+void set_log_category_threshold( const char *pattern, const int log_threshold )
+{
+    if( log_threshold < 0 && log_threshold != LOG_THRESHOLD_DEFAULT )
+    {
+        log_WARNING(0, "Log threshold my not be less than zero, was: %d. Ignoring", log_threshold);
+        return;
+    }
+
+    if( pattern == NULL || strlen( pattern ) >= CATEGORY_NAME_SIZE )
+    {
+        log_WARNING(0, "Invalid log category pattern: '%s'. Ignoring", pattern ? pattern : "(null)");
+        return;
+    }
+
+    pthread_mutex_lock( &__category_lock );
+
+    // the same pattern replaces its rule, so that rules don't pile up
+    unsigned rule = 0;
+    while( rule < __category_rule_count && strcmp( __category_rules[ rule ].pattern, pattern ) != 0 )
+    {
+        rule++;
+    }
+
+    if( rule == __category_rule_count )
+    {
+        if( rule == CATEGORY_MAX_RULES )
+        {
+            pthread_mutex_unlock( &__category_lock );
+
+            log_WARNING(0, "Too many log category rules, can't add: '%s'. Ignoring", pattern);
+            return;
+        }
+        __category_rule_count++;
+    }
+
+    strcpy( __category_rules[ rule ].pattern, pattern );
+    __category_rules[ rule ].threshold = log_threshold;
+
+    const unsigned count = __category_count;
+    for( unsigned i = 1; i < count; i++ )
+    {
+        __atomic_store_n( &__log_control.category_thresholds[ i ], __rule_threshold( __category_names[ i ] ), __ATOMIC_SEQ_CST );
+    }
+
+    pthread_mutex_unlock( &__category_lock );
+
+    __tinylog_update_categories();
+
+    log_TRACE(0, "Set 'log_threshold' of categories '%s' to: %s", pattern,
+            log_threshold == LOG_THRESHOLD_DEFAULT ? "default" : strseverity( log_threshold ) );
+}
+
+int get_log_category_threshold( const log_category_t category )
+{
+    return __tinylog_category_threshold( category, __atomic_load_n( &__log_control.config, __ATOMIC_RELAXED ) );
+}
+
+/**
+** Retrieve the name of the given log category.
+*/
+const char *strlog_category( const log_category_t category )
+{
+    if( category < __atomic_load_n( &__category_count, __ATOMIC_ACQUIRE ) )
+    {
+        return __category_names[ category ];
+    }
+
+    return "";
+}
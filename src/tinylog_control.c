@@ -0,0 +1,272 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** The control block: configuration word, gates, thresholds and names of the
+** categories, in a page of its own.
+**
+** open_tinylog_control() copies the page into a file in /dev/shm and maps the file
+** over it. Log calls keep reading the same addresses, so sharing costs them nothing,
+** while other processes (see tools/tinylogctl.c) map the file as well and change
+** the configuration with the usual setters and atomics.
+*/
+
+#define _GNU_SOURCE     /* program_invocation_short_name */
+
+#include <errno.h>
+#include <fcntl.h>      /* open() */
+#include <pthread.h>    /* pthread_atfork() */
+#include <unistd.h>     /* getpid(), sysconf() */
+
+#include <sys/mman.h>   /* mmap() */
+
+#include "tinylog_internal.h"
+
+_Static_assert( sizeof( struct LogControl ) == TINYLOG_CONTROL_SIZE, "control block has to fill a page" );
+
+/**
+** The control block, see tinylog.h
+*/
+struct LogControl   __log_control =
+{
+    .config =
+        (uint64_t) LOG_WARNING
+        | (uint64_t) LOG_WARNING << CONFIG_THRESHOLD_SHIFT
+        | (uint64_t) STDERR << CONFIG_DEST_SHIFT,
+
+    // the gate of the default category 0 follows the log threshold
+    .category_gates = { LOG_WARNING },
+    .category_thresholds = { [ 0 ... TINYLOG_MAX_CATEGORIES - 1 ] = LOG_THRESHOLD_DEFAULT },
+    .category_count = 1
+};
+
+/**
+** Should open_tinylog() share the control block
+*/
+static bool         __control = false;          // atomic
+
+/**
+** File the control block is shared by, empty if it isn't
+*/
+static char         __control_path[ TINYLOG_CONTROL_PATH_SIZE ];
+
+/**
+** Serializes sharing the control block
+*/
+static pthread_mutex_t __control_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// internal prototypes
+
+static bool __map_control( const int fd );
+static void __control_fork_child( void );
+
+
+// functions
+
+/**
+** Whether open_tinylog() should share the control block (see open_tinylog_control())
+**
+** default: false
+*/
+void set_log_control( const bool control )
+{
+    if( control != __atomic_exchange_n( &__control, control, __ATOMIC_RELAXED ) )
+    {
+        log_TRACE(0, "Set 'control' to: %s", control ? "true" : "false" );
+    }
+}
+
+bool get_log_control( void )
+{
+    return __atomic_load_n( &__control, __ATOMIC_RELAXED );
+}
+
+/**
+** Share the control block with other processes as /dev/shm/tinylog.<ident>.<pid>.
+*/
+bool open_tinylog_control( const char *ident )
+{
+    if( sysconf( _SC_PAGESIZE ) != TINYLOG_CONTROL_SIZE )
+    {
+        log_WARNING(0, "Control block can't be shared, page size is not %d", TINYLOG_CONTROL_SIZE);
+        return false;
+    }
+
+    if( ident == NULL || ident[ 0 ] == '\0' )
+    {
+        ident = program_invocation_short_name;
+    }
+
+    pthread_mutex_lock( &__control_lock );
+
+    if( __control_path[ 0 ] != '\0' )
+    {
+        pthread_mutex_unlock( &__control_lock );
+        return true;
+    }
+
+    const pid_t pid = getpid();
+
+    // the identifier becomes part of the file name
+    char name[ sizeof( __log_control.ident ) ];
+    snprintf( name, sizeof( name ), "%s", ident );
+    for( char *c = name; *c != '\0'; c++ )
+    {
+        if( *c == '/' || *c == '.' )
+        {
+            *c = '_';
+        }
+    }
+
+    char path[ TINYLOG_CONTROL_PATH_SIZE ];
+    snprintf( path, sizeof( path ), TINYLOG_CONTROL_DIR "/tinylog.%s.%d", name, (int) pid );
+
+    // a file left by an earlier process with the same id is stale
+    unlink( path );
+
+    const int fd = open( path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600 );
+    if( fd < 0 )
+    {
+        const int err_no = errno;
+        pthread_mutex_unlock( &__control_lock );
+
+        log_WARNING(err_no, "Can't create control block '%s'", path);
+        return false;
+    }
+
+    __log_control.pid  = pid;
+    __log_control.size = sizeof( __log_control );
+    memcpy( __log_control.ident, name, sizeof( name ) );
+
+    // the file starts with the current content of the control block,
+    // changes made concurrently until it is mapped are lost
+    if( pwrite( fd, &__log_control, sizeof( __log_control ), 0 ) != sizeof( __log_control )
+        || !__map_control( fd ) )
+    {
+        const int err_no = errno;
+        close( fd );
+        unlink( path );
+        pthread_mutex_unlock( &__control_lock );
+
+        log_WARNING(err_no, "Can't share control block '%s'", path);
+        return false;
+    }
+    close( fd );
+
+    __atomic_store_n( &__log_control.magic, TINYLOG_CONTROL_MAGIC, __ATOMIC_RELEASE );
+
+    snprintf( __control_path, sizeof( __control_path ), "%s", path );
+
+    static bool registered = false;
+    if( !registered )
+    {
+        pthread_atfork( NULL, NULL, __control_fork_child );
+        atexit( close_tinylog_control );
+        registered = true;
+    }
+
+    pthread_mutex_unlock( &__control_lock );
+
+    log_TRACE(0, "Shared control block as: %s", path );
+
+    return true;
+}
+
+/**
+** Remove the file of the control block. The configuration stays as it is.
+*/
+void close_tinylog_control( void )
+{
+    pthread_mutex_lock( &__control_lock );
+
+    if( __control_path[ 0 ] != '\0' )
+    {
+        __atomic_store_n( &__log_control.magic, 0, __ATOMIC_RELEASE );
+        unlink( __control_path );
+        __control_path[ 0 ] = '\0';
+    }
+
+    pthread_mutex_unlock( &__control_lock );
+}
+
+/**
+** Use the control block of the file instead of the own one (for tinylogctl).
+*/
+bool __tinylog_control_attach( const char *path )
+{
+    const int fd = open( path, O_RDWR | O_CLOEXEC );
+    if( fd < 0 )
+    {
+        return false;
+    }
+
+    struct LogControl control;
+    const bool valid = pread( fd, &control, sizeof( control ), 0 ) == sizeof( control )
+            && control.magic == TINYLOG_CONTROL_MAGIC
+            && control.size == sizeof( control );
+
+    const bool attached = valid && __map_control( fd );
+    if( !valid )
+    {
+        errno = EINVAL;
+    }
+
+    const int err_no = errno;
+    close( fd );
+    errno = err_no;
+
+    return attached;
+}
+
+/**
+** Map the file over the control block.
+*/
+static bool __map_control( const int fd )
+{
+    void *mapped = mmap( &__log_control, sizeof( __log_control ), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED, fd, 0 );
+
+    return mapped == &__log_control;
+}
+
+/**
+** A child doesn't share the control block of its parent, it gets a private copy.
+*/
+static void __control_fork_child( void )
+{
+    if( __control_path[ 0 ] == '\0' )
+    {
+        return;
+    }
+
+    struct LogControl control;
+    memcpy( &control, &__log_control, sizeof( control ) );
+
+    void *mapped = mmap( &__log_control, sizeof( __log_control ), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0 );
+    if( mapped != &__log_control )
+    {
+        return;
+    }
+
+    memcpy( &__log_control, &control, sizeof( control ) );
+    __log_control.magic = 0;
+    __control_path[ 0 ] = '\0';
+}
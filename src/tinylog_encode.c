@@ -0,0 +1,596 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Structured log records: key/value fields and the logfmt and JSON encodings.
+**
+** Fields of a log call are packed into the record right behind the message,
+** so that they survive the queue of the asynchronous logger:
+**
+**   <type> <key> '\0' <value>
+**
+** with 8 bytes for numbers, 1 byte for booleans and a NULL flag byte followed
+** by the text and '\0' for strings.
+*/
+
+#include "tinylog_internal.h"
+
+/**
+** Names of the log levels for structured encodings
+*/
+static const char LEVELS[][ 8 ] =
+{
+        "emerg", "alert", "crit", "error",
+        "warning", "notice", "info", "debug",
+        "trace", "init"
+};
+
+/**
+** Textual representation of encodings
+*/
+static const char LOG_ENCODING[3][ 7 ] =
+{
+        "human",
+        "logfmt",
+        "json"
+};
+
+static const char HEX[] = "0123456789abcdef";
+
+
+// functions
+
+/**
+** Encoding for each of the given destinations, the built-in sinks
+*/
+void set_log_encoding( const log_dest_t log_dest, const log_encoding_t encoding )
+{
+    if( encoding != LOG_ENCODING_HUMAN && encoding != LOG_ENCODING_LOGFMT && encoding != LOG_ENCODING_JSON )
+    {
+        log_WARNING(0, "Unknown log encoding: %d. Ignoring.", encoding);
+        return;
+    }
+
+    // the ids of the built-in sinks match the destination bits
+    for( log_sink_t sink = LOG_SINK_STDERR; sink <= LOG_SINK_LOGFILE; sink++ )
+    {
+        if( log_dest & ( 1u << sink ) )
+        {
+            set_log_sink_encoding( sink, encoding );
+        }
+    }
+}
+
+log_encoding_t get_log_encoding( const log_dest_t log_dest )
+{
+    return get_log_sink_encoding( log_dest == SYSLOG ? LOG_SINK_SYSLOG : log_dest == LOGFILE ? LOG_SINK_LOGFILE : LOG_SINK_STDERR );
+}
+
+/**
+** Retrieve the string representation of the given encoding.
+*/
+const char *strlog_encoding( const log_encoding_t encoding )
+{
+    switch( encoding ){
+        case LOG_ENCODING_HUMAN:
+        case LOG_ENCODING_LOGFMT:
+        case LOG_ENCODING_JSON:
+            return LOG_ENCODING[ encoding ];
+    }
+
+    return "******";
+}
+
+//#################################################################################
+//  Packed fields
+//#################################################################################
+
+/**
+** Size of the packed form of a field
+*/
+static size_t __field_size( const log_field_t *field )
+{
+    const size_t key_size = strlen( field->key ) + 1;
+
+    switch( field->type )
+    {
+        case TL_FIELD_STR:
+            return 1 + key_size + 1 + ( field->value.s != NULL ? strlen( field->value.s ) + 1 : 0 );
+        case TL_FIELD_BOOL:
+            return 1 + key_size + 1;
+        default:
+            return 1 + key_size + 8;
+    }
+}
+
+/**
+** Size of the packed form of the fields
+*/
+size_t __tinylog_fields_size( const log_field_t *fields, const unsigned count )
+{
+    size_t size = 0;
+    for( unsigned i = 0; i < count; i++ )
+    {
+        size += __field_size( &fields[ i ] );
+    }
+
+    return size;
+}
+
+/**
+** Pack as many fields as fit into the buffer.
+** Returns the count of bytes used, the count of fields packed is stored in 'packed'.
+*/
+size_t __tinylog_pack_fields( char *buf, const size_t size, const log_field_t *fields, const unsigned count, unsigned *packed )
+{
+    size_t len = 0;
+    unsigned i;
+
+    for( i = 0; i < count; i++ )
+    {
+        const log_field_t *field = &fields[ i ];
+        if( len + __field_size( field ) > size )
+        {
+            break;
+        }
+
+        buf[ len++ ] = field->type;
+
+        const size_t key_size = strlen( field->key ) + 1;
+        memcpy( buf + len, field->key, key_size );
+        len += key_size;
+
+        switch( field->type )
+        {
+            case TL_FIELD_STR:
+                buf[ len++ ] = field->value.s != NULL;
+                if( field->value.s != NULL )
+                {
+                    const size_t value_size = strlen( field->value.s ) + 1;
+                    memcpy( buf + len, field->value.s, value_size );
+                    len += value_size;
+                }
+                break;
+            case TL_FIELD_BOOL:
+                buf[ len++ ] = field->value.b;
+                break;
+            default:
+                memcpy( buf + len, &field->value, 8 );
+                len += 8;
+                break;
+        }
+    }
+
+    *packed = i;
+
+    return len;
+}
+
+/**
+** Unpack the field at the given position of packed fields.
+** Returns the position of the next field.
+*/
+static const char *__unpack_field( const char *pos, log_field_t *field )
+{
+    field->type = (unsigned char) *pos++;
+    field->key  = pos;
+    pos += strlen( pos ) + 1;
+
+    switch( field->type )
+    {
+        case TL_FIELD_STR:
+            if( *pos++ )
+            {
+                field->value.s = pos;
+                pos += strlen( pos ) + 1;
+            }
+            else
+            {
+                field->value.s = NULL;
+            }
+            break;
+        case TL_FIELD_BOOL:
+            field->value.b = *pos++;
+            break;
+        default:
+            memcpy( &field->value, pos, 8 );
+            pos += 8;
+            break;
+    }
+
+    return pos;
+}
+
+//#################################################################################
+//  Encoders
+//#################################################################################
+
+/**
+** Output buffer of an encoder, text beyond its size is dropped
+*/
+struct LogBuffer {
+    char   *str;
+    size_t  size;
+    size_t  len;
+    bool    full;           // something didn't fit
+};
+typedef struct LogBuffer log_buffer_t;
+
+static inline void __put_char( log_buffer_t *buf, const char c )
+{
+    if( buf->len < buf->size )
+    {
+        buf->str[ buf->len++ ] = c;
+    }
+    else
+    {
+        buf->full = true;
+    }
+}
+
+static inline void __put_text( log_buffer_t *buf, const char *text, const size_t len )
+{
+    size_t n = len;
+    if( n > buf->size - buf->len )
+    {
+        n = buf->size - buf->len;
+        buf->full = true;
+    }
+    memcpy( buf->str + buf->len, text, n );
+    buf->len += n;
+}
+
+static inline void __put_str( log_buffer_t *buf, const char *text )
+{
+    __put_text( buf, text, strlen( text ) );
+}
+
+/**
+** Append a string as JSON string, including the quotes.
+** Plain characters are copied in runs, only special ones are escaped.
+** If the string is truncated, it is cut before an escape sequence and still closed.
+*/
+static void __put_json( log_buffer_t *buf, const char *text, const size_t len )
+{
+    if( buf->size - buf->len < 2 )
+    {
+        buf->full = true;
+        return;
+    }
+
+    // keep room for the closing quote
+    buf->size--;
+    __put_char( buf, '"' );
+
+    size_t start = 0;
+    for( size_t i = 0; i < len && !buf->full; i++ )
+    {
+        const unsigned char c = text[ i ];
+        if( c >= 0x20 && c != '"' && c != '\\' )
+        {
+            continue;
+        }
+
+        __put_text( buf, text + start, i - start );
+        start = i + 1;
+
+        char escape[ 6 ] = { '\\', c, 0, 0, 0, 0 };
+        size_t escape_len = 2;
+        switch( c )
+        {
+            case '"':
+            case '\\':
+                break;
+            case '\n': escape[ 1 ] = 'n'; break;
+            case '\r': escape[ 1 ] = 'r'; break;
+            case '\t': escape[ 1 ] = 't'; break;
+            default:
+                memcpy( escape + 1, "u00", 3 );
+                escape[ 4 ] = HEX[ c >> 4 ];
+                escape[ 5 ] = HEX[ c & 0xF ];
+                escape_len = 6;
+                break;
+        }
+
+        if( escape_len > buf->size - buf->len )
+        {
+            buf->full = true;
+        }
+        else
+        {
+            __put_text( buf, escape, escape_len );
+        }
+    }
+    if( !buf->full )
+    {
+        __put_text( buf, text + start, len - start );
+    }
+
+    buf->size++;
+    buf->str[ buf->len++ ] = '"';
+}
+
+/**
+** Append a string as logfmt value, quoted only if needed.
+*/
+static void __put_logfmt( log_buffer_t *buf, const char *text, const size_t len )
+{
+    bool quote = len == 0;
+    for( size_t i = 0; i < len && !quote; i++ )
+    {
+        const unsigned char c = text[ i ];
+        quote = c <= ' ' || c == '=' || c == '"' || c == '\\';
+    }
+
+    if( !quote )
+    {
+        __put_text( buf, text, len );
+        return;
+    }
+
+    // same escaping as JSON
+    __put_json( buf, text, len );
+}
+
+/**
+** Append a string value, quoted as needed by the encoding.
+*/
+static inline void __put_string( log_buffer_t *buf, const char *text, const size_t len, const log_encoding_t encoding )
+{
+    if( encoding == LOG_ENCODING_JSON )
+    {
+        __put_json( buf, text, len );
+    }
+    else
+    {
+        __put_logfmt( buf, text, len );
+    }
+}
+
+/**
+** Append a duration given in nanoseconds like '1.25ms'
+*/
+static void __put_duration( log_buffer_t *buf, const long long nanos )
+{
+    char text[ 32 ];
+    int len;
+
+    const unsigned long long abs_nanos = nanos < 0 ? -(unsigned long long) nanos : (unsigned long long) nanos;
+    if( abs_nanos < 1000ULL )
+    {
+        len = snprintf( text, sizeof( text ), "%lldns", nanos );
+    }
+    else if( abs_nanos < 1000000ULL )
+    {
+        len = snprintf( text, sizeof( text ), "%.6gus", nanos / 1e3 );
+    }
+    else if( abs_nanos < 1000000000ULL )
+    {
+        len = snprintf( text, sizeof( text ), "%.6gms", nanos / 1e6 );
+    }
+    else
+    {
+        len = snprintf( text, sizeof( text ), "%.6gs", nanos / 1e9 );
+    }
+
+    __put_text( buf, text, len );
+}
+
+/**
+** Append the value of a field.
+** Strings are quoted for JSON and if needed for logfmt.
+*/
+static void __put_value( log_buffer_t *buf, const log_field_t *field, const log_encoding_t encoding )
+{
+    char text[ 32 ];
+
+    switch( field->type )
+    {
+        case TL_FIELD_STR:
+            if( field->value.s != NULL )
+            {
+                __put_string( buf, field->value.s, strlen( field->value.s ), encoding );
+            }
+            else
+            {
+                __put_str( buf, encoding == LOG_ENCODING_JSON ? "null" : "(null)" );
+            }
+            break;
+        case TL_FIELD_INT:
+            __put_text( buf, text, snprintf( text, sizeof( text ), "%lld", field->value.i ) );
+            break;
+        case TL_FIELD_UINT:
+            __put_text( buf, text, snprintf( text, sizeof( text ), "%llu", field->value.u ) );
+            break;
+        case TL_FIELD_DOUBLE:
+            __put_text( buf, text, snprintf( text, sizeof( text ), "%.17g", field->value.d ) );
+            break;
+        case TL_FIELD_BOOL:
+            __put_str( buf, field->value.b ? "true" : "false" );
+            break;
+        case TL_FIELD_DUR:
+            if( encoding == LOG_ENCODING_JSON )
+            {
+                // JSON consumers get plain nanoseconds
+                __put_text( buf, text, snprintf( text, sizeof( text ), "%lld", field->value.i ) );
+            }
+            else
+            {
+                __put_duration( buf, field->value.i );
+            }
+            break;
+    }
+}
+
+/**
+** Append a key of a structured encoding
+*/
+static void __put_key( log_buffer_t *buf, const char *key, const log_encoding_t encoding )
+{
+    if( encoding == LOG_ENCODING_JSON )
+    {
+        __put_char( buf, ',' );
+        __put_json( buf, key, strlen( key ) );
+        __put_char( buf, ':' );
+    }
+    else
+    {
+        __put_char( buf, ' ' );
+        __put_str( buf, key );
+        __put_char( buf, '=' );
+    }
+}
+
+/**
+** Append a key and its value.
+** A pair which doesn't fit is removed again, except for strings which are
+** cut (and still closed). Returns false if nothing more fits.
+*/
+static bool __put_field( log_buffer_t *buf, const log_field_t *field, const log_encoding_t encoding )
+{
+    const size_t len = buf->len;
+
+    __put_key( buf, field->key, encoding );
+    if( !buf->full )
+    {
+        __put_value( buf, field, encoding );
+
+        if( !buf->full || field->type == TL_FIELD_STR )
+        {
+            return !buf->full;
+        }
+    }
+
+    buf->len = len;
+
+    return false;
+}
+
+static inline bool __put_string_field( log_buffer_t *buf, const char *key, const char *text, const log_encoding_t encoding )
+{
+    const log_field_t field = { key, TL_FIELD_STR, { .s = text } };
+
+    return __put_field( buf, &field, encoding );
+}
+
+static inline bool __put_int_field( log_buffer_t *buf, const char *key, const long long value, const log_encoding_t encoding )
+{
+    const log_field_t field = { key, TL_FIELD_INT, { .i = value } };
+
+    return __put_field( buf, &field, encoding );
+}
+
+/**
+** Append the fields of the record, ' key=value' for the human and logfmt encodings,
+** ',"key":value' for JSON.
+** Returns the new length.
+*/
+size_t __tinylog_encode_fields( const log_encoding_t encoding, char *str, const size_t size, size_t len, const log_record_t *rec )
+{
+    log_buffer_t buf = { str, size, len, false };
+
+    const char *pos = rec->msg + rec->len + 1;
+    for( unsigned i = 0; i < rec->field_count; i++ )
+    {
+        log_field_t field;
+        pos = __unpack_field( pos, &field );
+
+        if( !__put_field( &buf, &field, encoding ) )
+        {
+            break;
+        }
+    }
+
+    return buf.len;
+}
+
+/**
+** Encode the whole record as logfmt or JSON (without '\n').
+** Returns the length.
+*/
+size_t __tinylog_encode_record( const log_encoding_t encoding, char *str, const size_t size,
+        const log_record_t *rec, const char *msg, const size_t msg_len )
+{
+    // room for the closing brace of JSON
+    log_buffer_t buf = { str, size - 1, 0, false };
+    const bool json = encoding == LOG_ENCODING_JSON;
+
+    struct timespec time;
+    __tinylog_wall_time( rec->stamp, rec->clock, &time );
+
+    char text[ TINYLOG_TIME_SIZE ];
+    const size_t time_len = __tinylog_format_time( text, &time );
+
+    __put_str( &buf, json ? "{\"time\":" : "time=" );
+    __put_string( &buf, text, time_len, encoding );
+
+    __put_key( &buf, "level", encoding );
+    if( 0 <= rec->severity && rec->severity < (int) ( sizeof( LEVELS ) / sizeof( LEVELS[ 0 ] ) ) )
+    {
+        __put_string( &buf, LEVELS[ rec->severity ], strlen( LEVELS[ rec->severity ] ), encoding );
+    }
+    else
+    {
+        __put_text( &buf, text, snprintf( text, sizeof( text ), "%d", rec->severity ) );
+    }
+
+    if( rec->flags & RECORD_THREAD_INFO )
+    {
+        __put_int_field( &buf, "tid", rec->tid, encoding );
+
+        if( rec->thread_name[ 0 ] != '\0' )
+        {
+            __put_string_field( &buf, "thread", rec->thread_name, encoding );
+        }
+    }
+
+    if( rec->category != 0 )
+    {
+        __put_string_field( &buf, "category", strlog_category( rec->category ), encoding );
+    }
+
+    if( rec->sample_rate > 1 )
+    {
+        __put_int_field( &buf, "sample_rate", rec->sample_rate, encoding );
+    }
+
+    // the message may be cut, anything after it is only written if it fits
+    __put_key( &buf, "msg", encoding );
+    __put_string( &buf, msg, msg_len, encoding );
+
+    if( !buf.full
+        && __put_string_field( &buf, "func", rec->func, encoding )
+        && __put_int_field( &buf, "line", rec->line, encoding )
+        && ( rec->err_no <= 0
+            || ( __put_int_field( &buf, "errno", rec->err_no, encoding )
+                && ( !get_log_errno_names() || strlog_errno_name( rec->err_no ) == NULL
+                    || __put_string_field( &buf, "errno_name", strlog_errno_name( rec->err_no ), encoding ) )
+                && __put_string_field( &buf, "error", strlog_errno( rec->err_no ), encoding ) ) ) )
+    {
+        buf.len = __tinylog_encode_fields( encoding, buf.str, buf.size, buf.len, rec );
+    }
+
+    if( json )
+    {
+        // there is always room for it
+        buf.str[ buf.len++ ] = '}';
+    }
+
+    return buf.len;
+}
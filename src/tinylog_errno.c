@@ -0,0 +1,287 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Verbose names for errno.
+**
+** strerror() is neither thread-safe nor cheap (it goes through the locale each time).
+** The messages and symbolic names of all errno values are looked up once and kept
+** in a table which is never changed afterwards, together with the complete text
+** appended to log messages, so that appending it is a lookup and a memcpy().
+** The table is built by open_tinylog() or by the first message which needs it
+** and published with a single atomic store.
+*/
+
+#define _GNU_SOURCE     /* strerror_r() returning the message, strerrorname_np() */
+
+#include <stdio.h>      /* snprintf() */
+
+#include "tinylog_internal.h"
+
+/**
+** errno values covered by the table, others are looked up by each call
+*/
+#define ERRNO_TABLE_SIZE    256
+
+/**
+** Text for a single errno value
+*/
+struct LogErrno {
+    const char     *message;            // 'Connection reset by peer'
+    const char     *name;               // 'ECONNRESET', NULL if unknown
+    const char     *text[ 2 ];          // '; Errno(104): Connection reset by peer', '; Errno(ECONNRESET): ...'
+    unsigned short  text_len[ 2 ];
+};
+typedef struct LogErrno log_errno_t;
+
+/**
+** The table, all strings follow the entries in the same allocation
+*/
+struct LogErrnoTable {
+    log_errno_t     entries[ ERRNO_TABLE_SIZE ];
+    char            strings[];
+};
+typedef struct LogErrnoTable log_errno_table_t;
+
+/**
+** The table once it is built, never changed afterwards
+*/
+static const log_errno_table_t *__errno_table = NULL;
+
+/**
+** Should the symbolic name of errno be shown instead of its number
+*/
+static bool __errno_names = false;     // atomic
+
+
+// internal prototypes
+
+static const log_errno_table_t *__build_table( void );
+
+
+// functions
+
+/**
+** Retrieve the table, building it on first use.
+** Returns NULL if no memory is left.
+*/
+static inline const log_errno_table_t *__table( void )
+{
+    const log_errno_table_t *table = __atomic_load_n( &__errno_table, __ATOMIC_ACQUIRE );
+    if( __builtin_expect( table != NULL, 1 ) )
+    {
+        return table;
+    }
+
+    return __build_table();
+}
+
+/**
+** Symbolic name of the errno value, NULL if unknown
+*/
+static const char *__errno_name( const int err_no )
+{
+#if defined( __GLIBC__ ) && __GLIBC_PREREQ( 2, 32 )
+    return strerrorname_np( err_no );
+#else
+    (void) err_no;
+    return NULL;
+#endif
+}
+
+/**
+** Look up the messages and names of all errno values.
+** Threads racing to build the table all build one, the first one published is kept.
+*/
+static const log_errno_table_t *__build_table( void )
+{
+    // may be called from threads with small stacks
+    char (*messages)[ 128 ] = malloc( ERRNO_TABLE_SIZE * sizeof( *messages ) );
+    if( messages == NULL )
+    {
+        return NULL;
+    }
+    const char *names[ ERRNO_TABLE_SIZE ];
+
+    // the size of all strings: message and name, plus the texts repeating them
+    size_t size = 0;
+    for( int err_no = 0; err_no < ERRNO_TABLE_SIZE; err_no++ )
+    {
+        const char *message = strerror_r( err_no, messages[ err_no ], sizeof( messages[ err_no ] ) );
+        if( message != messages[ err_no ] )
+        {
+            snprintf( messages[ err_no ], sizeof( messages[ err_no ] ), "%s", message );
+        }
+        names[ err_no ] = __errno_name( err_no );
+
+        const size_t message_len = strlen( messages[ err_no ] );
+        const size_t name_len = names[ err_no ] != NULL ? strlen( names[ err_no ] ) : 0;
+
+        size += 3 * ( message_len + 1 ) + 2 * ( name_len + 1 ) + 2 * sizeof( "; Errno(255): " );
+    }
+
+    log_errno_table_t *table = malloc( sizeof( log_errno_table_t ) + size );
+    if( table == NULL )
+    {
+        free( messages );
+        return NULL;
+    }
+
+    char *str = table->strings;
+    for( int err_no = 0; err_no < ERRNO_TABLE_SIZE; err_no++ )
+    {
+        log_errno_t *entry = &table->entries[ err_no ];
+
+        const size_t message_len = strlen( messages[ err_no ] ) + 1;
+        entry->message = memcpy( str, messages[ err_no ], message_len );
+        str += message_len;
+
+        entry->name = NULL;
+        if( names[ err_no ] != NULL )
+        {
+            const size_t name_len = strlen( names[ err_no ] ) + 1;
+            entry->name = memcpy( str, names[ err_no ], name_len );
+            str += name_len;
+        }
+
+        for( int named = 0; named < 2; named++ )
+        {
+            const int len = named && entry->name != NULL
+                    ? sprintf( str, "; Errno(%s): %s", entry->name, entry->message )
+                    : sprintf( str, "; Errno(%d): %s", err_no, entry->message );
+
+            entry->text[ named ]     = str;
+            entry->text_len[ named ] = len;
+            str += len + 1;
+        }
+    }
+
+    free( messages );
+
+    const log_errno_table_t *expected = NULL;
+    if( !__atomic_compare_exchange_n( &__errno_table, &expected, table, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+    {
+        // another thread was faster
+        free( table );
+        return expected;
+    }
+
+    return table;
+}
+
+/**
+** Build the table ahead of the first error, e.g. before the locale is changed.
+*/
+void __tinylog_errno_init( void )
+{
+    __table();
+}
+
+/**
+** Text appended to messages for errno, '; Errno(104): Connection reset by peer'
+** or '; Errno(ECONNRESET): Connection reset by peer' if set_log_errno_names() is on.
+** Values outside of the table are formatted into the buffer.
+*/
+const char *__tinylog_errno_text( const int err_no, char *buf, const size_t size, size_t *len )
+{
+    const log_errno_table_t *table = __table();
+    const bool named = __atomic_load_n( &__errno_names, __ATOMIC_RELAXED );
+
+    if( table != NULL && 0 <= err_no && err_no < ERRNO_TABLE_SIZE )
+    {
+        *len = table->entries[ err_no ].text_len[ named ];
+        return table->entries[ err_no ].text[ named ];
+    }
+
+    char message_buf[ 128 ];
+    const char *message = strerror_r( err_no, message_buf, sizeof( message_buf ) );
+
+    const char *name = named ? __errno_name( err_no ) : NULL;
+    const int n = name != NULL
+            ? snprintf( buf, size, "; Errno(%s): %s", name, message )
+            : snprintf( buf, size, "; Errno(%d): %s", err_no, message );
+
+    *len = n < (int) size ? (size_t) n : size - 1;
+    return buf;
+}
+
+/**
+** Message of the errno value, NULL if the table isn't built (yet).
+** Async-signal-safe.
+*/
+const char *__tinylog_errno_cached( const int err_no )
+{
+    const log_errno_table_t *table = __atomic_load_n( &__errno_table, __ATOMIC_ACQUIRE );
+
+    if( table != NULL && 0 <= err_no && err_no < ERRNO_TABLE_SIZE )
+    {
+        return table->entries[ err_no ].message;
+    }
+
+    return NULL;
+}
+
+/**
+** Retrieve the message of the given errno value, as strerror() would.
+*/
+const char *strlog_errno( const int err_no )
+{
+    const log_errno_table_t *table = __table();
+
+    if( table != NULL && 0 <= err_no && err_no < ERRNO_TABLE_SIZE )
+    {
+        return table->entries[ err_no ].message;
+    }
+
+    return "Unknown error";
+}
+
+/**
+** Retrieve the symbolic name of the given errno value, e.g. 'ECONNRESET'.
+** Returns NULL for unknown values.
+*/
+const char *strlog_errno_name( const int err_no )
+{
+    const log_errno_table_t *table = __table();
+
+    if( table != NULL && 0 <= err_no && err_no < ERRNO_TABLE_SIZE )
+    {
+        return table->entries[ err_no ].name;
+    }
+
+    return __errno_name( err_no );
+}
+
+/**
+** Whether the symbolic name of errno should be shown instead of its number
+**
+** default: false
+*/
+void set_log_errno_names( const bool errno_names )
+{
+    if( errno_names != __atomic_exchange_n( &__errno_names, errno_names, __ATOMIC_RELAXED ) )
+    {
+        log_TRACE(0, "Set 'errno_names' to: %s", errno_names ? "true" : "false" );
+    }
+}
+
+bool get_log_errno_names( void )
+{
+    return __atomic_load_n( &__errno_names, __ATOMIC_RELAXED );
+}
@@ -0,0 +1,509 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Log file backed by memory mapped segments.
+**
+** A segment is allocated at its full size when it is created and mapped into
+** memory. Writers reserve room for a line by advancing the offset of the
+** segment with compare-and-swap and copy the line, no system call involved.
+** When a segment is full (or old enough) it is replaced: the new segment is
+** published first, then the old one is finished as soon as the last writer
+** left it (unmapped and truncated to the lines written).
+*/
+
+#include <errno.h>      /* ENOENT */
+#include <fcntl.h>      /* open(), posix_fallocate() */
+#include <limits.h>     /* PATH_MAX */
+#include <pthread.h>    /* pthread_create() */
+#include <sched.h>      /* sched_yield() */
+#include <unistd.h>     /* ftruncate(), fdatasync() */
+
+#include <sys/mman.h>   /* mmap(), msync() */
+
+#include "tinylog_internal.h"
+
+/**
+** Size of a segment if none is given
+*/
+#define SEGMENT_SIZE_DEFAULT    ( 16 << 20 )
+
+/**
+** Segments in use at the same time: the current one and the one being finished
+*/
+#define SEGMENT_COUNT           2
+
+/**
+** A memory mapped segment of the log file
+*/
+struct LogSegment {
+    char           *base;
+    size_t          size;
+    size_t          offset;         // end of the lines written so far (atomic)
+    unsigned        writers;        // threads copying lines into the segment (atomic)
+    int             fd;
+    time_t          created;
+};
+typedef struct LogSegment log_segment_t;
+
+/**
+** Segments are never freed, so that writers may look at a segment which has
+** been replaced in the meantime
+*/
+static log_segment_t    __segments[ SEGMENT_COUNT ];
+static unsigned         __next_segment;
+
+/**
+** Segment lines are written to, NULL if there is no log file (atomic)
+*/
+static log_segment_t   *__current = NULL;
+
+/**
+** Settings of the log file
+*/
+static char             __path[ PATH_MAX ];
+static size_t           __segment_size;
+static unsigned         __rotate_seconds;
+static unsigned         __max_files;
+
+/**
+** How often the log file is synchronized to disk, 0 for never (atomic)
+*/
+static unsigned         __sync_interval = 1000;
+
+/**
+** Serializes opening, rotating and closing the log file
+*/
+static pthread_mutex_t  __file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+** Background thread synchronizing the log file and rotating it by time
+*/
+static pthread_t        __sync_thread;
+static bool             __sync_running = false;
+static pthread_mutex_t  __sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   __sync_stop = PTHREAD_COND_INITIALIZER;
+
+// internal prototypes
+
+static void *__sync_main( void *arg );
+static void __report_segment_error( const int err_no );
+
+
+// functions
+
+/**
+** Rename 'path' to 'path.1', 'path.1' to 'path.2' ... dropping the oldest file.
+** Has to be called with the file lock held.
+*/
+static void __shift_files( void )
+{
+    char from[ PATH_MAX + 16 ];
+    char to[ PATH_MAX + 16 ];
+
+    if( __max_files == 0 )
+    {
+        unlink( __path );
+        return;
+    }
+
+    for( unsigned i = __max_files; i > 0; i-- )
+    {
+        if( i == 1 )
+        {
+            snprintf( from, sizeof( from ), "%s", __path );
+        }
+        else
+        {
+            snprintf( from, sizeof( from ), "%s.%u", __path, i - 1 );
+        }
+        snprintf( to, sizeof( to ), "%s.%u", __path, i );
+
+        rename( from, to );
+    }
+}
+
+/**
+** Create and map a new segment at 'path', moving existing files out of the way.
+** Has to be called with the file lock held.
+** Returns the error number if the segment can't be created.
+*/
+static int __create_segment( log_segment_t *seg )
+{
+    __shift_files();
+
+    const int fd = open( __path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+    if( fd < 0 )
+    {
+        return errno;
+    }
+
+    // allocate the blocks up front, so that writing lines never fails because of a full disk
+    // (which would raise SIGBUS in the log call), only file systems which can't allocate get a sparse file
+    int err_no = posix_fallocate( fd, 0, __segment_size );
+    if( err_no == EOPNOTSUPP || err_no == EINVAL )
+    {
+        err_no = ftruncate( fd, __segment_size ) == 0 ? 0 : errno;
+    }
+
+    if( err_no != 0 )
+    {
+        close( fd );
+
+        return err_no;
+    }
+
+    char *base = mmap( NULL, __segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( base == MAP_FAILED )
+    {
+        err_no = errno;
+        close( fd );
+
+        return err_no;
+    }
+
+    seg->base    = base;
+    seg->size    = __segment_size;
+    seg->fd      = fd;
+    seg->created = time( NULL );
+    __atomic_store_n( &seg->offset, 0, __ATOMIC_SEQ_CST );
+
+    return 0;
+}
+
+/**
+** Finish a segment which isn't the current segment anymore: wait for the last writer,
+** unmap it and cut the file to the lines written.
+** Has to be called with the file lock held.
+*/
+static void __finish_segment( log_segment_t *seg )
+{
+    while( __atomic_load_n( &seg->writers, __ATOMIC_SEQ_CST ) != 0 )
+    {
+        sched_yield();
+    }
+
+    const size_t used = __atomic_load_n( &seg->offset, __ATOMIC_SEQ_CST );
+
+    munmap( seg->base, seg->size );
+    seg->base = NULL;
+
+    if( ftruncate( seg->fd, used ) == 0 && __atomic_load_n( &__sync_interval, __ATOMIC_RELAXED ) > 0 )
+    {
+        fdatasync( seg->fd );
+    }
+    close( seg->fd );
+}
+
+/**
+** Replace the given segment by a new one, unless that happened already.
+** Returns the error number if the new segment can't be created.
+*/
+static int __rotate( log_segment_t *seg )
+{
+    int err_no = 0;
+
+    pthread_mutex_lock( &__file_lock );
+
+    if( seg == __atomic_load_n( &__current, __ATOMIC_SEQ_CST ) )
+    {
+        log_segment_t *next = &__segments[ __next_segment ];
+
+        err_no = __create_segment( next );
+        if( err_no == 0 )
+        {
+            __next_segment = ( __next_segment + 1 ) % SEGMENT_COUNT;
+            __atomic_store_n( &__current, next, __ATOMIC_SEQ_CST );
+        }
+        else
+        {
+            // no more lines for the log file
+            __atomic_store_n( &__current, NULL, __ATOMIC_SEQ_CST );
+        }
+
+        __finish_segment( seg );
+    }
+
+    pthread_mutex_unlock( &__file_lock );
+
+    if( err_no != 0 )
+    {
+        __report_segment_error( err_no );
+    }
+
+    return err_no;
+}
+
+/**
+** Report that the log file was given up because a new segment couldn't be created.
+** The message only goes to stderr, the log file is gone already.
+*/
+static void __report_segment_error( const int err_no )
+{
+    char msg[ TINYLOG_MSG_SIZE ];
+
+    log_record_t rec;
+    rec.msg      = msg;
+    rec.size     = sizeof( msg );
+    rec.stamp    = __tinylog_now( &rec.clock );
+    rec.func     = __FUNCTION__;
+    rec.category = 0;
+    rec.line     = __LINE__;
+    rec.severity = LOG_ERR;
+    rec.err_no   = err_no;
+    rec.sample_rate = 0;
+    rec.flags    = STDERR | ( get_dev_logging() ? RECORD_DEV_LOGGING : 0 );
+    rec.field_count = 0;
+    rec.len      = snprintf( rec.msg, rec.size, "Could not rotate log file, no more lines are written" );
+
+    __tinylog_emit( &rec );
+}
+
+/**
+** Enter the current segment, so that it isn't unmapped while it is used.
+** Returns NULL if there is no log file.
+*/
+static log_segment_t *__enter_segment( void )
+{
+    for( ;; )
+    {
+        log_segment_t *seg = __atomic_load_n( &__current, __ATOMIC_SEQ_CST );
+        if( seg == NULL )
+        {
+            return NULL;
+        }
+
+        __atomic_add_fetch( &seg->writers, 1, __ATOMIC_SEQ_CST );
+
+        // still current, so it won't be finished before we leave
+        if( seg == __atomic_load_n( &__current, __ATOMIC_SEQ_CST ) )
+        {
+            return seg;
+        }
+
+        __atomic_sub_fetch( &seg->writers, 1, __ATOMIC_SEQ_CST );
+    }
+}
+
+static void __leave_segment( log_segment_t *seg )
+{
+    __atomic_sub_fetch( &seg->writers, 1, __ATOMIC_SEQ_CST );
+}
+
+/**
+** Append the line to the current segment of the log file.
+*/
+void __tinylog_file_write( const char *line, const size_t len )
+{
+    // a line is retried once in a new segment
+    for( int attempt = 0; attempt < 2; attempt++ )
+    {
+        log_segment_t *seg = __enter_segment();
+        if( seg == NULL )
+        {
+            return;
+        }
+
+        size_t offset = __atomic_load_n( &seg->offset, __ATOMIC_RELAXED );
+        do
+        {
+            if( offset + len > seg->size )
+            {
+                break;
+            }
+        }
+        while( !__atomic_compare_exchange_n( &seg->offset, &offset, offset + len, false,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+
+        if( offset + len <= seg->size )
+        {
+            memcpy( seg->base + offset, line, len );
+            __leave_segment( seg );
+
+            return;
+        }
+
+        const size_t size = seg->size;
+        __leave_segment( seg );
+
+        if( len > size )
+        {
+            // will never fit
+            return;
+        }
+
+        if( __rotate( seg ) != 0 )
+        {
+            return;
+        }
+    }
+}
+
+/**
+** Log file for the LOGFILE destination.
+*/
+bool open_tinylog_file( const char *path, const size_t segment_size, const unsigned rotate_seconds, const unsigned max_files )
+{
+    if( path == NULL || strlen( path ) >= sizeof( __path ) )
+    {
+        log_WARNING(0, "Invalid log file name. Ignoring");
+        return false;
+    }
+
+    close_tinylog_file();
+
+    pthread_mutex_lock( &__file_lock );
+
+    snprintf( __path, sizeof( __path ), "%s", path );
+    __segment_size   = segment_size > 0 ? segment_size : SEGMENT_SIZE_DEFAULT;
+    __rotate_seconds = rotate_seconds;
+    __max_files      = max_files;
+
+    log_segment_t *seg = &__segments[ __next_segment ];
+    const int err_no = __create_segment( seg );
+    if( err_no == 0 )
+    {
+        __next_segment = ( __next_segment + 1 ) % SEGMENT_COUNT;
+        __atomic_store_n( &__current, seg, __ATOMIC_SEQ_CST );
+    }
+
+    pthread_mutex_unlock( &__file_lock );
+
+    if( err_no != 0 )
+    {
+        log_ERR(err_no, "Could not create log file: %s", path);
+        return false;
+    }
+
+    static bool registered = false;
+    if( !registered )
+    {
+        // cut the file to the lines written when the program exits
+        atexit( close_tinylog_file );
+        registered = true;
+    }
+
+    pthread_mutex_lock( &__sync_lock );
+    __sync_running = pthread_create( &__sync_thread, NULL, __sync_main, NULL ) == 0;
+    pthread_mutex_unlock( &__sync_lock );
+
+    log_TRACE(0, "Opened log file: %s", path);
+
+    return true;
+}
+
+void close_tinylog_file( void )
+{
+    // lines still queued for the asynchronous logger go to the file as well
+    tinylog_flush();
+
+    pthread_mutex_lock( &__sync_lock );
+    const bool running = __sync_running;
+    __sync_running = false;
+    pthread_cond_signal( &__sync_stop );
+    pthread_mutex_unlock( &__sync_lock );
+
+    if( running )
+    {
+        pthread_join( __sync_thread, NULL );
+    }
+
+    pthread_mutex_lock( &__file_lock );
+
+    log_segment_t *seg = __atomic_exchange_n( &__current, NULL, __ATOMIC_SEQ_CST );
+    if( seg != NULL )
+    {
+        __finish_segment( seg );
+    }
+
+    pthread_mutex_unlock( &__file_lock );
+}
+
+/**
+** Synchronize the current segment to disk and rotate it if it is too old.
+*/
+static void *__sync_main( void *arg )
+{
+    (void) arg;
+
+    pthread_mutex_lock( &__sync_lock );
+
+    while( __sync_running )
+    {
+        const unsigned interval = __atomic_load_n( &__sync_interval, __ATOMIC_RELAXED );
+        const unsigned wait_ms  = interval > 0 ? interval : 1000;
+
+        struct timespec until;
+        clock_gettime( CLOCK_REALTIME, &until );
+        until.tv_sec  += wait_ms / 1000;
+        until.tv_nsec += ( wait_ms % 1000 ) * 1000000L;
+        if( until.tv_nsec >= 1000000000L )
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait( &__sync_stop, &__sync_lock, &until );
+        if( !__sync_running )
+        {
+            break;
+        }
+        pthread_mutex_unlock( &__sync_lock );
+
+        log_segment_t *seg = __enter_segment();
+        if( seg != NULL )
+        {
+            if( interval > 0 )
+            {
+                const size_t used = __atomic_load_n( &seg->offset, __ATOMIC_RELAXED );
+                if( used > 0 )
+                {
+                    msync( seg->base, used, MS_SYNC );
+                }
+            }
+
+            const bool expired = __rotate_seconds > 0 && time( NULL ) - seg->created >= (time_t) __rotate_seconds;
+            __leave_segment( seg );
+
+            if( expired )
+            {
+                __rotate( seg );
+            }
+        }
+
+        pthread_mutex_lock( &__sync_lock );
+    }
+
+    pthread_mutex_unlock( &__sync_lock );
+
+    return NULL;
+}
+
+void set_log_file_sync( const unsigned interval_ms )
+{
+    if( interval_ms != __atomic_exchange_n( &__sync_interval, interval_ms, __ATOMIC_RELAXED ) )
+    {
+        log_TRACE(0, "Set 'file_sync' to: %u ms", interval_ms );
+    }
+}
+
+unsigned get_log_file_sync( void )
+{
+    return __atomic_load_n( &__sync_interval, __ATOMIC_RELAXED );
+}
@@ -0,0 +1,808 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Formatting and deferred formatting.
+**
+** Format strings which are literals are parsed once and cached by their address.
+** Formats of other strings might be changed or freed after the log call, the
+** address doesn't tell their text, so they are left to vsnprintf().
+** The parsed format tells which arguments a log call passes, so that the
+** raw argument values can be captured on the calling thread and turned into
+** text later on (e.g. by the writer thread of the asynchronous logger).
+** It also lets messages be formatted without the generic printf() machinery:
+** plain conversions ('%d', '%s', '%p', ... without flags, width and precision)
+** are turned into text directly, all others are handed to snprintf() one by one.
+*/
+
+#include <limits.h>     /* INT_MAX */
+#include <stddef.h>     /* ptrdiff_t */
+#include <stdint.h>     /* intmax_t */
+
+#include <sys/types.h>  /* ssize_t */
+
+#include "tinylog_internal.h"
+
+/**
+** Count of cached format strings, has to be a power of two
+*/
+#define FORMAT_CACHE_SIZE   512
+
+/**
+** Maximum length of a single conversion specification, e.g. '%-08.3lld'
+*/
+#define FORMAT_SPEC_SIZE    32
+
+/**
+** States of a cache entry
+*/
+#define ENTRY_FREE      0
+#define ENTRY_WRITING   1
+#define ENTRY_READY     2
+
+struct LogFormatEntry {
+    unsigned        state;
+    log_format_t    format;
+};
+
+/**
+** Cache of parsed format strings, entries are never evicted
+*/
+static struct LogFormatEntry __formats[ FORMAT_CACHE_SIZE ];
+
+
+// functions
+
+/**
+** Parse a single conversion specification starting after the '%'.
+** Returns false if the conversion can't be captured.
+*/
+static bool __parse_spec( const char *fmt, unsigned *pos, log_format_spec_t *spec )
+{
+    unsigned p = *pos;
+
+    spec->conversion = 0;
+    spec->precision  = PRECISION_NONE;
+
+    // flags
+    while( fmt[ p ] == '-' || fmt[ p ] == '+' || fmt[ p ] == ' '
+        || fmt[ p ] == '#' || fmt[ p ] == '0' || fmt[ p ] == '\'' || fmt[ p ] == 'I'
+    )
+    {
+        p++;
+    }
+
+    // width
+    if( fmt[ p ] == '*' )
+    {
+        spec->stars++;
+        p++;
+    }
+    else
+    {
+        while( '0' <= fmt[ p ] && fmt[ p ] <= '9' )
+        {
+            p++;
+        }
+    }
+
+    // positional arguments such as '%1$d' are not supported
+    if( fmt[ p ] == '$' )
+    {
+        return false;
+    }
+
+    // precision, strings are captured up to it
+    if( fmt[ p ] == '.' )
+    {
+        p++;
+        if( fmt[ p ] == '*' )
+        {
+            spec->stars++;
+            spec->precision = PRECISION_ARG;
+            p++;
+        }
+        else
+        {
+            spec->precision = 0;
+            while( '0' <= fmt[ p ] && fmt[ p ] <= '9' )
+            {
+                if( spec->precision < INT_MAX / 10 )
+                {
+                    spec->precision = spec->precision * 10 + ( fmt[ p ] - '0' );
+                }
+                p++;
+            }
+        }
+    }
+
+    // length modifier
+    int longs = 0;
+    char modifier = 0;
+    for( ;; )
+    {
+        const char c = fmt[ p ];
+        if( c == 'h' )
+        {
+            p++;
+        }
+        else if( c == 'l' )
+        {
+            longs++;
+            p++;
+        }
+        else if( c == 'q' || c == 'L' )
+        {
+            longs = 2;
+            modifier = c;
+            p++;
+        }
+        else if( c == 'j' || c == 'z' || c == 'Z' || c == 't' )
+        {
+            modifier = c;
+            p++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // conversion
+    switch( fmt[ p ] )
+    {
+        case 'd': case 'i':
+        case 'u': case 'o': case 'x': case 'X':
+            switch( modifier )
+            {
+                case 'j':           spec->type = ARG_INTMAX;  break;
+                case 'z': case 'Z': spec->type = ARG_SIZE;    break;
+                case 't':           spec->type = ARG_PTRDIFF; break;
+                default:
+                    spec->type = longs == 0 ? ARG_INT : longs == 1 ? ARG_LONG : ARG_LLONG;
+            }
+            break;
+
+        case 'c':
+            if( longs )
+            {
+                return false;   // wide characters
+            }
+            spec->type = ARG_INT;
+            break;
+
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':
+            spec->type = modifier == 'L' ? ARG_LDOUBLE : ARG_DOUBLE;
+            break;
+
+        case 's':
+            if( longs )
+            {
+                return false;   // wide strings
+            }
+            spec->type = ARG_STR;
+            break;
+
+        case 'p':
+            spec->type = ARG_PTR;
+            break;
+
+        case '%':
+            spec->type = ARG_NONE;
+            break;
+
+        default:
+            // '%n', '%m', wide characters, unknown conversions
+            return false;
+    }
+
+    // anything between '%' and the conversion but 'l', 'll', 'j', 'z' or 't' needs snprintf()
+    const unsigned modifiers = longs + ( modifier == 'j' || modifier == 'z' || modifier == 'Z' || modifier == 't' );
+    if( p == *pos + modifiers && modifier != 'L' && modifier != 'q' )
+    {
+        switch( fmt[ p ] )
+        {
+            case 'd': case 'i':
+                spec->conversion = 'd';
+                break;
+            case 'u': case 'o': case 'x': case 'X': case 'c': case 's': case 'p':
+                spec->conversion = fmt[ p ];
+                break;
+        }
+    }
+
+    *pos = p + 1;
+
+    return true;
+}
+
+/**
+** Parse the format string into the given format.
+*/
+static void __parse( const char *fmt, log_format_t *format )
+{
+    format->fmt = fmt;
+    format->len = strlen( fmt );
+    format->spec_count = 0;
+    format->deferrable = true;
+    format->plain = true;
+
+    unsigned pos = 0;
+    while( fmt[ pos ] != '\0' )
+    {
+        if( fmt[ pos ] != '%' )
+        {
+            pos++;
+            continue;
+        }
+
+        if( format->spec_count == FORMAT_MAX_SPECS )
+        {
+            format->deferrable = false;
+            return;
+        }
+
+        log_format_spec_t *spec = &format->specs[ format->spec_count ];
+        spec->start = pos;
+        spec->stars = 0;
+
+        pos++;
+        if( !__parse_spec( fmt, &pos, spec ) || pos - spec->start >= FORMAT_SPEC_SIZE )
+        {
+            format->deferrable = false;
+            return;
+        }
+        spec->len = pos - spec->start;
+
+        if( spec->conversion == 0 && spec->type != ARG_NONE )
+        {
+            format->plain = false;
+        }
+
+        format->spec_count++;
+    }
+}
+
+/**
+** Retrieve the parsed form of the given format string.
+** Formats are parsed on first use and cached by their address,
+** so this is only for literals (see TINYLOG_LITERAL()).
+** Returns NULL if the cache is full.
+*/
+const log_format_t *__tinylog_format( const char *fmt )
+{
+    const unsigned long hash = ( (unsigned long) fmt >> 3 ) * 0x9E3779B97F4A7C15UL;
+
+    for( unsigned i = 0; i < FORMAT_CACHE_SIZE; i++ )
+    {
+        struct LogFormatEntry *entry = &__formats[ ( hash + i ) & ( FORMAT_CACHE_SIZE - 1 ) ];
+
+        unsigned state = __atomic_load_n( &entry->state, __ATOMIC_ACQUIRE );
+        if( state == ENTRY_READY )
+        {
+            if( entry->format.fmt == fmt )
+            {
+                return &entry->format;
+            }
+            continue;
+        }
+
+        if( state == ENTRY_WRITING )
+        {
+            // being parsed by another thread, possibly the same format
+            continue;
+        }
+
+        if( __atomic_compare_exchange_n( &entry->state, &state, ENTRY_WRITING, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+        {
+            __parse( fmt, &entry->format );
+            __atomic_store_n( &entry->state, ENTRY_READY, __ATOMIC_RELEASE );
+
+            return &entry->format;
+        }
+    }
+
+    // cache is full
+    return NULL;
+}
+
+/**
+** Parse the format string without caching it.
+*/
+void __tinylog_parse_format( const char *fmt, log_format_t *format )
+{
+    __parse( fmt, format );
+}
+
+/**
+** Copy a value of the given type from the argument list into the buffer.
+*/
+#define CAPTURE( type ) do \
+{ \
+    type value = va_arg( args, type ); \
+    if( len + sizeof( value ) > size ) \
+    { \
+        return -1; \
+    } \
+    memcpy( buf + len, &value, sizeof( value ) ); \
+    len += sizeof( value ); \
+} while (0)
+
+/**
+** Capture the raw values of the arguments described by the format.
+** Strings are copied up to the precision of their conversion (they need no '\0' then)
+** and terminated by '\0', preceded by a byte telling whether the pointer was NULL.
+** Returns the count of bytes used or -1 if the arguments don't fit.
+*/
+int __tinylog_capture( const log_format_t *format, char *buf, const size_t size, va_list args )
+{
+    size_t len = 0;
+
+    for( unsigned i = 0; i < format->spec_count; i++ )
+    {
+        const log_format_spec_t *spec = &format->specs[ i ];
+
+        // the precision taken from the arguments is the last '*'
+        int star_value = PRECISION_NONE;
+        for( unsigned star = 0; star < spec->stars; star++ )
+        {
+            star_value = va_arg( args, int );
+            if( len + sizeof( star_value ) > size )
+            {
+                return -1;
+            }
+            memcpy( buf + len, &star_value, sizeof( star_value ) );
+            len += sizeof( star_value );
+        }
+
+        switch( spec->type )
+        {
+            case ARG_NONE:                                  break;
+            case ARG_INT:       CAPTURE( int );             break;
+            case ARG_LONG:      CAPTURE( long );            break;
+            case ARG_LLONG:     CAPTURE( long long );       break;
+            case ARG_SIZE:      CAPTURE( size_t );          break;
+            case ARG_INTMAX:    CAPTURE( intmax_t );        break;
+            case ARG_PTRDIFF:   CAPTURE( ptrdiff_t );       break;
+            case ARG_DOUBLE:    CAPTURE( double );          break;
+            case ARG_LDOUBLE:   CAPTURE( long double );     break;
+            case ARG_PTR:       CAPTURE( void * );          break;
+
+            case ARG_STR:
+            {
+                const char *str = va_arg( args, const char * );
+
+                // a negative precision counts as none
+                const int precision = spec->precision == PRECISION_ARG ? star_value : spec->precision;
+
+                size_t str_len = 0;
+                if( str != NULL )
+                {
+                    str_len = precision >= 0 ? strnlen( str, precision ) : strlen( str );
+                }
+
+                if( len + 1 + str_len + ( str != NULL ) > size )
+                {
+                    return -1;
+                }
+
+                buf[ len++ ] = str != NULL;
+                if( str != NULL )
+                {
+                    memcpy( buf + len, str, str_len );
+                    buf[ len + str_len ] = '\0';
+                    len += str_len + 1;
+                }
+                break;
+            }
+        }
+    }
+
+    return len;
+}
+
+/**
+** Pairs of decimal digits, "00" to "99"
+*/
+static const char DECIMALS[ 201 ] =
+        "00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839"
+        "40414243444546474849" "50515253545556575859" "60616263646566676869" "70717273747576777879"
+        "80818283848586878889" "90919293949596979899";
+
+static const char HEX_LOWER[] = "0123456789abcdef";
+static const char HEX_UPPER[] = "0123456789ABCDEF";
+
+/**
+** Append literal text to the output, snprintf() style.
+*/
+static inline void __append( char *str, const size_t size, size_t *len, const char *text, const size_t text_len )
+{
+    if( *len + 1 < size )
+    {
+        const size_t room = size - 1 - *len;
+        memcpy( str + *len, text, text_len < room ? text_len : room );
+    }
+    *len += text_len;
+}
+
+/**
+** Write the digits of the value backwards, ending at 'end'.
+** Returns the start of the digits.
+*/
+static inline char *__digits( char *end, unsigned long long value, const char conversion )
+{
+    switch( conversion )
+    {
+        case 'x':
+        case 'X':
+        {
+            const char *hex = conversion == 'x' ? HEX_LOWER : HEX_UPPER;
+            do
+            {
+                *--end = hex[ value & 15 ];
+                value >>= 4;
+            }
+            while( value != 0 );
+            break;
+        }
+
+        case 'o':
+            do
+            {
+                *--end = '0' + ( value & 7 );
+                value >>= 3;
+            }
+            while( value != 0 );
+            break;
+
+        default:
+            while( value >= 100 )
+            {
+                const unsigned pair = value % 100;
+                value /= 100;
+                end -= 2;
+                memcpy( end, DECIMALS + 2 * pair, 2 );
+            }
+            if( value >= 10 )
+            {
+                end -= 2;
+                memcpy( end, DECIMALS + 2 * value, 2 );
+            }
+            else
+            {
+                *--end = '0' + value;
+            }
+    }
+
+    return end;
+}
+
+/**
+** Append an integer of a plain conversion ('d', 'u', 'o', 'x', 'X' or 'c').
+** 'value' holds the argument sign extended from its type, 'bytes' is the size of its type.
+*/
+static inline void __append_integer( char *str, const size_t size, size_t *len,
+        const char conversion, const long long value, const size_t bytes )
+{
+    if( conversion == 'c' )
+    {
+        const char c = (unsigned char) value;
+        __append( str, size, len, &c, 1 );
+        return;
+    }
+
+    char buf[ 24 ];
+    char *end = buf + sizeof( buf );
+    char *start;
+
+    if( conversion == 'd' )
+    {
+        start = __digits( end, value < 0 ? -(unsigned long long) value : (unsigned long long) value, 'd' );
+        if( value < 0 )
+        {
+            *--start = '-';
+        }
+    }
+    else
+    {
+        // unsigned conversions take the bits of the argument's type only
+        const unsigned long long mask = bytes < sizeof( mask ) ? ( 1ULL << ( 8 * bytes ) ) - 1 : ~0ULL;
+        start = __digits( end, (unsigned long long) value & mask, conversion );
+    }
+
+    __append( str, size, len, start, end - start );
+}
+
+/**
+** Append a string of a plain '%s' conversion.
+*/
+static inline void __append_string( char *str, const size_t size, size_t *len, const char *value )
+{
+    if( value == NULL )
+    {
+        __append( str, size, len, "(null)", 6 );
+        return;
+    }
+
+    __append( str, size, len, value, strlen( value ) );
+}
+
+/**
+** Append a pointer of a plain '%p' conversion.
+*/
+static inline void __append_pointer( char *str, const size_t size, size_t *len, const void *value )
+{
+    if( value == NULL )
+    {
+        __append( str, size, len, "(nil)", 5 );
+        return;
+    }
+
+    char buf[ 24 ];
+    char *end = buf + sizeof( buf );
+    char *start = __digits( end, (uintptr_t) value, 'x' );
+    *--start = 'x';
+    *--start = '0';
+
+    __append( str, size, len, start, end - start );
+}
+
+/**
+** Append a single conversion with snprintf(), with up to two '*' arguments.
+*/
+#define SNPRINTF( value ) do \
+{ \
+    char *out = *len < size ? str + *len : NULL; \
+    const size_t remaining = *len < size ? size - *len : 0; \
+    int n; \
+    switch( spec->stars ) \
+    { \
+        case 0:  n = snprintf( out, remaining, spec_str, value ); break; \
+        case 1:  n = snprintf( out, remaining, spec_str, stars[0], value ); break; \
+        default: n = snprintf( out, remaining, spec_str, stars[0], stars[1], value ); break; \
+    } \
+    if( n > 0 ) \
+    { \
+        *len += n; \
+    } \
+} while (0)
+
+/**
+** Append an integer, plain or with snprintf().
+*/
+#define APPEND_INTEGER( type, value ) do \
+{ \
+    const type integer = (value); \
+    if( spec->conversion != 0 ) \
+    { \
+        __append_integer( str, size, len, spec->conversion, integer, sizeof( type ) ); \
+    } \
+    else \
+    { \
+        SNPRINTF( integer ); \
+    } \
+} while (0)
+
+/**
+** Append a string, plain or with snprintf().
+*/
+#define APPEND_STRING( value ) do \
+{ \
+    const char *string = (value); \
+    if( spec->conversion != 0 ) \
+    { \
+        __append_string( str, size, len, string ); \
+    } \
+    else \
+    { \
+        SNPRINTF( string ); \
+    } \
+} while (0)
+
+/**
+** Append a pointer, plain or with snprintf().
+*/
+#define APPEND_POINTER( value ) do \
+{ \
+    const void *pointer = (value); \
+    if( spec->conversion != 0 ) \
+    { \
+        __append_pointer( str, size, len, pointer ); \
+    } \
+    else \
+    { \
+        SNPRINTF( pointer ); \
+    } \
+} while (0)
+
+/**
+** Copy the conversion specification, as format string of its own for snprintf().
+*/
+static inline void __spec_str( const log_format_t *format, const log_format_spec_t *spec, char *spec_str )
+{
+    memcpy( spec_str, format->fmt + spec->start, spec->len );
+    spec_str[ spec->len ] = '\0';
+}
+
+/**
+** Read a captured value of the given type.
+*/
+#define TAKE( type ) ( { \
+    type taken; \
+    memcpy( &taken, args + pos, sizeof( taken ) ); \
+    pos += sizeof( taken ); \
+    taken; \
+} )
+
+/**
+** Turn the captured arguments into text as vsnprintf() would have done.
+** Returns the length of the complete text, the output is truncated
+** to 'size' (including the terminating '\0').
+*/
+int __tinylog_render( const log_format_t *format, const char *args, char *str, const size_t size )
+{
+    const char *fmt = format->fmt;
+    size_t length = 0;
+    size_t *len = &length;
+    size_t pos = 0;
+    unsigned literal = 0;   // start of the text following the previous conversion
+
+    for( unsigned i = 0; i < format->spec_count; i++ )
+    {
+        const log_format_spec_t *spec = &format->specs[ i ];
+
+        __append( str, size, len, fmt + literal, spec->start - literal );
+        literal = spec->start + spec->len;
+
+        if( spec->type == ARG_NONE )
+        {
+            __append( str, size, len, "%", 1 );
+            continue;
+        }
+
+        char spec_str[ FORMAT_SPEC_SIZE ];
+        if( spec->conversion == 0 )
+        {
+            __spec_str( format, spec, spec_str );
+        }
+
+        int stars[2];
+        for( unsigned star = 0; star < spec->stars; star++ )
+        {
+            stars[ star ] = TAKE( int );
+        }
+
+        switch( spec->type )
+        {
+            case ARG_NONE:                                                      break;
+            case ARG_INT:       APPEND_INTEGER( int, TAKE( int ) );             break;
+            case ARG_LONG:      APPEND_INTEGER( long, TAKE( long ) );           break;
+            case ARG_LLONG:     APPEND_INTEGER( long long, TAKE( long long ) ); break;
+            case ARG_SIZE:      APPEND_INTEGER( ssize_t, TAKE( ssize_t ) );     break;
+            case ARG_INTMAX:    APPEND_INTEGER( intmax_t, TAKE( intmax_t ) );   break;
+            case ARG_PTRDIFF:   APPEND_INTEGER( ptrdiff_t, TAKE( ptrdiff_t ) ); break;
+            case ARG_DOUBLE:    SNPRINTF( TAKE( double ) );                     break;
+            case ARG_LDOUBLE:   SNPRINTF( TAKE( long double ) );                break;
+            case ARG_PTR:       APPEND_POINTER( TAKE( void * ) );               break;
+
+            case ARG_STR:
+            {
+                const char *value = args[ pos++ ] ? args + pos : NULL;
+                if( value != NULL )
+                {
+                    pos += strlen( value ) + 1;
+                }
+
+                APPEND_STRING( value );
+                break;
+            }
+        }
+    }
+
+    __append( str, size, len, fmt + literal, format->len - literal );
+
+    if( size > 0 )
+    {
+        str[ length < size ? length : size - 1 ] = '\0';
+    }
+
+    return length;
+}
+
+/**
+** Format the arguments as vsnprintf() would have done, using the parsed format.
+** Returns the length of the complete text, the output is truncated
+** to 'size' (including the terminating '\0').
+*/
+int __tinylog_vformat( const log_format_t *format, char *str, const size_t size, va_list args )
+{
+    const char *fmt = format->fmt;
+    size_t length = 0;
+    size_t *len = &length;
+    unsigned literal = 0;   // start of the text following the previous conversion
+
+    for( unsigned i = 0; i < format->spec_count; i++ )
+    {
+        const log_format_spec_t *spec = &format->specs[ i ];
+
+        __append( str, size, len, fmt + literal, spec->start - literal );
+        literal = spec->start + spec->len;
+
+        if( spec->type == ARG_NONE )
+        {
+            __append( str, size, len, "%", 1 );
+            continue;
+        }
+
+        char spec_str[ FORMAT_SPEC_SIZE ];
+        if( spec->conversion == 0 )
+        {
+            __spec_str( format, spec, spec_str );
+        }
+
+        int stars[2];
+        for( unsigned star = 0; star < spec->stars; star++ )
+        {
+            stars[ star ] = va_arg( args, int );
+        }
+
+        switch( spec->type )
+        {
+            case ARG_NONE:                                                              break;
+            case ARG_INT:       APPEND_INTEGER( int, va_arg( args, int ) );             break;
+            case ARG_LONG:      APPEND_INTEGER( long, va_arg( args, long ) );           break;
+            case ARG_LLONG:     APPEND_INTEGER( long long, va_arg( args, long long ) ); break;
+            case ARG_SIZE:      APPEND_INTEGER( ssize_t, va_arg( args, ssize_t ) );     break;
+            case ARG_INTMAX:    APPEND_INTEGER( intmax_t, va_arg( args, intmax_t ) );   break;
+            case ARG_PTRDIFF:   APPEND_INTEGER( ptrdiff_t, va_arg( args, ptrdiff_t ) ); break;
+            case ARG_DOUBLE:    SNPRINTF( va_arg( args, double ) );                     break;
+            case ARG_LDOUBLE:   SNPRINTF( va_arg( args, long double ) );                break;
+            case ARG_PTR:       APPEND_POINTER( va_arg( args, void * ) );               break;
+            case ARG_STR:       APPEND_STRING( va_arg( args, const char * ) );          break;
+        }
+    }
+
+    __append( str, size, len, fmt + literal, format->len - literal );
+
+    if( size > 0 )
+    {
+        str[ length < size ? length : size - 1 ] = '\0';
+    }
+
+    return length;
+}
+
+/**
+** Format the message with the parsed format if all its conversions are plain.
+** Otherwise a single call of vsnprintf() is cheaper than one snprintf() per conversion.
+** Formats which aren't literals are not parsed, parsing them each time would cost more.
+*/
+int __tinylog_vsnprintf( char *str, const size_t size, const char *fmt, const bool literal, va_list args )
+{
+    const log_format_t *format = literal ? __tinylog_format( fmt ) : NULL;
+
+    if( format != NULL && format->deferrable && format->plain )
+    {
+        return __tinylog_vformat( format, str, size, args );
+    }
+
+    return vsnprintf( str, size, fmt, args );
+}
@@ -0,0 +1,731 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Declarations shared between the tinylog translation units.
+** Not part of the public interface.
+*/
+
+#ifndef _TINYLOG_INTERNAL_H
+#define _TINYLOG_INTERNAL_H
+
+
+#include <stdint.h>     /* uint64_t */
+
+#include "tinylog.h"
+
+
+//#################################################################################
+//  Configuration
+//#################################################################################
+
+/**
+** Layout of the configuration word __log_control.config:
+**
+**   bits  0..31  gate, the highest severity which has to be handled by __tinylog()
+**                (the threshold, at least LOG_ERR if 'exit_on_error' is set,
+**                at least the level of the flight recorder if it is on)
+**   bits 32..51  log threshold, LOG_WARNING .... LOG_DEBUG, LOG_TRACE, LOG_INIT
+**   bits 52..55  level of the flight recorder + 1, 0 if it is off
+**   bits 56..59  where the log should go to
+**   bit  60      whether the log should quit the program on errors
+**   bit  61      should __FUNCTION__ & __LINE__ appear on stderr
+**   bit  62      should the id and name of the thread appear on stderr
+*/
+#define CONFIG_GATE_MASK        TINYLOG_GATE_MASK
+#define CONFIG_THRESHOLD_SHIFT  32
+#define CONFIG_THRESHOLD_MAX    0xFFFFF
+#define CONFIG_THRESHOLD_MASK   ( (uint64_t) CONFIG_THRESHOLD_MAX << CONFIG_THRESHOLD_SHIFT )
+#define CONFIG_RECORDER_SHIFT   52
+#define CONFIG_RECORDER_MASK    ( 15ull << CONFIG_RECORDER_SHIFT )
+#define CONFIG_DEST_SHIFT       56
+#define CONFIG_DEST_MASK        ( 15ull << CONFIG_DEST_SHIFT )
+#define CONFIG_EXIT_ON_ERROR    ( 1ull << 60 )
+#define CONFIG_DEV_LOGGING      ( 1ull << 61 )
+#define CONFIG_THREAD_INFO      ( 1ull << 62 )
+
+#define CONFIG_THRESHOLD( config )  ( (int) ( ( (config) & CONFIG_THRESHOLD_MASK ) >> CONFIG_THRESHOLD_SHIFT ) )
+#define CONFIG_DEST( config )       ( (log_dest_t) ( ( (config) & CONFIG_DEST_MASK ) >> CONFIG_DEST_SHIFT ) )
+#define CONFIG_GATE( config )       ( (int) ( (config) & CONFIG_GATE_MASK ) )
+#define CONFIG_RECORDER( config )   ( (int) ( ( (config) & CONFIG_RECORDER_MASK ) >> CONFIG_RECORDER_SHIFT ) - 1 )
+
+/**
+** Gate for the given threshold and configuration:
+** errors have to be handled to quit the program, even if they are not logged,
+** and the flight recorder sees everything up to its level.
+*/
+static inline int __tinylog_gate( int gate, const uint64_t config )
+{
+    if( ( config & CONFIG_EXIT_ON_ERROR ) && gate < LOG_ERR )
+    {
+        gate = LOG_ERR;
+    }
+    if( gate < CONFIG_RECORDER( config ) )
+    {
+        gate = CONFIG_RECORDER( config );
+    }
+
+    return gate;
+}
+
+/**
+** Retrieve the log threshold of the category for the given configuration.
+*/
+int  __tinylog_category_threshold( const log_category_t category, const uint64_t config );
+
+/**
+** Recompute the gates of all categories after the configuration or
+** the threshold of a category changed. Lock-free.
+*/
+void __tinylog_update_categories( void );
+
+
+//#################################################################################
+//  Buffers
+//#################################################################################
+
+/**
+** Size of the buffer on the stack for short messages,
+** longer ones are formatted into the arena of the thread
+*/
+#define TINYLOG_MSG_SIZE    128
+
+/**
+** Size of the buffer on the stack for lines written to stderr,
+** longer ones are formatted into the arena of the thread
+*/
+#define TINYLOG_LINE_SIZE   512
+
+/**
+** Maximum length of the prefix of a stderr line (timestamp, function and line)
+*/
+#define TINYLOG_PREFIX_SIZE 256
+
+/**
+** Maximum length of the verbose name for errno
+*/
+#define TINYLOG_ERRNO_SIZE  128
+
+/**
+** Marks messages which didn't fit into the maximum length
+*/
+#define TRUNCATION_MARKER   "[...]"
+
+/**
+** Arenas of a thread, for messages, for lines and for rendered deferred messages
+*/
+#define ARENA_MSG           0
+#define ARENA_LINE          1
+#define ARENA_RENDER        2
+#define ARENA_COUNT         3
+
+/**
+** Retrieve a buffer of at least the given size owned by the calling thread.
+** Returns NULL if the memory can't be allocated.
+*/
+char *__tinylog_arena( const int arena, const size_t size );
+
+
+/**
+** Mark a message cut to the buffer of the given size as truncated.
+** Returns the new length of the message.
+*/
+size_t __tinylog_truncated( char *msg, const size_t size );
+
+/**
+** Flags stored with a log record, so that the configuration at the time
+** of the log call is used even if the record is written later on.
+*/
+#define RECORD_STDERR       STDERR      // write to stderr
+#define RECORD_SYSLOG       SYSLOG      // write to syslog
+#define RECORD_LOGFILE      LOGFILE     // write to the log file
+#define RECORD_BINARY       BINARY      // write to the binary log file
+#define RECORD_DEV_LOGGING  0x100       // include __FUNCTION__ & __LINE__ on stderr
+#define RECORD_DEFERRED     0x200       // msg holds captured arguments instead of text
+#define RECORD_THREAD_INFO  0x400       // include the id and name of the thread
+
+//#################################################################################
+//  Threads
+//#################################################################################
+
+/**
+** Maximum length of the name of a thread, including '\0'
+*/
+#define TINYLOG_THREAD_NAME_SIZE    16
+
+/**
+** Text of a timestamp formatted last by a thread, valid for the cached second and layout
+*/
+struct LogTimeCache {
+    time_t              sec;            // -1 if nothing is cached
+    log_time_layout_t   layout;
+    char                text[ 32 ];
+    size_t              len;
+    char                zone[ 8 ];      // '+HH:MM' for ISO 8601
+    size_t              zone_len;
+};
+typedef struct LogTimeCache log_time_cache_t;
+
+/**
+** State of a thread which logs, set up the first time it logs.
+** Afterwards log calls don't need a system call or an allocation.
+*/
+struct LogThread {
+    int                 tid;            // cached gettid(), 0 until set up
+    bool                writer;         // writer thread of the asynchronous logger
+    char                name[ TINYLOG_THREAD_NAME_SIZE ];
+    char               *arena[ ARENA_COUNT ];
+    size_t              arena_size[ ARENA_COUNT ];
+    log_time_cache_t    time;
+    struct LogRing     *ring;           // flight recorder of the thread, NULL until it records
+};
+typedef struct LogThread log_thread_t;
+
+extern __thread log_thread_t __log_thread;
+
+void __tinylog_thread_init( void );
+
+/**
+** Retrieve the state of the calling thread, set up on first use.
+*/
+static inline log_thread_t *__tinylog_thread( void )
+{
+    if( __builtin_expect( __log_thread.tid == 0, 0 ) )
+    {
+        __tinylog_thread_init();
+    }
+
+    return &__log_thread;
+}
+
+
+//#################################################################################
+//  Timestamps
+//#################################################################################
+
+/**
+** Maximum length of a formatted timestamp
+*/
+#define TINYLOG_TIME_SIZE   40
+
+/**
+** Retrieve the raw time for a new log record and the clock it was taken from.
+*/
+uint64_t __tinylog_now( unsigned *clock );
+
+/**
+** Convert a raw time taken by __tinylog_now() into wall clock time.
+*/
+void __tinylog_wall_time( const uint64_t stamp, const unsigned clock, struct timespec *time );
+
+/**
+** Format the time with the selected layout and precision (no '\0' appended).
+** Returns the length, at most TINYLOG_TIME_SIZE.
+*/
+size_t __tinylog_format_time( char *str, const struct timespec *time );
+
+
+//#################################################################################
+//  Parsed format strings
+//#################################################################################
+
+/**
+** Maximum count of conversions of a format string which can be deferred
+*/
+#define FORMAT_MAX_SPECS    16
+
+/**
+** Types of arguments as passed through '...'
+*/
+enum LogArgType {
+    ARG_NONE,                           // '%%'
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_PTR,
+    ARG_STR
+};
+
+/**
+** Precision of a conversion specification without one, or with one taken from the arguments ('.*')
+*/
+#define PRECISION_NONE      (-1)
+#define PRECISION_ARG       (-2)
+
+/**
+** A single conversion specification such as '%-5s'
+*/
+struct LogFormatSpec {
+    unsigned short  start;              // offset of the '%' in the format string
+    unsigned char   len;                // length of the specification
+    unsigned char   type;               // LogArgType of the converted argument
+    unsigned char   stars;              // count of '*' arguments preceding it
+    unsigned char   conversion;         // 'd', 'u', 'o', 'x', 'X', 'c', 's' or 'p' without flags, width
+                                        // and precision (formatted without snprintf()), 0 otherwise
+    int             precision;          // PRECISION_NONE, PRECISION_ARG (the last '*' argument) or its value
+};
+typedef struct LogFormatSpec log_format_spec_t;
+
+/**
+** A parsed format string
+*/
+struct LogFormat {
+    const char         *fmt;
+    unsigned            len;            // length of fmt
+    unsigned            spec_count;
+    bool                deferrable;     // whether all arguments can be captured
+    bool                plain;          // whether all conversions are plain (see log_format_spec_t)
+    log_format_spec_t   specs[ FORMAT_MAX_SPECS ];
+};
+typedef struct LogFormat log_format_t;
+
+
+/**
+** Retrieve the parsed form of the given format string (cached by its address).
+** Only for literals, see TINYLOG_LITERAL().
+** Returns NULL if the cache is full.
+*/
+const log_format_t *__tinylog_format( const char *fmt );
+
+/**
+** Parse the format string without caching it.
+*/
+void __tinylog_parse_format( const char *fmt, log_format_t *format );
+
+/**
+** Capture the raw values of the arguments described by the format.
+** Strings are copied up to the precision of their conversion, always terminated by '\0'.
+** Returns the count of bytes used or -1 if they don't fit into the buffer.
+*/
+int __tinylog_capture( const log_format_t *format, char *buf, const size_t size, va_list args );
+
+/**
+** Turn captured arguments into text, vsnprintf() style.
+*/
+int __tinylog_render( const log_format_t *format, const char *args, char *str, const size_t size );
+
+/**
+** Format the arguments as vsnprintf() does, byte for byte, using the parsed format.
+*/
+int __tinylog_vformat( const log_format_t *format, char *str, const size_t size, va_list args );
+
+/**
+** Format the message, with the parsed format if it is a literal and all its conversions are plain,
+** with vsnprintf() otherwise.
+*/
+int __tinylog_vsnprintf( char *str, const size_t size, const char *fmt, const bool literal, va_list args );
+
+
+//#################################################################################
+//  Control block
+//#################################################################################
+
+/**
+** Marks control blocks which are shared ("TLCB")
+*/
+#define TINYLOG_CONTROL_MAGIC       0x54434C42
+
+/**
+** Where shared control blocks are found, as tinylog.<ident>.<pid>
+*/
+#define TINYLOG_CONTROL_DIR         "/dev/shm"
+
+/**
+** Size of the path of a control block (the directory and a file name)
+*/
+#define TINYLOG_CONTROL_PATH_SIZE   ( sizeof( TINYLOG_CONTROL_DIR ) + 256 )
+
+/**
+** Map the control block of the file over the own one, e.g. to change the configuration
+** of another process with the usual setters. Returns false (and sets errno) if the file
+** can't be opened or doesn't hold a control block.
+*/
+bool __tinylog_control_attach( const char *path );
+
+
+//#################################################################################
+//  Sampling
+//#################################################################################
+
+/**
+** Rate a log call of the category and severity was sampled with, 0 if it wasn't.
+*/
+unsigned __tinylog_sample_rate( const log_category_t category, const int severity );
+
+
+//#################################################################################
+//  Log storms
+//#################################################################################
+
+/**
+** Messages of a call site which were not logged
+*/
+struct LogSuppressed {
+    unsigned long   repeated;       // identical to the last message logged
+    unsigned long   limited;        // dropped by the rate limit
+    const char     *func;           // the call site
+    int             line;
+    log_category_t  category;
+    int             severity;       // of the last message of the call site
+};
+typedef struct LogSuppressed log_suppressed_t;
+
+/**
+** Whether messages identical to the last one of a call site are suppressed,
+** only then the hash of a message is needed.
+*/
+bool __tinylog_dedupe( void );
+
+/**
+** Hash of a message: its severity, errno, format string and arguments, 0 if they can't be captured.
+*/
+uint64_t __tinylog_hash_args( const int severity, const int err_no, const char *fmt, const bool literal, va_list args );
+
+/**
+** Hash of a structured message: its severity, errno, message and fields.
+*/
+uint64_t __tinylog_hash_fields( const int severity, const int err_no, const char *msg,
+        const log_field_t *fields, const unsigned count );
+
+/**
+** Decide whether a message of the call site should be logged (rate limit, repeated messages).
+** Call sites are identified by 'key' (the format string if it is a literal, the function otherwise) and line.
+** If so, the messages suppressed since the last one logged are handed over for reporting.
+*/
+bool __tinylog_limit( const char *key, const char *func, const int line, const log_category_t category,
+        const int severity, const uint64_t hash, log_suppressed_t *suppressed );
+
+/**
+** Hand over the messages suppressed at the next call site from 'pos' on which weren't reported yet.
+** Returns false if there are none left.
+*/
+bool __tinylog_limit_pending( unsigned *pos, log_suppressed_t *suppressed );
+
+/**
+** Report the messages suppressed at all call sites which weren't reported yet.
+*/
+void __tinylog_report_suppressed( void );
+
+
+//#################################################################################
+//  Log records
+//#################################################################################
+
+/**
+** A single log message with everything needed to write it
+*/
+struct LogRecord {
+    uint64_t            stamp;          // when the message was logged, raw time of 'clock'
+    unsigned            clock;          // log_clock_t the stamp was taken from
+    const char         *func;           // __FUNCTION__ of the log call
+    log_category_t      category;       // category of the log call, 0 for none
+    int                 line;           // __LINE__ of the log call
+    int                 severity;
+    int                 err_no;         // errno to be appended to the message
+    unsigned            sample_rate;    // logged 1 in N calls, 0 if not sampled
+    unsigned            flags;          // RECORD_* flags
+    const log_format_t *format;         // format of the captured arguments (RECORD_DEFERRED)
+    int                 tid;            // thread which logged the message (RECORD_THREAD_INFO)
+    char                thread_name[ TINYLOG_THREAD_NAME_SIZE ];
+    size_t              len;            // length of msg
+    size_t              size;           // size of the buffer msg points to
+    char               *msg;            // message text or captured arguments
+    unsigned            field_count;    // count of fields packed behind msg and its '\0'
+};
+typedef struct LogRecord log_record_t;
+
+
+/**
+** Write the record to the binary log file and all sinks taking it.
+*/
+void __tinylog_emit( const log_record_t *rec );
+
+
+//#################################################################################
+//  Structured records
+//#################################################################################
+
+/**
+** Size of the packed form of the fields
+*/
+size_t __tinylog_fields_size( const log_field_t *fields, const unsigned count );
+
+/**
+** Pack as many fields as fit into the buffer.
+** Returns the count of bytes used, the count of fields packed is stored in 'packed'.
+*/
+size_t __tinylog_pack_fields( char *buf, const size_t size, const log_field_t *fields, const unsigned count, unsigned *packed );
+
+/**
+** Append the fields of the record, ' key=value' for the human and logfmt encodings,
+** ',"key":value' for JSON. Returns the new length.
+*/
+size_t __tinylog_encode_fields( const log_encoding_t encoding, char *str, const size_t size, size_t len, const log_record_t *rec );
+
+/**
+** Encode the whole record as logfmt or JSON (without '\n').
+** Returns the length.
+*/
+size_t __tinylog_encode_record( const log_encoding_t encoding, char *str, const size_t size,
+        const log_record_t *rec, const char *msg, const size_t msg_len );
+
+
+//#################################################################################
+//  Sinks
+//#################################################################################
+
+/**
+** Select the sinks taking the record (one bit per sink id),
+** the built-in ones it is flagged for and the ones opened by the application.
+*/
+unsigned __tinylog_sinks_select( const log_record_t *rec );
+
+/**
+** Select those of the sinks which use the given encoding.
+*/
+unsigned __tinylog_sinks_encoded( const unsigned sinks, const log_encoding_t encoding );
+
+/**
+** Hand the line to the sinks.
+*/
+void __tinylog_sinks_write( const unsigned sinks, const log_sink_line_t *line );
+
+/**
+** Let the sinks opened by the application write what they collected.
+*/
+void __tinylog_sinks_flush( void );
+
+
+//#################################################################################
+//  stderr
+//#################################################################################
+
+/**
+** Write a line to stderr, collecting it in the buffer if buffering is turned on.
+*/
+void __tinylog_stderr_write( const int severity, const char *line, const size_t len );
+
+/**
+** Write the lines collected so far.
+*/
+void __tinylog_buffer_flush( void );
+
+
+//#################################################################################
+//  Syslog
+//#################################################################################
+
+/**
+** Called by open_tinylog() with the arguments of openlog().
+*/
+void __tinylog_syslog_open( const char *ident, const int facility );
+
+/**
+** Send the message of the record to syslog.
+*/
+void __tinylog_syslog_write( const log_record_t *rec, const char *msg, const size_t len );
+
+/**
+** Send the messages collected by the writer thread of the asynchronous logger.
+*/
+void __tinylog_syslog_flush( void );
+
+
+//#################################################################################
+//  Log file
+//#################################################################################
+
+/**
+** Append the line to the current segment of the log file.
+*/
+void __tinylog_file_write( const char *line, const size_t len );
+
+
+//#################################################################################
+//  Errno
+//#################################################################################
+
+/**
+** Build the table of errno messages ahead of the first error.
+*/
+void __tinylog_errno_init( void );
+
+/**
+** Text appended to messages for errno, '; Errno(104): Connection reset by peer'.
+** Values outside of the table are formatted into the buffer.
+*/
+const char *__tinylog_errno_text( const int err_no, char *buf, const size_t size, size_t *len );
+
+/**
+** Message of the errno value, NULL if the table isn't built (yet).
+** Async-signal-safe.
+*/
+const char *__tinylog_errno_cached( const int err_no );
+
+
+//#################################################################################
+//  Flight recorder
+//#################################################################################
+
+/**
+** Keep the message in the ring of the calling thread.
+** For structured messages (no arguments) the message is kept as text.
+*/
+void __tinylog_record( const log_category_t category, const int severity, const int err_no,
+        const char *func, const int line, const bool literal, const char *fmt_str, va_list *arg_pt );
+
+/**
+** Hand the ring of an exiting thread over to the next thread which records.
+*/
+void __tinylog_recorder_release( struct LogRing *ring );
+
+/**
+** Update the name shown for the ring after the thread was renamed.
+*/
+void __tinylog_recorder_rename( struct LogRing *ring, const char *name );
+
+
+//#################################################################################
+//  Binary log file
+//#################################################################################
+
+/**
+** Layout of the binary log file, read by tools/tinylog-decode.c:
+** a header followed by entries starting with their type.
+** Format strings, call sites and categories are written once per file,
+** before the first record referring to them.
+** Arguments are written in the native layout, as captured for deferred formatting.
+*/
+#define BINARY_MAGIC        "TINYLOGB"
+#define BINARY_VERSION      1
+
+struct BinaryHeader {
+    char        magic[ 8 ];
+    uint32_t    version;
+    uint8_t     long_size;          // sizeof( long )
+    uint8_t     pointer_size;       // sizeof( void * )
+    uint8_t     ldouble_size;       // sizeof( long double )
+    uint8_t     little_endian;
+    uint8_t     time_layout;        // log_time_layout_t of the writer
+    uint8_t     time_precision;     // log_time_precision_t of the writer
+    uint16_t    reserved;
+    uint64_t    time;               // when the file was opened, ns since the epoch
+} __attribute__ (( packed ));
+typedef struct BinaryHeader binary_header_t;
+
+/**
+** Types of entries
+*/
+#define BINARY_FORMAT       1       // binary_string_t, format string
+#define BINARY_SITE         2       // binary_string_t, function and line of a call site
+#define BINARY_CATEGORY     3       // binary_string_t, name of a category
+#define BINARY_TIME         4       // binary_time_t
+#define BINARY_RECORD       5       // binary_record_t, followed by the arguments
+#define BINARY_THREAD       6       // binary_string_t, name of a thread (id is the thread id)
+
+/**
+** An entry of the dictionary, followed by 'len' chars (no '\0')
+*/
+struct BinaryString {
+    uint8_t     type;
+    uint32_t    id;
+    int32_t     line;               // BINARY_SITE only
+    uint16_t    len;
+} __attribute__ (( packed ));
+typedef struct BinaryString binary_string_t;
+
+/**
+** Time of the next record, if it can't be given relative to the previous one
+*/
+struct BinaryTime {
+    uint8_t     type;
+    uint64_t    time;               // ns since the epoch
+} __attribute__ (( packed ));
+typedef struct BinaryTime binary_time_t;
+
+/**
+** A log message, followed by the thread id (int32_t, BINARY_THREAD_INFO only)
+** and 'args_len' bytes of arguments for the format string
+*/
+struct BinaryRecord {
+    uint8_t     type;
+    uint8_t     severity;
+    uint8_t     category;
+    uint8_t     flags;              // BINARY_DEV_LOGGING
+    uint32_t    delta;              // ns passed since the previous record
+    uint32_t    format;             // id of the format string
+    uint32_t    site;               // id of the call site
+    uint16_t    err_no;
+    uint16_t    args_len;
+} __attribute__ (( packed ));
+typedef struct BinaryRecord binary_record_t;
+
+#define BINARY_DEV_LOGGING  0x01
+#define BINARY_THREAD_INFO  0x02
+
+/**
+** Append the record to the binary log file.
+** Captured arguments of deferred records are written as they are, the text of other records
+** as the argument of the format string "%s".
+*/
+void __tinylog_binary_write( const log_record_t *rec );
+
+/**
+** Write the records collected so far.
+*/
+void __tinylog_binary_flush( void );
+
+/**
+** Format the record as line for humans, as written to stderr (no '\n' is appended).
+** Returns the length of the line.
+*/
+size_t __tinylog_format_line( const log_record_t *rec, char *line, const size_t size );
+
+
+//#################################################################################
+//  Asynchronous logger
+//#################################################################################
+
+/**
+** Results of __tinylog_async_begin()
+*/
+#define ASYNC_OFF       0               // asynchronous logger not running, write synchronously
+#define ASYNC_QUEUED    1               // record reserved, has to be committed
+#define ASYNC_DROPPED   2               // queue full, message has to be discarded
+
+/**
+** Reserve a record in the queue of the asynchronous logger.
+** Only if ASYNC_QUEUED is returned, *rec points to the reserved record
+** which has to be filled and handed over with __tinylog_async_commit().
+*/
+int  __tinylog_async_begin( log_record_t **rec );
+void __tinylog_async_commit( log_record_t *rec );
+
+/**
+** Whether the calling thread is the writer thread of the asynchronous logger
+*/
+bool __tinylog_is_writer( void );
+
+
+#endif // _TINYLOG_INTERNAL_H
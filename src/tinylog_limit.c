@@ -0,0 +1,432 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Protection against log storms, per call site.
+**
+** Call sites are identified by their format string (their function if the format
+** isn't a literal) and line. Their state lives in a table which is never evicted
+** and updated with atomics only: the rate limit is a token bucket in the form of
+** the generic cell rate algorithm (a single 'theoretical arrival time' per site),
+** repeated messages are detected by a hash of the severity, errno, format string
+** and raw arguments of the last message.
+** Messages suppressed since the last message of a site are reported before its next
+** message, or by tinylog_flush() (also when the program exits).
+*/
+
+#include "tinylog_internal.h"
+
+#define NANOS_PER_SEC   1000000000ULL
+
+/**
+** Count of call sites which can be tracked, has to be a power of two
+*/
+#define SITE_TABLE_SIZE 1024
+
+/**
+** Size of the buffer for the arguments hashed to detect repeated messages
+*/
+#define SITE_ARGS_SIZE  256
+
+/**
+** States of a table entry
+*/
+#define ENTRY_FREE      0
+#define ENTRY_WRITING   1
+#define ENTRY_READY     2
+
+/**
+** State of a call site
+*/
+struct LogSite {
+    unsigned        state;
+    const char     *key;            // key: format string (or function) and line of the call site
+    int             line;
+    const char     *func;
+    log_category_t  category;
+    int             severity;       // of the last message
+    uint64_t        tat;            // theoretical arrival time of the next message (ns)
+    uint64_t        last_hash;      // hash of the last message logged, 0 if unknown
+    unsigned long   repeated;       // repetitions of the last message not logged
+    unsigned long   limited;        // messages dropped by the rate limit
+};
+typedef struct LogSite log_site_t;
+
+static log_site_t       __sites[ SITE_TABLE_SIZE ];
+
+/**
+** Rate limit, messages per second (0 = off) in the upper and burst in the lower half
+*/
+static uint64_t         __rate_limit = 0;
+
+/**
+** Whether repeated messages should be collapsed
+*/
+static bool             __dedupe = false;
+
+/**
+** Count of all messages suppressed so far
+*/
+static unsigned long    __suppressed = 0;
+
+
+// internal prototypes
+
+static void __limit_atexit( void );
+
+
+// functions
+
+/**
+** Maximum rate of messages per call site, further messages are dropped.
+** 'burst' messages may be logged at once before the limit applies.
+*/
+void set_log_rate_limit( const unsigned per_second, const unsigned burst )
+{
+    const uint64_t rate_limit = (uint64_t) per_second << 32 | ( burst > 0 ? burst : 1 );
+
+    if( per_second > 0 )
+    {
+        __limit_atexit();
+    }
+
+    if( rate_limit != __atomic_exchange_n( &__rate_limit, rate_limit, __ATOMIC_RELAXED ) )
+    {
+        log_TRACE(0, "Set 'rate_limit' to: %u/s, burst %u", per_second, burst );
+    }
+}
+
+unsigned get_log_rate_limit( void )
+{
+    return __atomic_load_n( &__rate_limit, __ATOMIC_RELAXED ) >> 32;
+}
+
+unsigned get_log_rate_burst( void )
+{
+    return (unsigned) __atomic_load_n( &__rate_limit, __ATOMIC_RELAXED );
+}
+
+/**
+** Whether a message identical to the last one of the same call site should be suppressed
+*/
+void set_log_dedupe( const bool dedupe )
+{
+    if( dedupe )
+    {
+        __limit_atexit();
+    }
+
+    if( dedupe != __atomic_exchange_n( &__dedupe, dedupe, __ATOMIC_RELAXED ) )
+    {
+        log_TRACE(0, "Set 'dedupe' to: %s", dedupe ? "true" : "false" );
+    }
+}
+
+bool get_log_dedupe( void )
+{
+    return __atomic_load_n( &__dedupe, __ATOMIC_RELAXED );
+}
+
+unsigned long get_log_suppressed( void )
+{
+    return __atomic_load_n( &__suppressed, __ATOMIC_RELAXED );
+}
+
+/**
+** Report the messages suppressed and not reported yet when the program exits,
+** registered once protection against log storms is turned on.
+*/
+static void __limit_atexit( void )
+{
+    static bool registered = false;
+
+    if( !__atomic_exchange_n( &registered, true, __ATOMIC_RELAXED ) )
+    {
+        atexit( tinylog_flush );
+    }
+}
+
+/**
+** Find the state of the call site, creating it if needed.
+** Returns NULL if the table is full.
+*/
+static log_site_t *__find_site( const char *key, const char *func, const int line, const log_category_t category )
+{
+    const unsigned long hash = ( ( (unsigned long) key >> 3 ) ^ (unsigned long) line ) * 0x9E3779B97F4A7C15UL;
+
+    for( unsigned i = 0; i < SITE_TABLE_SIZE; i++ )
+    {
+        log_site_t *site = &__sites[ ( hash + i ) & ( SITE_TABLE_SIZE - 1 ) ];
+
+        unsigned state = __atomic_load_n( &site->state, __ATOMIC_ACQUIRE );
+        if( state == ENTRY_READY )
+        {
+            if( site->key == key && site->line == line )
+            {
+                return site;
+            }
+            continue;
+        }
+
+        if( state == ENTRY_WRITING )
+        {
+            // being set up by another thread, possibly for the same call site
+            continue;
+        }
+
+        if( __atomic_compare_exchange_n( &site->state, &state, ENTRY_WRITING, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+        {
+            site->key      = key;
+            site->line     = line;
+            site->func     = func;
+            site->category = category;
+            __atomic_store_n( &site->state, ENTRY_READY, __ATOMIC_RELEASE );
+
+            return site;
+        }
+    }
+
+    // table is full
+    return NULL;
+}
+
+/**
+** Whether repeated messages are suppressed
+*/
+bool __tinylog_dedupe( void )
+{
+    return __atomic_load_n( &__dedupe, __ATOMIC_RELAXED );
+}
+
+/**
+** Continue a FNV-1a hash over the given bytes
+*/
+static inline uint64_t __hash_bytes( uint64_t hash, const void *bytes, const size_t len )
+{
+    const unsigned char *pos = bytes;
+    for( size_t i = 0; i < len; i++ )
+    {
+        hash = ( hash ^ pos[ i ] ) * 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+/**
+** Start the hash of a message with its severity, errno and text (or format string).
+*/
+static inline uint64_t __hash_message( const int severity, const int err_no, const char *text )
+{
+    uint64_t hash = __hash_bytes( 0xCBF29CE484222325ULL, &severity, sizeof( severity ) );
+    hash = __hash_bytes( hash, &err_no, sizeof( err_no ) );
+
+    return __hash_bytes( hash, text, strlen( text ) + 1 );
+}
+
+/**
+** Hash the severity, errno, format string and raw arguments of a message (FNV-1a).
+** Formats which aren't literals are parsed each time, they can't be cached.
+** Returns 0 if the arguments can't be captured.
+*/
+uint64_t __tinylog_hash_args( const int severity, const int err_no, const char *fmt, const bool literal, va_list args )
+{
+    log_format_t parsed;
+    const log_format_t *format = literal ? __tinylog_format( fmt ) : NULL;
+    if( format == NULL )
+    {
+        __tinylog_parse_format( fmt, &parsed );
+        format = &parsed;
+    }
+
+    if( !format->deferrable )
+    {
+        return 0;
+    }
+
+    char buf[ SITE_ARGS_SIZE ];
+    const int len = __tinylog_capture( format, buf, sizeof( buf ), args );
+    if( len < 0 )
+    {
+        return 0;
+    }
+
+    const uint64_t hash = __hash_bytes( __hash_message( severity, err_no, fmt ), buf, len );
+
+    // 0 is reserved for unknown
+    return hash != 0 ? hash : 1;
+}
+
+/**
+** Hash the severity, errno, message and fields of a structured message (FNV-1a).
+** Strings are hashed by their text, everything else by its raw value.
+*/
+uint64_t __tinylog_hash_fields( const int severity, const int err_no, const char *msg,
+        const log_field_t *fields, const unsigned count )
+{
+    uint64_t hash = __hash_message( severity, err_no, msg );
+
+    for( unsigned i = 0; i < count; i++ )
+    {
+        const log_field_t *field = &fields[ i ];
+
+        hash = __hash_bytes( hash, &field->type, 1 );
+        if( field->type != TL_FIELD_STR )
+        {
+            hash = __hash_bytes( hash, &field->value, sizeof( field->value ) );
+        }
+        else if( field->value.s != NULL )
+        {
+            hash = __hash_bytes( hash, field->value.s, strlen( field->value.s ) + 1 );
+        }
+    }
+
+    return hash != 0 ? hash : 1;
+}
+
+/**
+** Take a token from the bucket of the call site.
+** Returns false if the rate limit is exceeded.
+*/
+static bool __take_token( log_site_t *site, const uint64_t rate_limit )
+{
+    const uint64_t per_second = rate_limit >> 32;
+    const uint64_t burst      = rate_limit & 0xFFFFFFFF;
+
+    const uint64_t interval   = NANOS_PER_SEC / per_second;
+    const uint64_t tolerance  = interval * ( burst - 1 );
+
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    const uint64_t now = ts.tv_sec * NANOS_PER_SEC + ts.tv_nsec;
+
+    uint64_t tat = __atomic_load_n( &site->tat, __ATOMIC_RELAXED );
+    uint64_t next;
+    do
+    {
+        const uint64_t start = tat > now ? tat : now;
+        if( start - now > tolerance )
+        {
+            return false;
+        }
+        next = start + interval;
+    }
+    while( !__atomic_compare_exchange_n( &site->tat, &tat, next, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+
+    return true;
+}
+
+/**
+** Decide whether a message of the call site should be logged.
+** The hash of the message is only looked at for deduplication, 0 if unknown.
+** If so, the messages suppressed since the last one logged are handed over for reporting.
+*/
+bool __tinylog_limit(
+    const char *key,
+    const char *func,
+    const int line,
+    const log_category_t category,
+    const int severity,
+    const uint64_t hash,
+    log_suppressed_t *suppressed
+)
+{
+    suppressed->repeated = 0;
+    suppressed->limited  = 0;
+    suppressed->func     = func;
+    suppressed->line     = line;
+    suppressed->category = category;
+    suppressed->severity = severity;
+
+    const uint64_t rate_limit = __atomic_load_n( &__rate_limit, __ATOMIC_RELAXED );
+    const bool     dedupe     = __atomic_load_n( &__dedupe, __ATOMIC_RELAXED );
+
+    if( rate_limit >> 32 == 0 && !dedupe )
+    {
+        return true;
+    }
+
+    log_site_t *site = __find_site( key, func, line, category );
+    if( site == NULL )
+    {
+        return true;
+    }
+
+    // suppressed messages are reported with the severity of the last one
+    __atomic_store_n( &site->severity, severity, __ATOMIC_RELAXED );
+
+    if( dedupe )
+    {
+        if( hash != 0 && hash == __atomic_load_n( &site->last_hash, __ATOMIC_RELAXED ) )
+        {
+            __atomic_add_fetch( &site->repeated, 1, __ATOMIC_RELAXED );
+            __atomic_add_fetch( &__suppressed, 1, __ATOMIC_RELAXED );
+
+            return false;
+        }
+    }
+
+    if( rate_limit >> 32 != 0 && !__take_token( site, rate_limit ) )
+    {
+        __atomic_add_fetch( &site->limited, 1, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &__suppressed, 1, __ATOMIC_RELAXED );
+
+        return false;
+    }
+
+    __atomic_store_n( &site->last_hash, hash, __ATOMIC_RELAXED );
+
+    suppressed->repeated = __atomic_exchange_n( &site->repeated, 0, __ATOMIC_RELAXED );
+    suppressed->limited  = __atomic_exchange_n( &site->limited, 0, __ATOMIC_RELAXED );
+
+    return true;
+}
+
+/**
+** Hand over the messages suppressed at the next call site from 'pos' on which weren't reported yet.
+** Returns false if there are none left.
+*/
+bool __tinylog_limit_pending( unsigned *pos, log_suppressed_t *suppressed )
+{
+    for( ; *pos < SITE_TABLE_SIZE; (*pos)++ )
+    {
+        log_site_t *site = &__sites[ *pos ];
+
+        if( __atomic_load_n( &site->state, __ATOMIC_ACQUIRE ) != ENTRY_READY )
+        {
+            continue;
+        }
+
+        suppressed->repeated = __atomic_exchange_n( &site->repeated, 0, __ATOMIC_RELAXED );
+        suppressed->limited  = __atomic_exchange_n( &site->limited, 0, __ATOMIC_RELAXED );
+
+        if( suppressed->repeated > 0 || suppressed->limited > 0 )
+        {
+            suppressed->func     = site->func;
+            suppressed->line     = site->line;
+            suppressed->category = site->category;
+            suppressed->severity = __atomic_load_n( &site->severity, __ATOMIC_RELAXED );
+
+            (*pos)++;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,754 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Flight recorder.
+**
+** Each thread keeps its last messages in a ring, up to the level of the recorder
+** and regardless of the log threshold. Only the raw arguments are captured,
+** like for deferred formatting.
+** The rings are kept in a list which is only ever prepended to, so that they can be
+** dumped from a signal handler: dumping takes no locks, doesn't allocate and formats
+** with its own code, so that nothing but write() is called.
+** Rings of threads which exited are kept (and dumped) until another thread takes them over.
+*/
+
+#include <signal.h>
+#include <stddef.h>     /* ptrdiff_t */
+#include <unistd.h>
+
+#include "tinylog_internal.h"
+
+/**
+** Size of the captured arguments of a message, larger ones are kept as format string only
+*/
+#define RECORDER_ARGS_SIZE  96
+
+/**
+** Size of the buffer a line of the dump is formatted in
+*/
+#define RECORDER_LINE_SIZE  512
+
+/**
+** A message kept by the recorder
+*/
+struct LogRingEntry {
+    unsigned long       seq;            // position + 1 of the entry, 0 while it is written
+    uint64_t            stamp;          // raw time of 'clock'
+    unsigned            clock;
+    const char         *func;
+    const char         *fmt;
+    const log_format_t *format;         // NULL if 'args' holds text (or nothing)
+    int                 line;
+    int                 severity;
+    int                 err_no;
+    log_category_t      category;
+    unsigned short      len;            // length of args
+    char                args[ RECORDER_ARGS_SIZE ];
+};
+typedef struct LogRingEntry log_ring_entry_t;
+
+/**
+** Ring of a thread
+*/
+struct LogRing {
+    struct LogRing     *next;
+    int                 owner;          // id of the thread, 0 if the ring is free
+    int                 tid;            // id of the thread which recorded last
+    char                name[ TINYLOG_THREAD_NAME_SIZE ];
+    unsigned            size;           // count of entries
+    unsigned long       head;           // count of entries recorded so far
+    log_ring_entry_t    entries[];
+};
+typedef struct LogRing log_ring_t;
+
+/**
+** All rings, newest first
+*/
+static log_ring_t      *__rings = NULL;
+
+/**
+** Count of entries of rings set up from now on
+*/
+static unsigned         __recorder_size = 256;
+
+/**
+** Whether the rings are dumped on fatal signals
+*/
+static bool             __crash_dump = false;
+
+/**
+** Only the first thread which crashes dumps the rings
+*/
+static int              __dumping = 0;
+
+/**
+** Fatal signals the rings are dumped for
+*/
+static const int CRASH_SIGNALS[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+#define CRASH_SIGNAL_COUNT  ( sizeof( CRASH_SIGNALS ) / sizeof( CRASH_SIGNALS[ 0 ] ) )
+
+/**
+** Actions of the application for the signals above, restored when the dump is turned off
+*/
+static struct sigaction __previous[ CRASH_SIGNAL_COUNT ];
+
+
+// internal prototypes
+
+static void __crash_handler( int sig, siginfo_t *info, void *context );
+
+
+// functions
+
+/**
+** Retrieve the ring of the calling thread, set up on first use.
+** Returns NULL if no memory is left.
+*/
+static log_ring_t *__ring( log_thread_t *thread )
+{
+    if( __builtin_expect( thread->ring != NULL, 1 ) )
+    {
+        return thread->ring;
+    }
+
+    const unsigned size = __atomic_load_n( &__recorder_size, __ATOMIC_RELAXED );
+
+    // take over the ring of a thread which exited
+    log_ring_t *ring;
+    for( ring = __atomic_load_n( &__rings, __ATOMIC_ACQUIRE ); ring != NULL; ring = ring->next )
+    {
+        int unowned = 0;
+        if( ring->size == size
+            && __atomic_load_n( &ring->owner, __ATOMIC_RELAXED ) == 0
+            && __atomic_compare_exchange_n( &ring->owner, &unowned, thread->tid, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED )
+        )
+        {
+            break;
+        }
+    }
+
+    if( ring == NULL )
+    {
+        ring = calloc( 1, sizeof( log_ring_t ) + size * sizeof( log_ring_entry_t ) );
+        if( ring == NULL )
+        {
+            return NULL;
+        }
+        ring->owner = thread->tid;
+        ring->size  = size;
+
+        ring->next = __atomic_load_n( &__rings, __ATOMIC_RELAXED );
+        while( !__atomic_compare_exchange_n( &__rings, &ring->next, ring, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) )
+        {
+        }
+    }
+
+    ring->tid = thread->tid;
+    __tinylog_recorder_rename( ring, thread->name );
+
+    thread->ring = ring;
+
+    return ring;
+}
+
+/**
+** Keep the message in the ring of the calling thread.
+*/
+void __tinylog_record(
+    const log_category_t category,
+    const int severity,
+    const int err_no,
+    const char *func,
+    const int line,
+    const bool literal,
+    const char *fmt_str,
+    va_list *arg_pt
+)
+{
+    log_ring_t *ring = __ring( __tinylog_thread() );
+    if( ring == NULL )
+    {
+        return;
+    }
+
+    const unsigned long pos = ring->head;
+    log_ring_entry_t *entry = &ring->entries[ pos % ring->size ];
+
+    // a dump interrupting this thread skips the entry
+    __atomic_store_n( &entry->seq, 0, __ATOMIC_RELEASE );
+    __atomic_signal_fence( __ATOMIC_SEQ_CST );
+
+    entry->stamp    = __tinylog_now( &entry->clock );
+    entry->func     = func;
+    entry->fmt      = literal ? fmt_str : NULL;
+    entry->format   = NULL;
+    entry->line     = line;
+    entry->severity = severity;
+    entry->err_no   = err_no;
+    entry->category = category;
+    entry->len      = 0;
+
+    if( arg_pt == NULL || !literal )
+    {
+        // structured message, or a format which might be gone or changed when the ring is dumped:
+        // keep its text (without the arguments, formatting them would make the log call expensive)
+        const size_t len = strnlen( fmt_str, sizeof( entry->args ) );
+        entry->len = len;
+        memcpy( entry->args, fmt_str, len );
+    }
+    else
+    {
+        const log_format_t *format = __tinylog_format( fmt_str );
+        if( format != NULL && format->deferrable )
+        {
+            va_list args;
+            va_copy( args, *arg_pt );
+            const int len = __tinylog_capture( format, entry->args, sizeof( entry->args ), args );
+            va_end( args );
+
+            if( len >= 0 )
+            {
+                entry->format = format;
+                entry->len    = len;
+            }
+        }
+    }
+
+    __atomic_store_n( &entry->seq, pos + 1, __ATOMIC_RELEASE );
+    __atomic_store_n( &ring->head, pos + 1, __ATOMIC_RELEASE );
+}
+
+/**
+** Hand the ring of an exiting thread over to the next thread which records.
+*/
+void __tinylog_recorder_release( log_ring_t *ring )
+{
+    if( ring != NULL )
+    {
+        __atomic_store_n( &ring->owner, 0, __ATOMIC_RELEASE );
+    }
+}
+
+/**
+** Update the name shown for the ring after the thread was renamed.
+*/
+void __tinylog_recorder_rename( log_ring_t *ring, const char *name )
+{
+    if( ring != NULL )
+    {
+        for( size_t i = 0; i < sizeof( ring->name ); i++ )
+        {
+            __atomic_store_n( &ring->name[ i ], name[ i ], __ATOMIC_RELAXED );
+            if( name[ i ] == '\0' )
+            {
+                break;
+            }
+        }
+    }
+}
+
+//#################################################################################
+//  Configuration
+//#################################################################################
+
+/**
+** Count of messages kept per thread, for threads which record for the first time
+*/
+void set_log_recorder_size( const unsigned size )
+{
+    if( size == 0 )
+    {
+        log_WARNING(0, "Flight recorder needs room for at least one message. Ignoring.");
+        return;
+    }
+
+    __atomic_store_n( &__recorder_size, size, __ATOMIC_RELAXED );
+
+    log_TRACE(0, "Set 'recorder_size' to: %u", size );
+}
+
+unsigned get_log_recorder_size( void )
+{
+    return __atomic_load_n( &__recorder_size, __ATOMIC_RELAXED );
+}
+
+/**
+** Whether the flight recorder is dumped to stderr on fatal signals.
+** The actions of the application for these signals are kept, they take over after the dump
+** and are restored when the dump is turned off.
+*/
+void set_log_crash_dump( const bool crash_dump )
+{
+    if( crash_dump == __atomic_exchange_n( &__crash_dump, crash_dump, __ATOMIC_RELAXED ) )
+    {
+        return;
+    }
+
+    if( crash_dump )
+    {
+        struct sigaction action;
+        memset( &action, 0, sizeof( action ) );
+        sigemptyset( &action.sa_mask );
+
+        action.sa_sigaction = __crash_handler;
+        action.sa_flags     = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+
+        for( size_t i = 0; i < CRASH_SIGNAL_COUNT; i++ )
+        {
+            sigaction( CRASH_SIGNALS[ i ], &action, &__previous[ i ] );
+        }
+    }
+    else
+    {
+        for( size_t i = 0; i < CRASH_SIGNAL_COUNT; i++ )
+        {
+            sigaction( CRASH_SIGNALS[ i ], &__previous[ i ], NULL );
+        }
+    }
+
+    log_TRACE(0, "Set 'crash_dump' to: %s", crash_dump ? "true" : "false" );
+}
+
+bool get_log_crash_dump( void )
+{
+    return __atomic_load_n( &__crash_dump, __ATOMIC_RELAXED );
+}
+
+/**
+** Dump the rings and hand the signal over to the action of the application,
+** which stays in place for further signals.
+*/
+static void __crash_handler( int sig, siginfo_t *info, void *context )
+{
+    int expected = 0;
+    if( __atomic_compare_exchange_n( &__dumping, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
+    {
+        tinylog_dump_recorder( STDERR_FILENO );
+    }
+
+    const struct sigaction *previous = NULL;
+    for( size_t i = 0; i < CRASH_SIGNAL_COUNT; i++ )
+    {
+        if( CRASH_SIGNALS[ i ] == sig )
+        {
+            previous = &__previous[ i ];
+        }
+    }
+    if( previous == NULL )
+    {
+        return;
+    }
+
+    sigaction( sig, previous, NULL );
+
+    if( previous->sa_flags & SA_SIGINFO )
+    {
+        previous->sa_sigaction( sig, info, context );
+    }
+    else if( previous->sa_handler == SIG_DFL )
+    {
+        raise( sig );
+    }
+    else if( previous->sa_handler != SIG_IGN )
+    {
+        previous->sa_handler( sig );
+    }
+}
+
+//#################################################################################
+//  Async-signal-safe formatting
+//#################################################################################
+
+/**
+** Line of the dump, text beyond its size is dropped
+*/
+struct LogDumpLine {
+    char    text[ RECORDER_LINE_SIZE ];
+    size_t  len;
+};
+typedef struct LogDumpLine log_dump_line_t;
+
+static void __put_text( log_dump_line_t *line, const char *text, size_t len )
+{
+    if( len > sizeof( line->text ) - line->len )
+    {
+        len = sizeof( line->text ) - line->len;
+    }
+    memcpy( line->text + line->len, text, len );
+    line->len += len;
+}
+
+static void __put_str( log_dump_line_t *line, const char *text )
+{
+    __put_text( line, text, strlen( text ) );
+}
+
+static void __put_char( log_dump_line_t *line, const char c )
+{
+    __put_text( line, &c, 1 );
+}
+
+/**
+** Append an unsigned number with at least 'digits' digits.
+*/
+static void __put_unsigned( log_dump_line_t *line, unsigned long long value, const unsigned base, const bool upper, const int digits )
+{
+    const char *DIGITS = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    char reversed[ 64 ];
+    int len = 0;
+    do
+    {
+        reversed[ len++ ] = DIGITS[ value % base ];
+        value /= base;
+    }
+    while( value > 0 || len < digits );
+
+    while( len > 0 )
+    {
+        __put_char( line, reversed[ --len ] );
+    }
+}
+
+static void __put_signed( log_dump_line_t *line, const long long value )
+{
+    if( value < 0 )
+    {
+        __put_char( line, '-' );
+        __put_unsigned( line, -(unsigned long long) value, 10, false, 1 );
+    }
+    else
+    {
+        __put_unsigned( line, value, 10, false, 1 );
+    }
+}
+
+/**
+** Append a floating point number with 6 decimals (no exponent).
+*/
+static void __put_double( log_dump_line_t *line, double value )
+{
+    if( value != value )
+    {
+        __put_str( line, "nan" );
+        return;
+    }
+    if( value < 0 )
+    {
+        __put_char( line, '-' );
+        value = -value;
+    }
+    if( value >= 1e18 )
+    {
+        __put_str( line, value > 1e308 ? "inf" : "(large)" );
+        return;
+    }
+
+    unsigned long long integral = value;
+    unsigned long long fraction = ( value - integral ) * 1e6 + 0.5;
+    if( fraction >= 1000000 )
+    {
+        integral++;
+        fraction -= 1000000;
+    }
+
+    __put_unsigned( line, integral, 10, false, 1 );
+    __put_char( line, '.' );
+    __put_unsigned( line, fraction, 10, false, 6 );
+}
+
+/**
+** Append the time as '2016-07-03T12:37:52.628417309Z' (always UTC, localtime_r() is not safe).
+*/
+static void __put_time( log_dump_line_t *line, const uint64_t stamp, const unsigned clock )
+{
+    struct timespec time;
+    __tinylog_wall_time( stamp, clock, &time );
+
+    // civil date from days since the epoch (proleptic Gregorian calendar)
+    const long days = time.tv_sec / 86400;
+    const long secs = time.tv_sec % 86400;
+
+    const long z   = days + 719468;
+    const long era = z / 146097;
+    const long doe = z - era * 146097;
+    const long yoe = ( doe - doe / 1460 + doe / 36524 - doe / 146096 ) / 365;
+    const long doy = doe - ( 365 * yoe + yoe / 4 - yoe / 100 );
+    const long mp  = ( 5 * doy + 2 ) / 153;
+    const long day = doy - ( 153 * mp + 2 ) / 5 + 1;
+    const long month = mp < 10 ? mp + 3 : mp - 9;
+    const long year  = yoe + era * 400 + ( month <= 2 );
+
+    __put_unsigned( line, year, 10, false, 4 );
+    __put_char( line, '-' );
+    __put_unsigned( line, month, 10, false, 2 );
+    __put_char( line, '-' );
+    __put_unsigned( line, day, 10, false, 2 );
+    __put_char( line, 'T' );
+    __put_unsigned( line, secs / 3600, 10, false, 2 );
+    __put_char( line, ':' );
+    __put_unsigned( line, secs / 60 % 60, 10, false, 2 );
+    __put_char( line, ':' );
+    __put_unsigned( line, secs % 60, 10, false, 2 );
+    __put_char( line, '.' );
+    __put_unsigned( line, time.tv_nsec, 10, false, 9 );
+    __put_char( line, 'Z' );
+}
+
+/**
+** Read a captured value of the given type.
+*/
+#define TAKE( type, var ) do \
+{ \
+    type __taken; \
+    memcpy( &__taken, args + pos, sizeof( __taken ) ); \
+    pos += sizeof( __taken ); \
+    var = __taken; \
+} while (0)
+
+/**
+** Turn captured arguments into text.
+** Flags and width are ignored, precision only counts for strings, floating point numbers get 6 decimals.
+*/
+static void __put_message( log_dump_line_t *line, const log_format_t *format, const char *args )
+{
+    const char *fmt = format->fmt;
+    size_t pos = 0;         // in args
+    unsigned done = 0;      // in fmt
+
+    for( unsigned i = 0; i < format->spec_count; i++ )
+    {
+        const log_format_spec_t *spec = &format->specs[ i ];
+
+        __put_text( line, fmt + done, spec->start - done );
+        done = spec->start + spec->len;
+
+        // '*' arguments, the last one is the precision if taken from the arguments
+        int star_value = PRECISION_NONE;
+        for( unsigned star = 0; star < spec->stars; star++ )
+        {
+            TAKE( int, star_value );
+        }
+
+        const char conversion = fmt[ spec->start + spec->len - 1 ];
+        const bool is_unsigned = conversion == 'u' || conversion == 'x' || conversion == 'X' || conversion == 'o';
+        const unsigned base = conversion == 'x' || conversion == 'X' ? 16 : conversion == 'o' ? 8 : 10;
+
+        long long value = 0;
+        unsigned long long mask = ~0ULL;
+        switch( spec->type )
+        {
+            case ARG_NONE:
+                __put_char( line, '%' );
+                continue;
+            case ARG_INT:       TAKE( int, value );       mask = ~0U;   break;
+            case ARG_LONG:      TAKE( long, value );      mask = ~0UL;  break;
+            case ARG_LLONG:     TAKE( long long, value );               break;
+            case ARG_SIZE:      TAKE( size_t, value );                  break;
+            case ARG_INTMAX:    TAKE( intmax_t, value );                break;
+            case ARG_PTRDIFF:   TAKE( ptrdiff_t, value );               break;
+
+            case ARG_DOUBLE:
+            case ARG_LDOUBLE:
+            {
+                double number;
+                if( spec->type == ARG_DOUBLE )
+                {
+                    TAKE( double, number );
+                }
+                else
+                {
+                    TAKE( long double, number );
+                }
+                __put_double( line, number );
+                continue;
+            }
+
+            case ARG_PTR:
+            {
+                void *ptr;
+                TAKE( void *, ptr );
+                __put_str( line, "0x" );
+                __put_unsigned( line, (uintptr_t) ptr, 16, false, 1 );
+                continue;
+            }
+
+            case ARG_STR:
+            {
+                const bool present = args[ pos++ ];
+                if( present )
+                {
+                    const int precision = spec->precision == PRECISION_ARG ? star_value : spec->precision;
+                    const size_t len = strlen( args + pos );
+
+                    __put_text( line, args + pos, precision >= 0 && (size_t) precision < len ? (size_t) precision : len );
+                    pos += len + 1;
+                }
+                else
+                {
+                    __put_str( line, "(null)" );
+                }
+                continue;
+            }
+        }
+
+        if( conversion == 'c' )
+        {
+            __put_char( line, (char) value );
+        }
+        else if( is_unsigned )
+        {
+            __put_unsigned( line, (unsigned long long) value & mask, base, conversion == 'X', 1 );
+        }
+        else
+        {
+            __put_signed( line, value );
+        }
+    }
+
+    __put_str( line, fmt + done );
+}
+
+/**
+** Append a message of the recorder as line for humans.
+*/
+static void __put_entry( log_dump_line_t *line, const log_ring_entry_t *entry )
+{
+    __put_char( line, '[' );
+    __put_str( line, strseverity( entry->severity ) );
+    __put_str( line, "] " );
+    __put_time( line, entry->stamp, entry->clock );
+    __put_char( line, ' ' );
+
+    if( entry->category != 0 )
+    {
+        // the name might have been changed through the shared control block
+        const char *category = strlog_category( entry->category );
+        __put_text( line, category, strnlen( category, TINYLOG_CATEGORY_NAME_SIZE ) );
+        __put_str( line, ": " );
+    }
+
+    __put_str( line, entry->func );
+    __put_str( line, "():" );
+    __put_unsigned( line, entry->line, 10, false, 3 );
+    __put_str( line, ": " );
+
+    if( entry->format != NULL )
+    {
+        __put_message( line, entry->format, entry->args );
+    }
+    else if( entry->len > 0 )
+    {
+        __put_text( line, entry->args, entry->len );
+    }
+    else if( entry->fmt != NULL )
+    {
+        // arguments couldn't be captured
+        __put_str( line, entry->fmt );
+    }
+
+    if( entry->err_no > 0 )
+    {
+        __put_str( line, "; Errno(" );
+        __put_signed( line, entry->err_no );
+        __put_char( line, ')' );
+
+        // only if the table was already built
+        const char *message = __tinylog_errno_cached( entry->err_no );
+        if( message != NULL )
+        {
+            __put_str( line, ": " );
+            __put_str( line, message );
+        }
+    }
+
+    // the line is cut, not the newline
+    if( line->len == sizeof( line->text ) )
+    {
+        line->len--;
+    }
+    __put_char( line, '\n' );
+}
+
+static void __write_line( const int fd, const log_dump_line_t *line )
+{
+    size_t pos = 0;
+    while( pos < line->len )
+    {
+        const ssize_t written = write( fd, line->text + pos, line->len - pos );
+        if( written <= 0 )
+        {
+            return;
+        }
+        pos += written;
+    }
+}
+
+/**
+** Write the messages kept by the flight recorder, oldest first for each thread.
+** Async-signal-safe.
+*/
+void tinylog_dump_recorder( const int fd )
+{
+    for( log_ring_t *ring = __atomic_load_n( &__rings, __ATOMIC_ACQUIRE ); ring != NULL; ring = ring->next )
+    {
+        const unsigned long head  = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+        const unsigned long first = head > ring->size ? head - ring->size : 0;
+
+        log_dump_line_t line = { .len = 0 };
+        __put_str( &line, "==== tinylog flight recorder, thread " );
+        __put_signed( &line, ring->tid );
+        if( ring->name[ 0 ] != '\0' )
+        {
+            __put_str( &line, " (" );
+            __put_text( &line, ring->name, strnlen( ring->name, sizeof( ring->name ) ) );
+            __put_char( &line, ')' );
+        }
+        if( __atomic_load_n( &ring->owner, __ATOMIC_RELAXED ) == 0 )
+        {
+            __put_str( &line, ", exited" );
+        }
+        __put_str( &line, " ====\n" );
+        __write_line( fd, &line );
+
+        for( unsigned long pos = first; pos < head; pos++ )
+        {
+            const log_ring_entry_t *slot = &ring->entries[ pos % ring->size ];
+
+            // copy the entry and check that it wasn't overwritten meanwhile
+            if( __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE ) != pos + 1 )
+            {
+                continue;
+            }
+            log_ring_entry_t entry;
+            memcpy( &entry, slot, sizeof( entry ) );
+            __atomic_thread_fence( __ATOMIC_ACQUIRE );
+            if( __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) != pos + 1 )
+            {
+                continue;
+            }
+
+            line.len = 0;
+            __put_entry( &line, &entry );
+            __write_line( fd, &line );
+        }
+    }
+}
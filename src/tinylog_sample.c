@@ -0,0 +1,171 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Sampling of log calls, 1 in N per severity or per category.
+**
+** The log macros decide before calling the logging routine: the limits below
+** are compared with the next number of a xorshift generator kept per thread.
+** Limits are 0 unless sampling is on, so a call which isn't sampled only
+** loads and checks its limit.
+*/
+
+#include "tinylog_internal.h"
+
+/**
+** Share of the log calls passing per severity, as fraction of UINT32_MAX (0 = all).
+** Errors and anything more critical are never sampled.
+*/
+uint32_t            __log_sampling[ TINYLOG_SEVERITIES ];
+
+/**
+** The same per category, for severities less important than LOG_ERR (0 = as the severity)
+*/
+uint32_t            __log_category_sampling[ TINYLOG_MAX_CATEGORIES ];
+
+/**
+** State of the generator of the thread, 0 until seeded
+*/
+__thread uint32_t   __log_sample_state;
+
+/**
+** The rates set, 1 in N (0 = not sampled)
+*/
+static unsigned     __sample_rates[ TINYLOG_SEVERITIES ];
+static unsigned     __category_sample_rates[ TINYLOG_MAX_CATEGORIES ];
+
+
+// internal prototypes
+
+static inline uint32_t __limit_of( const unsigned one_in );
+
+
+// functions
+
+/**
+** Log only 1 in 'one_in' calls of the given severity (chosen at random), 0 or 1 for all.
+*/
+void set_log_sampling( const int severity, const unsigned one_in )
+{
+    if( severity <= LOG_ERR || severity >= TINYLOG_SEVERITIES )
+    {
+        log_WARNING(0, "Severity can't be sampled: %d. Ignoring.", severity);
+        return;
+    }
+
+    const unsigned rate = one_in > 1 ? one_in : 0;
+
+    // the rate first, so that messages which pass the new limit report it
+    const unsigned old = __atomic_exchange_n( &__sample_rates[ severity ], rate, __ATOMIC_RELAXED );
+    __atomic_store_n( &__log_sampling[ severity ], __limit_of( rate ), __ATOMIC_RELAXED );
+
+    if( old != rate )
+    {
+        log_TRACE(0, "Set 'sampling' of %s to: 1 in %u", strseverity( severity ), rate > 0 ? rate : 1 );
+    }
+}
+
+unsigned get_log_sampling( const int severity )
+{
+    if( severity < 0 || severity >= TINYLOG_SEVERITIES )
+    {
+        return 1;
+    }
+
+    const unsigned rate = __atomic_load_n( &__sample_rates[ severity ], __ATOMIC_RELAXED );
+
+    return rate > 0 ? rate : 1;
+}
+
+/**
+** Log only 1 in 'one_in' calls of the category, 0 to follow the sampling of the severity.
+*/
+void set_log_category_sampling( const log_category_t category, const unsigned one_in )
+{
+    if( category == 0 || category >= TINYLOG_MAX_CATEGORIES )
+    {
+        log_WARNING(0, "Category can't be sampled: %u. Ignoring.", category);
+        return;
+    }
+
+    const unsigned rate = one_in > 1 ? one_in : 0;
+
+    const unsigned old = __atomic_exchange_n( &__category_sample_rates[ category ], rate, __ATOMIC_RELAXED );
+    __atomic_store_n( &__log_category_sampling[ category ], __limit_of( rate ), __ATOMIC_RELAXED );
+
+    if( old != rate )
+    {
+        log_TRACE(0, "Set 'sampling' of category '%s' to: 1 in %u", strlog_category( category ), rate > 0 ? rate : 1 );
+    }
+}
+
+unsigned get_log_category_sampling( const log_category_t category )
+{
+    if( category >= TINYLOG_MAX_CATEGORIES )
+    {
+        return 0;
+    }
+
+    return __atomic_load_n( &__category_sample_rates[ category ], __ATOMIC_RELAXED );
+}
+
+/**
+** Rate the log call was sampled with (0 if it wasn't), as decided by __tinylog_sampling().
+*/
+unsigned __tinylog_sample_rate( const log_category_t category, const int severity )
+{
+    if( severity <= LOG_ERR || severity >= TINYLOG_SEVERITIES )
+    {
+        return 0;
+    }
+
+    const unsigned rate = __atomic_load_n( &__category_sample_rates[ category % TINYLOG_MAX_CATEGORIES ], __ATOMIC_RELAXED );
+
+    return rate != 0 ? rate : __atomic_load_n( &__sample_rates[ severity ], __ATOMIC_RELAXED );
+}
+
+/**
+** Seed the generator of the calling thread, never 0.
+*/
+uint32_t __tinylog_sample_seed( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    // threads starting at the same time differ by their thread local storage
+    uint64_t seed = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+    seed ^= (uint64_t) (uintptr_t) &__log_sample_state;
+
+    // finalizer of splitmix64
+    seed = ( seed ^ ( seed >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+    seed = ( seed ^ ( seed >> 27 ) ) * 0x94D049BB133111EBULL;
+    seed ^= seed >> 31;
+
+    const uint32_t state = (uint32_t) seed ^ (uint32_t) ( seed >> 32 );
+
+    return state != 0 ? state : 0x9E3779B9;
+}
+
+/**
+** Limit for the generator, which yields all numbers but 0 with the same probability
+*/
+static inline uint32_t __limit_of( const unsigned one_in )
+{
+    return one_in > 1 ? UINT32_MAX / one_in : 0;
+}
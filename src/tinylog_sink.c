@@ -0,0 +1,430 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Registry of the sinks encoded lines are written to.
+**
+** The first sinks are built in: stderr, syslog and the log file, enabled by the
+** log destination (their ids match the bits of STDERR, SYSLOG and LOGFILE).
+** Further sinks are opened by the application and stay enabled until they are closed.
+** Each sink has a threshold and an encoding of its own. A record is encoded
+** once per encoding in use and the line is shared by all sinks using it.
+** The binary log file is not a sink, it takes the captured arguments instead of a line.
+**
+** Opening and closing sinks is rare and takes a lock, writing doesn't.
+*/
+
+#include <pthread.h>    /* pthread_mutex_lock() */
+#include <sched.h>      /* sched_yield() */
+
+#include "tinylog_internal.h"
+
+/**
+** Maximum length of sink names (including '\0')
+*/
+#define SINK_NAME_SIZE      32
+
+/**
+** Count of built-in sinks
+*/
+#define SINK_BUILTIN_COUNT  3
+
+/**
+** Sinks enabled by the log destination
+*/
+#define SINK_BUILTIN_MASK   ( STDERR | SYSLOG | LOGFILE )
+
+/**
+** A registered sink
+*/
+struct LogSink {
+    char                    name[ SINK_NAME_SIZE ];
+    const log_sink_ops_t   *ops;            // NULL if the slot is free
+    void                   *arg;
+    int                     threshold;      // LOG_THRESHOLD_DEFAULT to take all messages passing the log threshold (atomic)
+    unsigned                encoding;       // log_encoding_t (atomic)
+    unsigned                busy;           // writes in progress, waited for when the sink is closed (atomic)
+};
+typedef struct LogSink log_sink_entry_t;
+
+
+// internal prototypes
+
+static void __stderr_write( void *arg, const log_sink_line_t *line );
+static void __syslog_write( void *arg, const log_sink_line_t *line );
+static void __file_write( void *arg, const log_sink_line_t *line );
+
+static void __close_sinks( void );
+
+
+/**
+** Operations of the built-in sinks, flushing is done by their modules
+*/
+static const log_sink_ops_t STDERR_OPS  = { .write = __stderr_write };
+static const log_sink_ops_t SYSLOG_OPS  = { .write = __syslog_write };
+static const log_sink_ops_t LOGFILE_OPS = { .write = __file_write };
+
+/**
+** All sinks, indexed by their id
+*/
+static log_sink_entry_t     __sinks[ TINYLOG_MAX_SINKS ] =
+{
+    [ LOG_SINK_STDERR ]  = { "stderr", &STDERR_OPS,  NULL, LOG_THRESHOLD_DEFAULT, LOG_ENCODING_HUMAN, 0 },
+    [ LOG_SINK_SYSLOG ]  = { "syslog", &SYSLOG_OPS,  NULL, LOG_THRESHOLD_DEFAULT, LOG_ENCODING_HUMAN, 0 },
+    [ LOG_SINK_LOGFILE ] = { "file",   &LOGFILE_OPS, NULL, LOG_THRESHOLD_DEFAULT, LOG_ENCODING_HUMAN, 0 }
+};
+
+/**
+** Sinks opened by the application, one bit per id (atomic)
+*/
+static unsigned             __sink_mask = 0;
+
+/**
+** Serializes opening and closing sinks
+*/
+static pthread_mutex_t      __sink_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// functions
+
+static inline bool __is_sink( const log_sink_t sink )
+{
+    return 0 <= sink && sink < TINYLOG_MAX_SINKS
+        && __atomic_load_n( &__sinks[ sink ].ops, __ATOMIC_ACQUIRE ) != NULL;
+}
+
+/**
+** Select the sinks taking the record: the built-in ones it is flagged for
+** and the ones opened by the application, if their thresholds let it pass.
+*/
+unsigned __tinylog_sinks_select( const log_record_t *rec )
+{
+    unsigned sinks = ( rec->flags & SINK_BUILTIN_MASK ) | __atomic_load_n( &__sink_mask, __ATOMIC_ACQUIRE );
+
+    for( unsigned pending = sinks; pending != 0; pending &= pending - 1 )
+    {
+        const int sink = __builtin_ctz( pending );
+        const int threshold = __atomic_load_n( &__sinks[ sink ].threshold, __ATOMIC_RELAXED );
+
+        if( threshold != LOG_THRESHOLD_DEFAULT && threshold < rec->severity )
+        {
+            sinks &= ~( 1u << sink );
+        }
+    }
+
+    return sinks;
+}
+
+/**
+** Select those of the sinks which use the given encoding.
+*/
+unsigned __tinylog_sinks_encoded( const unsigned sinks, const log_encoding_t encoding )
+{
+    unsigned encoded = 0;
+
+    for( unsigned pending = sinks; pending != 0; pending &= pending - 1 )
+    {
+        const int sink = __builtin_ctz( pending );
+
+        if( __atomic_load_n( &__sinks[ sink ].encoding, __ATOMIC_RELAXED ) == encoding )
+        {
+            encoded |= 1u << sink;
+        }
+    }
+
+    return encoded;
+}
+
+/**
+** Hand the line to the sinks.
+*/
+void __tinylog_sinks_write( const unsigned sinks, const log_sink_line_t *line )
+{
+    for( unsigned pending = sinks; pending != 0; pending &= pending - 1 )
+    {
+        const int sink = __builtin_ctz( pending );
+        log_sink_entry_t *entry = &__sinks[ sink ];
+
+        if( sink < SINK_BUILTIN_COUNT )
+        {
+            entry->ops->write( entry->arg, line );
+            continue;
+        }
+
+        // the sink may be closed meanwhile
+        __atomic_add_fetch( &entry->busy, 1, __ATOMIC_SEQ_CST );
+        if( __atomic_load_n( &__sink_mask, __ATOMIC_SEQ_CST ) & ( 1u << sink ) )
+        {
+            entry->ops->write( entry->arg, line );
+        }
+        __atomic_sub_fetch( &entry->busy, 1, __ATOMIC_RELEASE );
+    }
+}
+
+/**
+** Let the sinks opened by the application write what they collected.
+*/
+void __tinylog_sinks_flush( void )
+{
+    const unsigned sinks = __atomic_load_n( &__sink_mask, __ATOMIC_ACQUIRE );
+
+    for( unsigned pending = sinks; pending != 0; pending &= pending - 1 )
+    {
+        log_sink_entry_t *entry = &__sinks[ __builtin_ctz( pending ) ];
+
+        __atomic_add_fetch( &entry->busy, 1, __ATOMIC_SEQ_CST );
+        if( ( __atomic_load_n( &__sink_mask, __ATOMIC_SEQ_CST ) & ( pending & -pending ) )
+            && entry->ops->flush != NULL
+        )
+        {
+            entry->ops->flush( entry->arg );
+        }
+        __atomic_sub_fetch( &entry->busy, 1, __ATOMIC_RELEASE );
+    }
+}
+
+static void __stderr_write( void *arg, const log_sink_line_t *line )
+{
+    (void) arg;
+
+    // the whole line is written at once, so that lines of concurrent
+    // threads don't get mixed up (atomic for pipes up to PIPE_BUF)
+    __tinylog_stderr_write( line->severity, line->text, line->len + 1 );
+}
+
+static void __syslog_write( void *arg, const log_sink_line_t *line )
+{
+    (void) arg;
+
+    // log only known severity levels to syslog
+    if( line->severity > LOG_DEBUG )
+    {
+        return;
+    }
+
+    // no prefix, syslog has its own
+    __tinylog_syslog_write( line->record, line->text + line->msg_offset, line->len - line->msg_offset );
+}
+
+static void __file_write( void *arg, const log_sink_line_t *line )
+{
+    (void) arg;
+
+    __tinylog_file_write( line->text, line->len + 1 );
+}
+
+//#################################################################################
+//  Registry
+//#################################################################################
+
+/**
+** Open a sink and start writing to it.
+*/
+log_sink_t open_tinylog_sink( const char *name, const log_sink_ops_t *ops, void *arg )
+{
+    static bool exit_handler = false;
+
+    if( ops == NULL || ops->write == NULL )
+    {
+        log_WARNING(0, "Sink '%s' can't be written to. Ignoring.", name );
+        return -1;
+    }
+
+    pthread_mutex_lock( &__sink_lock );
+
+    log_sink_t sink = SINK_BUILTIN_COUNT;
+    while( sink < TINYLOG_MAX_SINKS && __sinks[ sink ].ops != NULL )
+    {
+        sink++;
+    }
+
+    if( sink == TINYLOG_MAX_SINKS )
+    {
+        pthread_mutex_unlock( &__sink_lock );
+
+        log_WARNING(0, "No more sinks can be opened, maximum is: %d. Ignoring '%s'.", TINYLOG_MAX_SINKS, name );
+        return -1;
+    }
+
+    if( ops->open != NULL && !ops->open( arg ) )
+    {
+        pthread_mutex_unlock( &__sink_lock );
+
+        log_WARNING(0, "Sink '%s' couldn't be opened.", name );
+        return -1;
+    }
+
+    log_sink_entry_t *entry = &__sinks[ sink ];
+    snprintf( entry->name, sizeof( entry->name ), "%s", name != NULL ? name : "" );
+    entry->arg = arg;
+    __atomic_store_n( &entry->threshold, LOG_THRESHOLD_DEFAULT, __ATOMIC_RELAXED );
+    __atomic_store_n( &entry->encoding, LOG_ENCODING_HUMAN, __ATOMIC_RELAXED );
+    __atomic_store_n( &entry->ops, ops, __ATOMIC_RELEASE );
+
+    __atomic_or_fetch( &__sink_mask, 1u << sink, __ATOMIC_SEQ_CST );
+
+    if( !exit_handler )
+    {
+        exit_handler = true;
+        atexit( __close_sinks );
+    }
+
+    pthread_mutex_unlock( &__sink_lock );
+
+    log_TRACE(0, "Opened sink '%s': %d", name, sink );
+
+    return sink;
+}
+
+/**
+** Stop writing to the sink, after the messages queued so far.
+** Waits for writes in progress on other threads, then the sink is flushed and closed.
+*/
+void close_tinylog_sink( const log_sink_t sink )
+{
+    if( sink < SINK_BUILTIN_COUNT || !__is_sink( sink ) )
+    {
+        log_WARNING(0, "Sink %d can't be closed. Ignoring.", sink );
+        return;
+    }
+
+    // the queue may still hold messages for the sink
+    tinylog_flush();
+
+    pthread_mutex_lock( &__sink_lock );
+
+    log_sink_entry_t *entry = &__sinks[ sink ];
+
+    if( __atomic_fetch_and( &__sink_mask, ~( 1u << sink ), __ATOMIC_SEQ_CST ) & ( 1u << sink ) )
+    {
+        while( __atomic_load_n( &entry->busy, __ATOMIC_ACQUIRE ) > 0 )
+        {
+            sched_yield();
+        }
+
+        if( entry->ops->flush != NULL )
+        {
+            entry->ops->flush( entry->arg );
+        }
+        if( entry->ops->close != NULL )
+        {
+            entry->ops->close( entry->arg );
+        }
+
+        __atomic_store_n( &entry->ops, NULL, __ATOMIC_RELEASE );
+    }
+
+    pthread_mutex_unlock( &__sink_lock );
+}
+
+static void __close_sinks( void )
+{
+    for( log_sink_t sink = SINK_BUILTIN_COUNT; sink < TINYLOG_MAX_SINKS; sink++ )
+    {
+        if( __atomic_load_n( &__sink_mask, __ATOMIC_ACQUIRE ) & ( 1u << sink ) )
+        {
+            close_tinylog_sink( sink );
+        }
+    }
+}
+
+/**
+** Retrieve the id of the sink with the given name, -1 if there is none.
+*/
+log_sink_t get_log_sink( const char *name )
+{
+    for( log_sink_t sink = 0; sink < TINYLOG_MAX_SINKS; sink++ )
+    {
+        if( __is_sink( sink ) && strcmp( __sinks[ sink ].name, name ) == 0 )
+        {
+            return sink;
+        }
+    }
+
+    return -1;
+}
+
+/**
+** Threshold of the sink, applied after the log threshold (or the threshold of the category)
+**
+** default: LOG_THRESHOLD_DEFAULT (all messages passing the log threshold)
+*/
+void set_log_sink_threshold( const log_sink_t sink, const int threshold )
+{
+    if( !__is_sink( sink ) )
+    {
+        log_WARNING(0, "Unknown sink: %d. Ignoring.", sink );
+        return;
+    }
+
+    if( threshold != LOG_THRESHOLD_DEFAULT && ( threshold < 0 || LOG_INIT < threshold ) )
+    {
+        log_WARNING(0, "Unknown log threshold for sink '%s': %d. Ignoring.", __sinks[ sink ].name, threshold );
+        return;
+    }
+
+    if( threshold != __atomic_exchange_n( &__sinks[ sink ].threshold, threshold, __ATOMIC_RELAXED ) )
+    {
+        log_TRACE(0, "Set 'threshold' of sink '%s' to: %s", __sinks[ sink ].name,
+                threshold == LOG_THRESHOLD_DEFAULT ? "default" : strseverity( threshold ) );
+    }
+}
+
+int get_log_sink_threshold( const log_sink_t sink )
+{
+    return __is_sink( sink ) ? __atomic_load_n( &__sinks[ sink ].threshold, __ATOMIC_RELAXED ) : LOG_THRESHOLD_DEFAULT;
+}
+
+/**
+** Encoding of the lines written to the sink
+**
+** default: LOG_ENCODING_HUMAN
+*/
+void set_log_sink_encoding( const log_sink_t sink, const log_encoding_t encoding )
+{
+    if( !__is_sink( sink ) )
+    {
+        log_WARNING(0, "Unknown sink: %d. Ignoring.", sink );
+        return;
+    }
+
+    if( encoding != LOG_ENCODING_HUMAN && encoding != LOG_ENCODING_LOGFMT && encoding != LOG_ENCODING_JSON )
+    {
+        log_WARNING(0, "Unknown log encoding: %d. Ignoring.", encoding );
+        return;
+    }
+
+    if( encoding != __atomic_exchange_n( &__sinks[ sink ].encoding, encoding, __ATOMIC_RELAXED ) )
+    {
+        log_TRACE(0, "Set 'encoding' of sink '%s' to: %s", __sinks[ sink ].name, strlog_encoding( encoding ) );
+    }
+}
+
+log_encoding_t get_log_sink_encoding( const log_sink_t sink )
+{
+    return __is_sink( sink ) ? __atomic_load_n( &__sinks[ sink ].encoding, __ATOMIC_RELAXED ) : LOG_ENCODING_HUMAN;
+}
+
+/**
+** Retrieve the name of the given sink ("" for unknown sinks).
+*/
+const char *strlog_sink( const log_sink_t sink )
+{
+    return __is_sink( sink ) ? __sinks[ sink ].name : "";
+}
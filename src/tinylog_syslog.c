@@ -0,0 +1,622 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Native syslog sink.
+**
+** Instead of calling syslog() (which formats the message again, takes a lock
+** and blocks on /dev/log) datagrams are sent to the syslog socket directly,
+** either as RFC 5424 messages or in the native protocol of the systemd journal.
+** The parts which don't change (host name, application name, process id)
+** are rendered once. The socket is non-blocking, messages which can't be sent
+** right away are dropped and counted.
+** If the daemon isn't up yet or restarted, the socket is connected again
+** (at most once per second), like syslog() does. A new connection replaces the
+** old one with dup3() on the same descriptor, so threads still sending on it
+** never send to an unrelated file which happened to get its number.
+** The writer thread of the asynchronous logger collects its messages and
+** sends them in batches with sendmmsg().
+*/
+
+#define _GNU_SOURCE     /* sendmmsg() */
+
+#include <errno.h>      /* EAGAIN */
+#include <fcntl.h>      /* O_CLOEXEC */
+#include <pthread.h>    /* pthread_mutex_lock() */
+#include <time.h>       /* time() */
+#include <unistd.h>     /* gethostname(), getpid(), dup3() */
+
+#include <sys/socket.h> /* socket(), sendmmsg() */
+#include <sys/un.h>     /* struct sockaddr_un */
+
+#include "tinylog_internal.h"
+
+/**
+** Default sockets of the syslog daemon and the systemd journal
+*/
+#define SYSLOG_SOCKET       "/dev/log"
+#define JOURNAL_SOCKET      "/run/systemd/journal/socket"
+
+/**
+** Maximum size of a datagram, longer messages are truncated
+*/
+#define SYSLOG_DGRAM_SIZE   4096
+
+/**
+** Count of datagrams sent at once by the writer thread
+*/
+#define SYSLOG_BATCH_SIZE   32
+
+/**
+** Minimum seconds between attempts to connect again
+*/
+#define SYSLOG_RECONNECT_INTERVAL   1
+
+/**
+** How messages are sent (atomic)
+*/
+static log_syslog_mode_t    __syslog_mode = SYSLOG_LIBC;
+
+/**
+** Socket to send to, NULL for the default of the mode
+*/
+static char                 __socket_path[ sizeof( ( (struct sockaddr_un *) 0 )->sun_path ) ];
+static bool                 __socket_path_set = false;
+
+/**
+** Socket to send to, -1 until the first one is created (atomic).
+** Once created the descriptor stays the same, new connections replace it.
+*/
+static int                  __socket = -1;
+
+/**
+** When the socket was connected again the last time (atomic)
+*/
+static time_t               __reconnect_time = 0;
+
+/**
+** Parts of the messages rendered once
+*/
+static int                  __facility = LOG_USER;
+static char                 __rfc5424_header[ 320 ];     // ' HOSTNAME APP-NAME PROCID MSGID'
+static char                 __journal_header[ 320 ];     // 'SYSLOG_IDENTIFIER=...\nSYSLOG_FACILITY=...\n'
+
+/**
+** Messages which couldn't be sent (atomic)
+*/
+static unsigned long        __syslog_dropped = 0;
+
+/**
+** Serializes connecting and rendering the headers
+*/
+static pthread_mutex_t      __syslog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+** Datagrams collected by the writer thread, only used by the writer thread
+*/
+static char                 __batch[ SYSLOG_BATCH_SIZE ][ SYSLOG_DGRAM_SIZE ];
+static struct mmsghdr       __batch_msgs[ SYSLOG_BATCH_SIZE ];
+static struct iovec         __batch_iovs[ SYSLOG_BATCH_SIZE ];
+static unsigned             __batch_count = 0;
+
+/**
+** Textual representation of the syslog modes
+*/
+static const char LOG_SYSLOG_MODE[3][ 8 ] =
+{
+        "libc",
+        "rfc5424",
+        "journal"
+};
+
+
+// functions
+
+/**
+** Render the parts of the messages which don't change.
+** Has to be called with the lock held.
+*/
+static void __render_headers( const char *ident )
+{
+    char host[ 256 ];
+    if( gethostname( host, sizeof( host ) ) != 0 || host[ 0 ] == '\0' )
+    {
+        strcpy( host, "-" );
+    }
+    host[ sizeof( host ) - 1 ] = '\0';
+
+    // the application name is the program name without its path
+    const char *app = ident;
+    if( app == NULL || app[ 0 ] == '\0' )
+    {
+        app = "-";
+    }
+    else if( strrchr( app, '/' ) != NULL )
+    {
+        app = strrchr( app, '/' ) + 1;
+    }
+
+    snprintf( __rfc5424_header, sizeof( __rfc5424_header ), " %.255s %.48s %d -", host, app, (int) getpid() );
+    snprintf( __journal_header, sizeof( __journal_header ), "SYSLOG_IDENTIFIER=%.255s\nSYSLOG_FACILITY=%d\n", app, __facility >> 3 );
+}
+
+/**
+** Connect to the socket of the mode.
+** The old connection is replaced even if connecting fails, so that messages don't
+** go to a socket which was configured before. Sending then fails with ENOTCONN
+** until the daemon is up.
+** Has to be called with the lock held. Returns whether the socket is connected.
+*/
+static bool __connect( const log_syslog_mode_t mode )
+{
+    if( mode == SYSLOG_LIBC )
+    {
+        return false;
+    }
+
+    struct sockaddr_un addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    snprintf( addr.sun_path, sizeof( addr.sun_path ), "%s",
+            __socket_path_set ? __socket_path : mode == SYSLOG_JOURNAL ? JOURNAL_SOCKET : SYSLOG_SOCKET );
+
+    const int fd = socket( AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( fd < 0 )
+    {
+        return false;
+    }
+
+    const bool connected = connect( fd, (struct sockaddr *) &addr, sizeof( addr ) ) == 0;
+
+    // other threads might still be sending on the old socket, don't close its descriptor
+    const int old = __atomic_load_n( &__socket, __ATOMIC_SEQ_CST );
+    if( old >= 0 && dup3( fd, old, O_CLOEXEC ) >= 0 )
+    {
+        close( fd );
+    }
+    else
+    {
+        __atomic_store_n( &__socket, fd, __ATOMIC_SEQ_CST );
+    }
+
+    return connected;
+}
+
+/**
+** Whether sending failed because the daemon isn't there (anymore)
+*/
+static inline bool __disconnected( const int err_no )
+{
+    return err_no == ECONNREFUSED || err_no == ENOTCONN || err_no == EBADF;
+}
+
+/**
+** Connect again after the daemon wasn't up or restarted, at most once per
+** SYSLOG_RECONNECT_INTERVAL. Log calls don't wait for a setter connecting.
+** Returns whether the socket was connected.
+*/
+static bool __reconnect( const int err_no )
+{
+    const time_t now = time( NULL );
+    time_t last = __atomic_load_n( &__reconnect_time, __ATOMIC_RELAXED );
+
+    if( now - last < SYSLOG_RECONNECT_INTERVAL
+            || !__atomic_compare_exchange_n( &__reconnect_time, &last, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+    {
+        return false;
+    }
+
+    if( pthread_mutex_trylock( &__syslog_lock ) != 0 )
+    {
+        return false;
+    }
+
+    if( err_no == EBADF )
+    {
+        // the descriptor was closed behind our back, its number may belong to someone else now
+        __atomic_store_n( &__socket, -1, __ATOMIC_SEQ_CST );
+    }
+    const bool connected = __connect( __atomic_load_n( &__syslog_mode, __ATOMIC_RELAXED ) );
+
+    pthread_mutex_unlock( &__syslog_lock );
+
+    return connected;
+}
+
+/**
+** Send a single datagram, connecting again once if the daemon went away.
+*/
+static ssize_t __send( const char *buf, const size_t len )
+{
+    bool retried = false;
+
+    for( ;; )
+    {
+        const int fd = __atomic_load_n( &__socket, __ATOMIC_RELAXED );
+        if( fd < 0 )
+        {
+            if( retried || !__reconnect( 0 ) )
+            {
+                errno = ENOTCONN;
+                return -1;
+            }
+            retried = true;
+            continue;
+        }
+
+        const ssize_t sent = send( fd, buf, len, MSG_DONTWAIT );
+        if( sent >= 0 )
+        {
+            return sent;
+        }
+
+        if( errno == EINTR )
+        {
+            continue;
+        }
+        if( retried || !__disconnected( errno ) || !__reconnect( errno ) )
+        {
+            return -1;
+        }
+        retried = true;
+    }
+}
+
+/**
+** Called by open_tinylog() with the arguments of openlog().
+*/
+void __tinylog_syslog_open( const char *ident, const int facility )
+{
+    pthread_mutex_lock( &__syslog_lock );
+
+    __facility = facility;
+    __render_headers( ident );
+    __connect( __atomic_load_n( &__syslog_mode, __ATOMIC_RELAXED ) );
+
+    pthread_mutex_unlock( &__syslog_lock );
+}
+
+/**
+** How messages are sent to syslog
+*/
+void set_log_syslog_mode( const log_syslog_mode_t mode )
+{
+    if( mode != SYSLOG_LIBC && mode != SYSLOG_RFC5424 && mode != SYSLOG_JOURNAL )
+    {
+        log_WARNING(0, "Unknown syslog mode: %d. Ignoring.", mode);
+        return;
+    }
+
+    pthread_mutex_lock( &__syslog_lock );
+
+    const log_syslog_mode_t old = __atomic_exchange_n( &__syslog_mode, mode, __ATOMIC_SEQ_CST );
+    if( __rfc5424_header[ 0 ] == '\0' )
+    {
+        // open_tinylog() wasn't called
+        __render_headers( NULL );
+    }
+    __connect( mode );
+
+    pthread_mutex_unlock( &__syslog_lock );
+
+    if( mode != old )
+    {
+        log_TRACE(0, "Set 'syslog_mode' to: %s", strlog_syslog_mode( mode ) );
+    }
+}
+
+log_syslog_mode_t get_log_syslog_mode( void )
+{
+    return __atomic_load_n( &__syslog_mode, __ATOMIC_RELAXED );
+}
+
+/**
+** Socket the messages are sent to, NULL for the default of the mode
+*/
+void set_log_syslog_socket( const char *path )
+{
+    if( path != NULL && strlen( path ) >= sizeof( __socket_path ) )
+    {
+        log_WARNING(0, "Socket path too long: %s. Ignoring.", path);
+        return;
+    }
+
+    pthread_mutex_lock( &__syslog_lock );
+
+    __socket_path_set = path != NULL;
+    snprintf( __socket_path, sizeof( __socket_path ), "%s", path != NULL ? path : "" );
+    __connect( __atomic_load_n( &__syslog_mode, __ATOMIC_RELAXED ) );
+
+    pthread_mutex_unlock( &__syslog_lock );
+
+    log_TRACE(0, "Set 'syslog_socket' to: %s", path != NULL ? path : "(default)" );
+}
+
+unsigned long get_log_syslog_dropped( void )
+{
+    return __atomic_load_n( &__syslog_dropped, __ATOMIC_RELAXED );
+}
+
+/**
+** Retrieve the string representation of the given syslog mode.
+*/
+const char *strlog_syslog_mode( const log_syslog_mode_t mode )
+{
+    switch( mode ){
+        case SYSLOG_LIBC:
+        case SYSLOG_RFC5424:
+        case SYSLOG_JOURNAL:
+            return LOG_SYSLOG_MODE[ mode ];
+    }
+
+    return "*******";
+}
+
+/**
+** Append text to a datagram, truncating it at the end of the buffer.
+*/
+static size_t __put( char *buf, size_t len, const char *text, const size_t text_len )
+{
+    const size_t n = text_len < SYSLOG_DGRAM_SIZE - len ? text_len : SYSLOG_DGRAM_SIZE - len;
+    memcpy( buf + len, text, n );
+
+    return len + n;
+}
+
+/**
+** Append a field of a structured data element, escaping '"', '\' and ']'.
+*/
+static size_t __put_param( char *buf, size_t len, const char *name, const char *value )
+{
+    len = __put( buf, len, " ", 1 );
+    len = __put( buf, len, name, strlen( name ) );
+    len = __put( buf, len, "=\"", 2 );
+
+    for( const char *c = value; *c != '\0' && len < SYSLOG_DGRAM_SIZE - 1; c++ )
+    {
+        if( *c == '"' || *c == '\\' || *c == ']' )
+        {
+            buf[ len++ ] = '\\';
+        }
+        buf[ len++ ] = *c;
+    }
+
+    return __put( buf, len, "\"", 1 );
+}
+
+/**
+** Render a RFC 5424 message:
+** <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID [code@32473 func="..." line="..."] MSG
+*/
+static size_t __render_rfc5424( char *buf, const log_record_t *rec, const char *msg, const size_t msg_len )
+{
+    struct timespec time;
+    __tinylog_wall_time( rec->stamp, rec->clock, &time );
+
+    struct tm tm;
+    gmtime_r( &time.tv_sec, &tm );
+
+    size_t len = snprintf( buf, SYSLOG_DGRAM_SIZE, "<%d>1 %04d-%02d-%02dT%02d:%02d:%02d.%06ldZ",
+            __facility | rec->severity,
+            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+            time.tv_nsec / 1000 );
+
+    len = __put( buf, len, __rfc5424_header, strlen( __rfc5424_header ) );
+
+    // structured data with the origin of the message (example enterprise number of RFC 5612)
+    char line[ 16 ];
+    snprintf( line, sizeof( line ), "%d", rec->line );
+
+    len = __put( buf, len, " [code@32473", 12 );
+    len = __put_param( buf, len, "func", rec->func );
+    len = __put_param( buf, len, "line", line );
+    if( rec->category != 0 )
+    {
+        len = __put_param( buf, len, "category", strlog_category( rec->category ) );
+    }
+    if( rec->sample_rate > 1 )
+    {
+        char rate[ 16 ];
+        snprintf( rate, sizeof( rate ), "%u", rec->sample_rate );
+        len = __put_param( buf, len, "sampleRate", rate );
+    }
+    len = __put( buf, len, "] ", 2 );
+
+    return __put( buf, len, msg, msg_len );
+}
+
+/**
+** Append a field of the journal protocol, in binary form if the value contains a newline.
+*/
+static size_t __put_field( char *buf, size_t len, const char *name, const char *value, const size_t value_len )
+{
+    len = __put( buf, len, name, strlen( name ) );
+
+    if( memchr( value, '\n', value_len ) == NULL )
+    {
+        len = __put( buf, len, "=", 1 );
+        len = __put( buf, len, value, value_len );
+    }
+    else
+    {
+        // NAME\n<64 bit little endian length><value>
+        len = __put( buf, len, "\n", 1 );
+
+        unsigned char size[ 8 ];
+        for( int i = 0; i < 8; i++ )
+        {
+            size[ i ] = (unsigned char) ( (uint64_t) value_len >> ( 8 * i ) );
+        }
+        len = __put( buf, len, (const char *) size, sizeof( size ) );
+        len = __put( buf, len, value, value_len );
+    }
+
+    return __put( buf, len, "\n", 1 );
+}
+
+/**
+** Render a message of the native journal protocol
+*/
+static size_t __render_journal( char *buf, const log_record_t *rec, const char *msg, const size_t msg_len )
+{
+    size_t len = __put( buf, 0, __journal_header, strlen( __journal_header ) );
+
+    char value[ 32 ];
+    len = __put( buf, len, value, snprintf( value, sizeof( value ), "PRIORITY=%d\n", rec->severity ) );
+    len = __put( buf, len, value, snprintf( value, sizeof( value ), "CODE_LINE=%d\n", rec->line ) );
+    if( rec->err_no > 0 )
+    {
+        len = __put( buf, len, value, snprintf( value, sizeof( value ), "ERRNO=%d\n", rec->err_no ) );
+    }
+
+    len = __put_field( buf, len, "CODE_FUNC", rec->func, strlen( rec->func ) );
+    if( rec->category != 0 )
+    {
+        const char *category = strlog_category( rec->category );
+        len = __put_field( buf, len, "TINYLOG_CATEGORY", category, strlen( category ) );
+    }
+    if( rec->sample_rate > 1 )
+    {
+        len = __put( buf, len, value, snprintf( value, sizeof( value ), "TINYLOG_SAMPLE_RATE=%u\n", rec->sample_rate ) );
+    }
+
+    // a field cut by __put() would make the whole datagram invalid, shorten the value instead
+    const size_t marker_len = sizeof( TRUNCATION_MARKER ) - 1;
+    const size_t room = SYSLOG_DGRAM_SIZE - len < 8 + 9 ? 0 : SYSLOG_DGRAM_SIZE - len - ( 8 + 9 );
+    if( msg_len <= room )
+    {
+        return __put_field( buf, len, "MESSAGE", msg, msg_len );
+    }
+    if( room < marker_len )
+    {
+        return len;
+    }
+
+    // the value is followed by the closing newline
+    len = __put_field( buf, len, "MESSAGE", msg, room );
+    memcpy( buf + len - 1 - marker_len, TRUNCATION_MARKER, marker_len );
+
+    return len;
+}
+
+/**
+** Send the datagrams collected by the writer thread.
+*/
+void __tinylog_syslog_flush( void )
+{
+    unsigned done = 0;          // sent or skipped
+    unsigned long dropped = 0;
+    bool retried = false;
+
+    while( done < __batch_count )
+    {
+        const int fd = __atomic_load_n( &__socket, __ATOMIC_RELAXED );
+        if( fd < 0 )
+        {
+            if( retried || !__reconnect( 0 ) )
+            {
+                break;
+            }
+            retried = true;
+            continue;
+        }
+
+        const int n = sendmmsg( fd, __batch_msgs + done, __batch_count - done, MSG_DONTWAIT );
+        if( n >= 0 )
+        {
+            done += n;
+            continue;
+        }
+
+        if( errno == EINTR )
+        {
+            continue;
+        }
+        if( !retried && __disconnected( errno ) )
+        {
+            retried = true;
+            if( __reconnect( errno ) )
+            {
+                continue;
+            }
+        }
+        if( errno == EAGAIN || errno == EWOULDBLOCK || __disconnected( errno ) )
+        {
+            // the daemon can't keep up or isn't there, don't wait for it
+            break;
+        }
+
+        // the first datagram was refused (e.g. EMSGSIZE), skip just this one
+        dropped++;
+        done++;
+    }
+
+    dropped += __batch_count - done;
+    if( dropped > 0 )
+    {
+        __atomic_add_fetch( &__syslog_dropped, dropped, __ATOMIC_RELAXED );
+    }
+
+    __batch_count = 0;
+}
+
+/**
+** Send the message of the record to syslog.
+*/
+void __tinylog_syslog_write( const log_record_t *rec, const char *msg, const size_t len )
+{
+    const log_syslog_mode_t mode = __atomic_load_n( &__syslog_mode, __ATOMIC_RELAXED );
+
+    if( mode == SYSLOG_LIBC )
+    {
+        syslog( rec->severity, "%.*s", (int) len, msg );
+        return;
+    }
+
+    // the writer thread sends its messages in batches
+    const bool batch = __tinylog_is_writer();
+
+    char stack_buf[ SYSLOG_DGRAM_SIZE ];
+    char *buf = batch ? __batch[ __batch_count ] : stack_buf;
+
+    const size_t dgram_len = mode == SYSLOG_JOURNAL
+            ? __render_journal( buf, rec, msg, len )
+            : __render_rfc5424( buf, rec, msg, len );
+
+    if( batch )
+    {
+        __batch_iovs[ __batch_count ].iov_base = buf;
+        __batch_iovs[ __batch_count ].iov_len  = dgram_len;
+
+        memset( &__batch_msgs[ __batch_count ], 0, sizeof( struct mmsghdr ) );
+        __batch_msgs[ __batch_count ].msg_hdr.msg_iov    = &__batch_iovs[ __batch_count ];
+        __batch_msgs[ __batch_count ].msg_hdr.msg_iovlen = 1;
+
+        if( ++__batch_count == SYSLOG_BATCH_SIZE )
+        {
+            __tinylog_syslog_flush();
+        }
+        return;
+    }
+
+    if( __send( buf, dgram_len ) < 0 )
+    {
+        __atomic_add_fetch( &__syslog_dropped, 1, __ATOMIC_RELAXED );
+    }
+}
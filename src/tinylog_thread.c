@@ -0,0 +1,154 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** State owned by the threads which log: their id and name, the buffers for
+** long messages and lines, and the cached text of the current second.
+** It is set up the first time a thread logs and released when the thread exits.
+*/
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "tinylog_internal.h"
+
+/**
+** State of the calling thread
+*/
+__thread log_thread_t   __log_thread = { .time = { .sec = -1 } };
+
+/**
+** Releases the state when the thread exits
+*/
+static pthread_key_t    __thread_key;
+static pthread_once_t   __thread_once = PTHREAD_ONCE_INIT;
+
+
+// internal prototypes
+
+static void __thread_key_create( void );
+static void __thread_exit( void *thread );
+static void __after_fork( void );
+
+
+// functions
+
+/**
+** Set up the state of the calling thread.
+*/
+void __tinylog_thread_init( void )
+{
+    pthread_once( &__thread_once, __thread_key_create );
+
+    __log_thread.tid = syscall( SYS_gettid );
+
+    // release the state when the thread exits
+    pthread_setspecific( __thread_key, &__log_thread );
+}
+
+static void __thread_key_create( void )
+{
+    pthread_key_create( &__thread_key, __thread_exit );
+
+    // the child runs with the thread which forked, but has an id of its own
+    pthread_atfork( NULL, NULL, __after_fork );
+}
+
+static void __after_fork( void )
+{
+    __log_thread.tid = 0;
+}
+
+static void __thread_exit( void *state )
+{
+    log_thread_t *thread = state;
+
+    for( int i = 0; i < ARENA_COUNT; i++ )
+    {
+        free( thread->arena[ i ] );
+        thread->arena[ i ] = NULL;
+        thread->arena_size[ i ] = 0;
+    }
+
+    // the messages stay in the flight recorder until another thread takes it over
+    __tinylog_recorder_release( thread->ring );
+    thread->ring = NULL;
+
+    // destructors running later may still log, they set the state up again
+    thread->tid = 0;
+}
+
+/**
+** Retrieve a buffer of at least the given size owned by the calling thread.
+** The buffer is kept for the next calls, so it is only allocated when it has to grow.
+** Returns NULL if the memory can't be allocated.
+*/
+char *__tinylog_arena( const int arena, const size_t size )
+{
+    log_thread_t *thread = __tinylog_thread();
+
+    if( size <= thread->arena_size[ arena ] )
+    {
+        return thread->arena[ arena ];
+    }
+
+    // grow at least to the next power of two to avoid frequent reallocation
+    size_t new_size = 256;
+    while( new_size < size )
+    {
+        new_size <<= 1;
+    }
+
+    char *buffer = realloc( thread->arena[ arena ], new_size );
+    if( buffer == NULL )
+    {
+        return NULL;
+    }
+
+    thread->arena[ arena ] = buffer;
+    thread->arena_size[ arena ] = new_size;
+
+    return buffer;
+}
+
+/**
+** Name of the calling thread shown in the prefix
+*/
+void set_log_thread_name( const char *name )
+{
+    log_thread_t *thread = __tinylog_thread();
+
+    snprintf( thread->name, sizeof( thread->name ), "%s", name != NULL ? name : "" );
+
+    __tinylog_recorder_rename( thread->ring, thread->name );
+}
+
+const char *get_log_thread_name( void )
+{
+    return __tinylog_thread()->name;
+}
+
+/**
+** Id of the calling thread, as shown in the prefix
+*/
+int get_log_thread_id( void )
+{
+    return __tinylog_thread()->tid;
+}
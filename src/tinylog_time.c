@@ -0,0 +1,496 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Timestamps of log records.
+**
+** Log calls only read the selected clock, the raw value is converted
+** to wall clock time when the record is written.
+**
+** localtime_r() and strftime() are expensive (glibc takes a lock for the
+** timezone), so the formatted date and time are cached per thread and only
+** recomputed when the second changes.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>  /* __rdtsc() */
+#define HAVE_TSC
+#endif
+
+#include "tinylog_internal.h"
+
+#define NANOS_PER_SEC   1000000000ULL
+
+/**
+** Clock to take timestamps from (atomic)
+*/
+static log_clock_t          __log_clock = LOG_CLOCK_REALTIME;
+
+/**
+** Whether the faster but less precise coarse clocks should be used (atomic)
+*/
+static bool                 __coarse_clock = false;
+
+// internal prototypes
+
+static size_t __format_time_of_day( char *str, const struct timespec *time );
+
+
+/**
+** Layout and precision of formatted timestamps (atomic)
+*/
+static log_time_layout_t    __time_layout = LOG_TIME_OF_DAY;
+static log_time_precision_t __time_precision = LOG_TIME_MILLIS;
+
+/**
+** What is needed to turn raw times into wall clock time.
+** A calibration is never changed once published, a new one replaces it as a whole.
+*/
+struct ClockCalibration {
+    uint64_t        monotonic_offset;       // CLOCK_MONOTONIC to wall clock time (nanoseconds)
+    uint64_t        tsc_base_ticks;         // time stamp counter ticks to wall clock time
+    uint64_t        tsc_base_nanos;
+    double          tsc_nanos_per_tick;
+};
+typedef struct ClockCalibration clock_calibration_t;
+
+/**
+** Calibration in use (atomic). Replaced calibrations are not freed, the writer thread
+** might still be converting with them (set_log_clock() is rarely called more than once).
+*/
+static const clock_calibration_t __initial_calibration;
+static const clock_calibration_t *__calibration = &__initial_calibration;
+
+/**
+** Formatter for the selected layout, chosen when the layout is set
+*/
+typedef size_t (*time_formatter_t)( char *str, const struct timespec *time );
+static time_formatter_t     __time_formatter = __format_time_of_day;
+
+/**
+** Divisors to turn nanoseconds into the fraction of the given precision
+*/
+static const unsigned long FRACTION_DIVISOR[ 10 ] =
+{
+    1000000000, 100000000, 10000000, 1000000, 100000, 10000, 1000, 100, 10, 1
+};
+
+
+// functions
+
+static inline uint64_t __timespec_nanos( const struct timespec *ts )
+{
+    return ts->tv_sec * NANOS_PER_SEC + ts->tv_nsec;
+}
+
+static inline uint64_t __clock_nanos( const clockid_t clock )
+{
+    struct timespec now;
+    clock_gettime( clock, &now );
+
+    return __timespec_nanos( &now );
+}
+
+static uint64_t __read_tsc( void )
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint64_t __read_realtime( void )
+{
+    return __clock_nanos( CLOCK_REALTIME );
+}
+
+static uint64_t __read_realtime_coarse( void )
+{
+#ifdef CLOCK_REALTIME_COARSE
+    return __clock_nanos( CLOCK_REALTIME_COARSE );
+#else
+    return __clock_nanos( CLOCK_REALTIME );
+#endif
+}
+
+static uint64_t __read_monotonic( void )
+{
+    return __clock_nanos( CLOCK_MONOTONIC );
+}
+
+static uint64_t __read_monotonic_coarse( void )
+{
+#ifdef CLOCK_MONOTONIC_COARSE
+    return __clock_nanos( CLOCK_MONOTONIC_COARSE );
+#else
+    return __clock_nanos( CLOCK_MONOTONIC );
+#endif
+}
+
+static uint64_t __realtime_to_wall( const uint64_t stamp )
+{
+    return stamp;
+}
+
+static uint64_t __monotonic_to_wall( const uint64_t stamp )
+{
+    const clock_calibration_t *calibration = __atomic_load_n( &__calibration, __ATOMIC_ACQUIRE );
+
+    return stamp + calibration->monotonic_offset;
+}
+
+static uint64_t __tsc_to_wall( const uint64_t stamp )
+{
+    const clock_calibration_t *calibration = __atomic_load_n( &__calibration, __ATOMIC_ACQUIRE );
+
+    return calibration->tsc_base_nanos
+         + (int64_t) ( (double) (int64_t) ( stamp - calibration->tsc_base_ticks ) * calibration->tsc_nanos_per_tick );
+}
+
+/**
+** Clock sources, indexed by clock * 2 + coarse
+*/
+struct ClockSource {
+    log_clock_t     clock;
+    uint64_t      (*read)( void );                      // raw time of a new record
+    uint64_t      (*to_wall)( const uint64_t stamp );   // raw time to nanoseconds since the epoch
+};
+typedef struct ClockSource clock_source_t;
+
+static const clock_source_t CLOCK_SOURCES[] =
+{
+    { LOG_CLOCK_REALTIME,   __read_realtime,            __realtime_to_wall },
+    { LOG_CLOCK_REALTIME,   __read_realtime_coarse,     __realtime_to_wall },
+    { LOG_CLOCK_MONOTONIC,  __read_monotonic,           __monotonic_to_wall },
+    { LOG_CLOCK_MONOTONIC,  __read_monotonic_coarse,    __monotonic_to_wall },
+    { LOG_CLOCK_TSC,        __read_tsc,                 __tsc_to_wall },
+    { LOG_CLOCK_TSC,        __read_tsc,                 __tsc_to_wall }     // there is no coarse TSC
+};
+
+/**
+** Index of the selected clock source
+*/
+static unsigned __clock_source = 0;
+
+static void __select_clock_source( void )
+{
+    const log_clock_t clock = __atomic_load_n( &__log_clock, __ATOMIC_ACQUIRE );
+    const bool coarse = __atomic_load_n( &__coarse_clock, __ATOMIC_ACQUIRE );
+
+    __atomic_store_n( &__clock_source, clock * 2 + ( coarse ? 1 : 0 ), __ATOMIC_RELEASE );
+}
+
+/**
+** Measure the rate of the time stamp counter against CLOCK_MONOTONIC.
+*/
+static void __calibrate_tsc( clock_calibration_t *calibration )
+{
+    const uint64_t wall0  = __clock_nanos( CLOCK_REALTIME );
+    const uint64_t mono0  = __clock_nanos( CLOCK_MONOTONIC );
+    const uint64_t ticks0 = __read_tsc();
+
+    const struct timespec pause = { 0, 20 * 1000 * 1000 };
+    nanosleep( &pause, NULL );
+
+    const uint64_t mono1  = __clock_nanos( CLOCK_MONOTONIC );
+    const uint64_t ticks1 = __read_tsc();
+
+    calibration->tsc_nanos_per_tick = (double) ( mono1 - mono0 ) / (double) ( ticks1 - ticks0 );
+    calibration->tsc_base_ticks = ticks0;
+    calibration->tsc_base_nanos = wall0;
+}
+
+/**
+** Clocks to take timestamps from
+**
+** default: LOG_CLOCK_REALTIME
+*/
+void set_log_clock( const log_clock_t clock )
+{
+    switch( clock )
+    {
+        case LOG_CLOCK_REALTIME:
+        case LOG_CLOCK_MONOTONIC:
+            break;
+
+        case LOG_CLOCK_TSC:
+#ifdef HAVE_TSC
+            break;
+#else
+            log_WARNING(0, "No time stamp counter available. Ignoring.");
+            return;
+#endif
+
+        default:
+            log_WARNING(0, "Unknown log clock: %d. Ignoring.", clock);
+            return;
+    }
+
+    if( clock != LOG_CLOCK_REALTIME )
+    {
+        clock_calibration_t *calibration = malloc( sizeof( clock_calibration_t ) );
+        if( calibration == NULL )
+        {
+            log_ERR(0, "Could not allocate clock calibration. Ignoring.");
+            return;
+        }
+
+        // keep what the other clock needs, records taken from it may still be waiting
+        *calibration = *__atomic_load_n( &__calibration, __ATOMIC_ACQUIRE );
+        if( clock == LOG_CLOCK_MONOTONIC )
+        {
+            calibration->monotonic_offset = __clock_nanos( CLOCK_REALTIME ) - __clock_nanos( CLOCK_MONOTONIC );
+        }
+        else
+        {
+            __calibrate_tsc( calibration );
+        }
+
+        // publish the calibration before the clock, records taken from the clock need it
+        __atomic_store_n( &__calibration, calibration, __ATOMIC_RELEASE );
+    }
+
+    __atomic_store_n( &__log_clock, clock, __ATOMIC_RELEASE );
+    __select_clock_source();
+
+    log_TRACE(0, "Set 'clock' to: %d", clock );
+}
+
+log_clock_t get_log_clock( void )
+{
+    return __atomic_load_n( &__log_clock, __ATOMIC_RELAXED );
+}
+
+/**
+** Whether timestamps should be taken from the coarse clocks
+** (resolution of a few milliseconds, but much cheaper to read)
+**
+** default: false
+*/
+void set_log_coarse_clock( const bool coarse_clock )
+{
+    if( coarse_clock != __atomic_exchange_n( &__coarse_clock, coarse_clock, __ATOMIC_ACQ_REL ) )
+    {
+        __select_clock_source();
+
+        log_TRACE(0, "Set 'coarse_clock' to: %s", coarse_clock ? "true" : "false" );
+    }
+}
+
+bool get_log_coarse_clock( void )
+{
+    return __atomic_load_n( &__coarse_clock, __ATOMIC_RELAXED );
+}
+
+/**
+** Retrieve the raw time for a new log record and the clock it was taken from.
+*/
+uint64_t __tinylog_now( unsigned *clock )
+{
+    const clock_source_t *source = &CLOCK_SOURCES[ __atomic_load_n( &__clock_source, __ATOMIC_ACQUIRE ) ];
+
+    *clock = source->clock;
+
+    return source->read();
+}
+
+/**
+** Convert a raw time taken by __tinylog_now() into wall clock time.
+*/
+void __tinylog_wall_time( const uint64_t stamp, const unsigned clock, struct timespec *time )
+{
+    const uint64_t nanos = CLOCK_SOURCES[ clock * 2 ].to_wall( stamp );
+
+    time->tv_sec  = nanos / NANOS_PER_SEC;
+    time->tv_nsec = nanos % NANOS_PER_SEC;
+}
+
+/**
+** Write the value as decimal with exactly 'digits' digits.
+*/
+static inline void __put_digits( char *str, unsigned long value, int digits )
+{
+    while( digits-- > 0 )
+    {
+        str[ digits ] = '0' + value % 10;
+        value /= 10;
+    }
+}
+
+/**
+** Append the fraction of the second with the selected precision.
+*/
+static inline size_t __put_fraction( char *str, const char separator, const long nanos )
+{
+    const int digits = __atomic_load_n( &__time_precision, __ATOMIC_RELAXED );
+
+    str[ 0 ] = separator;
+    __put_digits( str + 1, nanos / FRACTION_DIVISOR[ digits ], digits );
+
+    return 1 + digits;
+}
+
+/**
+** Format as '14:37:52,628' (fraction depending on the precision).
+*/
+static size_t __format_time_of_day( char *str, const struct timespec *time )
+{
+    // text formatted last by this thread
+    log_time_cache_t *cache = &__log_thread.time;
+
+    if( time->tv_sec != cache->sec || cache->layout != LOG_TIME_OF_DAY )
+    {
+        struct tm result;
+        localtime_r( &time->tv_sec, &result );
+
+        __put_digits( cache->text + 0, result.tm_hour, 2 );
+        cache->text[ 2 ] = ':';
+        __put_digits( cache->text + 3, result.tm_min, 2 );
+        cache->text[ 5 ] = ':';
+        __put_digits( cache->text + 6, result.tm_sec, 2 );
+        cache->len = 8;
+
+        cache->sec = time->tv_sec;
+        cache->layout = LOG_TIME_OF_DAY;
+    }
+
+    memcpy( str, cache->text, cache->len );
+
+    return cache->len + __put_fraction( str + cache->len, ',', time->tv_nsec );
+}
+
+/**
+** Format as '2016-07-03T14:37:52.628+02:00' (fraction depending on the precision).
+*/
+static size_t __format_iso8601( char *str, const struct timespec *time )
+{
+    // text formatted last by this thread
+    log_time_cache_t *cache = &__log_thread.time;
+
+    if( time->tv_sec != cache->sec || cache->layout != LOG_TIME_ISO8601 )
+    {
+        struct tm result;
+        localtime_r( &time->tv_sec, &result );
+
+        cache->len = strftime( cache->text, sizeof( cache->text ), "%Y-%m-%dT%H:%M:%S", &result );
+
+        const long offset = result.tm_gmtoff / 60;
+        const long offset_abs = offset < 0 ? -offset : offset;
+        cache->zone[ 0 ] = offset < 0 ? '-' : '+';
+        __put_digits( cache->zone + 1, offset_abs / 60, 2 );
+        cache->zone[ 3 ] = ':';
+        __put_digits( cache->zone + 4, offset_abs % 60, 2 );
+        cache->zone_len = 6;
+
+        cache->sec = time->tv_sec;
+        cache->layout = LOG_TIME_ISO8601;
+    }
+
+    memcpy( str, cache->text, cache->len );
+    size_t len = cache->len;
+
+    len += __put_fraction( str + len, '.', time->tv_nsec );
+
+    memcpy( str + len, cache->zone, cache->zone_len );
+
+    return len + cache->zone_len;
+}
+
+/**
+** Format as count of milli-, micro- or nanoseconds since the epoch, e.g. '1467549472628'.
+*/
+static size_t __format_epoch( char *str, const struct timespec *time )
+{
+    const int digits = __atomic_load_n( &__time_precision, __ATOMIC_RELAXED );
+    unsigned long long value = (unsigned long long) time->tv_sec * FRACTION_DIVISOR[ 9 - digits ]
+                             + time->tv_nsec / FRACTION_DIVISOR[ digits ];
+
+    char reversed[ 24 ];
+    size_t len = 0;
+    do
+    {
+        reversed[ len++ ] = '0' + value % 10;
+        value /= 10;
+    }
+    while( value > 0 );
+
+    for( size_t i = 0; i < len; i++ )
+    {
+        str[ i ] = reversed[ len - 1 - i ];
+    }
+
+    return len;
+}
+
+/**
+** Layout and precision of the timestamps on stderr
+**
+** default: LOG_TIME_OF_DAY, LOG_TIME_MILLIS
+*/
+void set_log_time_format( const log_time_layout_t layout, const log_time_precision_t precision )
+{
+    time_formatter_t formatter;
+
+    switch( layout )
+    {
+        case LOG_TIME_OF_DAY:   formatter = __format_time_of_day;   break;
+        case LOG_TIME_ISO8601:  formatter = __format_iso8601;       break;
+        case LOG_TIME_EPOCH:    formatter = __format_epoch;         break;
+        default:
+            log_WARNING(0, "Unknown time layout: %d. Ignoring.", layout);
+            return;
+    }
+
+    if(     precision != LOG_TIME_MILLIS &&
+            precision != LOG_TIME_MICROS &&
+            precision != LOG_TIME_NANOS
+    )
+    {
+        log_WARNING(0, "Unknown time precision: %d. Ignoring.", precision);
+        return;
+    }
+
+    __atomic_store_n( &__time_precision, precision, __ATOMIC_RELAXED );
+    __atomic_store_n( &__time_layout, layout, __ATOMIC_RELAXED );
+    __atomic_store_n( &__time_formatter, formatter, __ATOMIC_RELEASE );
+
+    log_TRACE(0, "Set 'time_format' to: %d, precision: %d", layout, precision );
+}
+
+log_time_layout_t get_log_time_layout( void )
+{
+    return __atomic_load_n( &__time_layout, __ATOMIC_RELAXED );
+}
+
+log_time_precision_t get_log_time_precision( void )
+{
+    return __atomic_load_n( &__time_precision, __ATOMIC_RELAXED );
+}
+
+/**
+** Format the time with the selected layout (no '\0' appended).
+** Returns the length, at most TINYLOG_TIME_SIZE.
+*/
+size_t __tinylog_format_time( char *str, const struct timespec *time )
+{
+    const time_formatter_t formatter = __atomic_load_n( &__time_formatter, __ATOMIC_ACQUIRE );
+
+    return formatter( str, time );
+}
@@ -0,0 +1,421 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Turns binary log files (see open_tinylog_binary()) back into the lines
+** tinylog writes to stderr. Times are shown in the local time zone.
+**
+**   tinylog-decode [file ...]
+*/
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "../src/tinylog_internal.h"
+
+/**
+** Zeros after the arguments of a record, so that a broken file can't make
+** the formatting read beyond them (FORMAT_MAX_SPECS arguments of up to 16 bytes)
+*/
+#define ARGS_PADDING    ( FORMAT_MAX_SPECS * 3 * 16 )
+
+/**
+** Size of the buffer for a decoded line
+*/
+#define LINE_SIZE       ( TINYLOG_PREFIX_SIZE + 2 * UINT16_MAX + TINYLOG_ERRNO_SIZE )
+
+/**
+** A format string of the dictionary
+*/
+struct DecodeFormat {
+    char           *fmt;
+    log_format_t    format;
+};
+
+/**
+** A call site of the dictionary
+*/
+struct DecodeSite {
+    char           *func;
+    int             line;
+};
+
+/**
+** Name of a thread
+*/
+struct DecodeThread {
+    int             tid;
+    char            name[ TINYLOG_THREAD_NAME_SIZE ];
+};
+
+/**
+** Dictionary of the file being decoded
+*/
+static struct DecodeFormat *__formats = NULL;
+static size_t               __format_count = 0;
+static struct DecodeSite   *__sites = NULL;
+static size_t               __site_count = 0;
+static log_category_t       __categories[ 256 ];
+static struct DecodeThread *__threads = NULL;
+static size_t               __thread_count = 0;
+
+static char                 __args[ UINT16_MAX + ARGS_PADDING ];
+static char                 __line[ LINE_SIZE ];
+
+
+// functions
+
+/**
+** Forget the dictionary of the previous file.
+*/
+static void __reset( void )
+{
+    for( size_t i = 0; i < __format_count; i++ )
+    {
+        free( __formats[ i ].fmt );
+    }
+    for( size_t i = 0; i < __site_count; i++ )
+    {
+        free( __sites[ i ].func );
+    }
+    free( __formats );
+    free( __sites );
+    free( __threads );
+
+    __formats      = NULL;
+    __format_count = 0;
+    __sites        = NULL;
+    __site_count   = 0;
+    __threads      = NULL;
+    __thread_count = 0;
+    memset( __categories, 0, sizeof( __categories ) );
+}
+
+/**
+** Read exactly 'size' bytes.
+** Returns false at the end of the file.
+*/
+static bool __read( FILE *file, void *buf, const size_t size )
+{
+    return size == 0 || fread( buf, size, 1, file ) == 1;
+}
+
+/**
+** Read the text of a dictionary entry.
+*/
+static char *__read_text( FILE *file, const size_t len )
+{
+    char *text = malloc( len + 1 );
+    if( text == NULL || !__read( file, text, len ) )
+    {
+        free( text );
+        return NULL;
+    }
+    text[ len ] = '\0';
+
+    return text;
+}
+
+/**
+** Retrieve the name of the thread, NULL if the table can't grow.
+*/
+static struct DecodeThread *__find_thread( const int tid )
+{
+    for( size_t i = 0; i < __thread_count; i++ )
+    {
+        if( __threads[ i ].tid == tid )
+        {
+            return &__threads[ i ];
+        }
+    }
+
+    struct DecodeThread *threads = realloc( __threads, ( __thread_count + 1 ) * sizeof( *threads ) );
+    if( threads == NULL )
+    {
+        return NULL;
+    }
+    __threads = threads;
+
+    struct DecodeThread *thread = &__threads[ __thread_count++ ];
+    thread->tid = tid;
+    thread->name[ 0 ] = '\0';
+
+    return thread;
+}
+
+/**
+** Grow the table so that it holds the entry with the given id.
+*/
+static void *__grow( void *table, size_t *count, const size_t entry_size, const uint32_t id )
+{
+    if( id < *count )
+    {
+        return table;
+    }
+
+    void *grown = realloc( table, ( id + 1 ) * entry_size );
+    if( grown != NULL )
+    {
+        memset( (char *) grown + *count * entry_size, 0, ( id + 1 - *count ) * entry_size );
+        *count = id + 1;
+    }
+
+    return grown;
+}
+
+static bool __read_string( FILE *file, const uint8_t type )
+{
+    binary_string_t entry = { .type = type };
+    if( !__read( file, (char *) &entry + 1, sizeof( entry ) - 1 ) )
+    {
+        return false;
+    }
+
+    char *text = __read_text( file, entry.len );
+    if( text == NULL )
+    {
+        return false;
+    }
+
+    switch( entry.type )
+    {
+        case BINARY_FORMAT:
+        {
+            struct DecodeFormat *formats = __grow( __formats, &__format_count, sizeof( *formats ), entry.id );
+            if( formats == NULL )
+            {
+                return false;
+            }
+            __formats = formats;
+
+            free( __formats[ entry.id ].fmt );
+            __formats[ entry.id ].fmt = text;
+            __tinylog_parse_format( text, &__formats[ entry.id ].format );
+            return true;
+        }
+
+        case BINARY_SITE:
+        {
+            struct DecodeSite *sites = __grow( __sites, &__site_count, sizeof( *sites ), entry.id );
+            if( sites == NULL )
+            {
+                return false;
+            }
+            __sites = sites;
+
+            free( __sites[ entry.id ].func );
+            __sites[ entry.id ].func = text;
+            __sites[ entry.id ].line = entry.line;
+            return true;
+        }
+
+        case BINARY_THREAD:
+        {
+            struct DecodeThread *thread = __find_thread( entry.id );
+            if( thread == NULL )
+            {
+                free( text );
+                return false;
+            }
+
+            snprintf( thread->name, sizeof( thread->name ), "%s", text );
+            free( text );
+            return true;
+        }
+
+        default:
+            // categories are registered under their name, their handle may differ
+            __categories[ entry.id % 256 ] = tinylog_category( text );
+            free( text );
+            return true;
+    }
+}
+
+static bool __read_record( FILE *file, uint64_t *time )
+{
+    binary_record_t entry;
+    int32_t tid = 0;
+    if( !__read( file, (char *) &entry + 1, sizeof( entry ) - 1 )
+        || !__read( file, &tid, entry.flags & BINARY_THREAD_INFO ? sizeof( tid ) : 0 )
+        || !__read( file, __args, entry.args_len )
+    )
+    {
+        return false;
+    }
+    memset( __args + entry.args_len, 0, ARGS_PADDING );
+
+    *time += entry.delta;
+
+    log_record_t rec =
+    {
+        .stamp      = *time,
+        .clock      = LOG_CLOCK_REALTIME,
+        .func       = "?",
+        .category   = __categories[ entry.category ],
+        .line       = 0,
+        .severity   = entry.severity,
+        .err_no     = entry.err_no,
+        .flags      = RECORD_DEFERRED | ( entry.flags & BINARY_DEV_LOGGING ? RECORD_DEV_LOGGING : 0 ),
+        .len        = entry.args_len,
+        .size       = sizeof( __args ),
+        .msg        = __args
+    };
+
+    if( entry.flags & BINARY_THREAD_INFO )
+    {
+        const struct DecodeThread *thread = __find_thread( tid );
+
+        rec.tid = tid;
+        snprintf( rec.thread_name, sizeof( rec.thread_name ), "%s", thread != NULL ? thread->name : "" );
+        rec.flags |= RECORD_THREAD_INFO;
+    }
+
+    if( entry.site < __site_count && __sites[ entry.site ].func != NULL )
+    {
+        rec.func = __sites[ entry.site ].func;
+        rec.line = __sites[ entry.site ].line;
+    }
+
+    if( entry.format >= __format_count || __formats[ entry.format ].fmt == NULL )
+    {
+        fprintf( stderr, "tinylog-decode: unknown format string %u\n", entry.format );
+        return false;
+    }
+
+    const struct DecodeFormat *format = &__formats[ entry.format ];
+    if( !format->format.deferrable )
+    {
+        // never written like this, show the format string at least
+        rec.flags &= ~RECORD_DEFERRED;
+        rec.msg    = format->fmt;
+        rec.len    = strlen( format->fmt );
+    }
+    rec.format = &format->format;
+
+    const size_t len = __tinylog_format_line( &rec, __line, sizeof( __line ) );
+    __line[ len ] = '\n';
+    fwrite( __line, len + 1, 1, stdout );
+
+    return true;
+}
+
+/**
+** Decode a whole file.
+** Returns false if it is not a binary log file or broken.
+*/
+static bool __decode( FILE *file, const char *name )
+{
+    binary_header_t header;
+    if( !__read( file, &header, sizeof( header ) )
+        || memcmp( header.magic, BINARY_MAGIC, sizeof( header.magic ) ) != 0
+        || header.version != BINARY_VERSION
+    )
+    {
+        fprintf( stderr, "tinylog-decode: %s: not a binary log file\n", name );
+        return false;
+    }
+
+    const uint16_t byte_order = 1;
+    if( header.long_size != sizeof( long )
+        || header.pointer_size != sizeof( void * )
+        || header.ldouble_size != sizeof( long double )
+        || header.little_endian != *(const uint8_t *) &byte_order
+    )
+    {
+        fprintf( stderr, "tinylog-decode: %s: written on a different architecture\n", name );
+        return false;
+    }
+
+    set_log_time_format( header.time_layout, header.time_precision );
+
+    uint64_t time = header.time;
+
+    uint8_t type;
+    while( __read( file, &type, 1 ) )
+    {
+        bool done;
+        switch( type )
+        {
+            case BINARY_FORMAT:
+            case BINARY_SITE:
+            case BINARY_CATEGORY:
+            case BINARY_THREAD:
+                done = __read_string( file, type );
+                break;
+
+            case BINARY_TIME:
+            {
+                binary_time_t entry;
+                done = __read( file, (char *) &entry + 1, sizeof( entry ) - 1 );
+                time = entry.time;
+                break;
+            }
+
+            case BINARY_RECORD:
+                done = __read_record( file, &time );
+                break;
+
+            default:
+                done = false;
+                break;
+        }
+
+        if( !done )
+        {
+            fprintf( stderr, "tinylog-decode: %s: broken entry at offset %ld\n", name, ftell( file ) );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main( int argc, char **argv )
+{
+    // messages are as long as the writer allowed
+    set_log_max_msg_size( UINT16_MAX );
+
+    if( argc < 2 )
+    {
+        return __decode( stdin, "-" ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    int result = EXIT_SUCCESS;
+    for( int i = 1; i < argc; i++ )
+    {
+        FILE *file = fopen( argv[ i ], "rb" );
+        if( file == NULL )
+        {
+            fprintf( stderr, "tinylog-decode: %s: %s\n", argv[ i ], strerror( errno ) );
+            result = EXIT_FAILURE;
+            continue;
+        }
+
+        // each file has its own dictionary
+        __reset();
+
+        if( !__decode( file, argv[ i ] ) )
+        {
+            result = EXIT_FAILURE;
+        }
+        fclose( file );
+    }
+
+    return result;
+}
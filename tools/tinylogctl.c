@@ -0,0 +1,418 @@
+/*
+** tinylog - minimalistic logging facility supporting stderr/syslog
+**
+** Copyright (c) 2016 Victor Toni.
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, version 3.
+**
+** This program is distributed in the hope that it will be useful, but
+** WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+** Lesser General Lesser Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public License
+** along with this program. If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+/*
+** Lists and changes the configuration of running processes which share
+** their control block (see open_tinylog_control()).
+**
+**   tinylogctl                             list the processes
+**   tinylogctl <process> [setting ...]     show or change the configuration of a process
+**
+** The process is given by its pid, its ident or the path of its control block.
+** Settings are:
+**
+**   threshold=<level>                      emerg, alert, crit, err, warning, notice, info, debug, trace, init
+**   dest=<dest>                            stderr, syslog, both, file, stderr+file, ... (as listed)
+**   dev_logging=on|off
+**   thread_info=on|off
+**   category:<pattern>=<level>|default     threshold of the categories matching the glob pattern
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../src/tinylog_internal.h"
+
+/**
+** Names of the levels as accepted and shown
+*/
+static const char LEVELS[ TINYLOG_SEVERITIES ][ 8 ] =
+{
+        "emerg", "alert", "crit", "err",
+        "warning", "notice", "info", "debug",
+        "trace", "init"
+};
+
+/**
+** Content of the control block read last (too large for the stack)
+*/
+static struct LogControl    __control;
+
+
+// functions
+
+/**
+** Read the control block of the file.
+*/
+static bool __read_control( const char *path, struct LogControl *control )
+{
+    const int fd = open( path, O_RDONLY | O_CLOEXEC );
+    if( fd < 0 )
+    {
+        return false;
+    }
+
+    const bool valid = pread( fd, control, sizeof( *control ), 0 ) == sizeof( *control )
+            && control->magic == TINYLOG_CONTROL_MAGIC
+            && control->size == sizeof( *control );
+    close( fd );
+
+    return valid;
+}
+
+static bool __running( const pid_t pid )
+{
+    return kill( pid, 0 ) == 0 || errno == EPERM;
+}
+
+static const char *__level( const int level )
+{
+    if( 0 <= level && level < TINYLOG_SEVERITIES )
+    {
+        return LEVELS[ level ];
+    }
+
+    static char number[ 16 ];
+    snprintf( number, sizeof( number ), "%d", level );
+
+    return number;
+}
+
+/**
+** Parse a level, by name or number. Returns -1 if unknown.
+*/
+static int __parse_level( const char *text )
+{
+    for( int level = 0; level < TINYLOG_SEVERITIES; level++ )
+    {
+        if( strcmp( text, LEVELS[ level ] ) == 0 )
+        {
+            return level;
+        }
+    }
+    if( strcmp( text, "error" ) == 0 )
+    {
+        return LOG_ERR;
+    }
+
+    char *end;
+    const long level = strtol( text, &end, 10 );
+
+    return *text != '\0' && *end == '\0' && 0 <= level && level <= INT32_MAX ? (int) level : -1;
+}
+
+/**
+** Parse on/off. Returns -1 if neither.
+*/
+static int __parse_switch( const char *text )
+{
+    if( strcmp( text, "on" ) == 0 || strcmp( text, "true" ) == 0 || strcmp( text, "1" ) == 0 )
+    {
+        return 1;
+    }
+    if( strcmp( text, "off" ) == 0 || strcmp( text, "false" ) == 0 || strcmp( text, "0" ) == 0 )
+    {
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+** Parse a destination as shown by strlog_dest(). Returns 0 if unknown.
+*/
+static log_dest_t __parse_dest( const char *text )
+{
+    for( int dest = STDERR; dest <= ( STDERR | SYSLOG | LOGFILE | BINARY ); dest++ )
+    {
+        if( strcmp( text, strlog_dest( dest ) ) == 0 )
+        {
+            return dest;
+        }
+    }
+
+    return 0;
+}
+
+/**
+** Show the configuration held by the control block.
+*/
+static void __show( const struct LogControl *control )
+{
+    const uint64_t config = control->config;
+
+    printf( "pid           %d%s\n", control->pid, __running( control->pid ) ? "" : " (not running)" );
+    printf( "ident         %.*s\n", (int) sizeof( control->ident ) - 1, control->ident );
+    printf( "threshold     %s\n", __level( CONFIG_THRESHOLD( config ) ) );
+    printf( "dest          %s\n", strlog_dest( CONFIG_DEST( config ) ) );
+    printf( "dev_logging   %s\n", config & CONFIG_DEV_LOGGING ? "on" : "off" );
+    printf( "thread_info   %s\n", config & CONFIG_THREAD_INFO ? "on" : "off" );
+
+    const unsigned count = control->category_count < TINYLOG_MAX_CATEGORIES ? control->category_count : TINYLOG_MAX_CATEGORIES;
+    for( unsigned i = 1; i < count; i++ )
+    {
+        const int threshold = control->category_thresholds[ i ];
+
+        printf( "category      %-*.*s %s\n", TINYLOG_CATEGORY_NAME_SIZE, TINYLOG_CATEGORY_NAME_SIZE - 1,
+                control->category_names[ i ], threshold == LOG_THRESHOLD_DEFAULT ? "default" : __level( threshold ) );
+    }
+}
+
+/**
+** List the control blocks of all processes.
+*/
+static int __list( void )
+{
+    DIR *dir = opendir( TINYLOG_CONTROL_DIR );
+    if( dir == NULL )
+    {
+        fprintf( stderr, "tinylogctl: %s: %s\n", TINYLOG_CONTROL_DIR, strerror( errno ) );
+        return EXIT_FAILURE;
+    }
+
+    printf( "%8s  %-24s %-10s %-20s %-12s %s\n", "PID", "IDENT", "THRESHOLD", "DEST", "DEV_LOGGING", "CATEGORIES" );
+
+    struct dirent *entry;
+    while( ( entry = readdir( dir ) ) != NULL )
+    {
+        if( strncmp( entry->d_name, "tinylog.", 8 ) != 0 )
+        {
+            continue;
+        }
+
+        char path[ TINYLOG_CONTROL_PATH_SIZE ];
+        snprintf( path, sizeof( path ), TINYLOG_CONTROL_DIR "/%s", entry->d_name );
+
+        if( !__read_control( path, &__control ) )
+        {
+            continue;
+        }
+
+        const uint64_t config = __control.config;
+
+        const unsigned count = __control.category_count < TINYLOG_MAX_CATEGORIES ? __control.category_count : TINYLOG_MAX_CATEGORIES;
+
+        printf( "%8d  %-24.*s %-10s %-20s %-12s %u%s\n",
+                __control.pid, (int) sizeof( __control.ident ) - 1, __control.ident,
+                __level( CONFIG_THRESHOLD( config ) ), strlog_dest( CONFIG_DEST( config ) ),
+                config & CONFIG_DEV_LOGGING ? "on" : "off",
+                count > 0 ? count - 1 : 0,
+                __running( __control.pid ) ? "" : " (not running)" );
+    }
+    closedir( dir );
+
+    return EXIT_SUCCESS;
+}
+
+/**
+** Find the control block of the process given by pid, ident or path.
+*/
+static bool __find( const char *process, char *path, const size_t size )
+{
+    if( strchr( process, '/' ) != NULL )
+    {
+        snprintf( path, size, "%s", process );
+        return true;
+    }
+
+    char *end;
+    const long pid = strtol( process, &end, 10 );
+    const bool by_pid = *end == '\0';
+
+    DIR *dir = opendir( TINYLOG_CONTROL_DIR );
+    if( dir == NULL )
+    {
+        return false;
+    }
+
+    unsigned found = 0;
+    struct dirent *entry;
+    while( ( entry = readdir( dir ) ) != NULL )
+    {
+        char candidate[ TINYLOG_CONTROL_PATH_SIZE ];
+        snprintf( candidate, sizeof( candidate ), TINYLOG_CONTROL_DIR "/%s", entry->d_name );
+
+        if( strncmp( entry->d_name, "tinylog.", 8 ) != 0
+            || !__read_control( candidate, &__control )
+            || !__running( __control.pid ) )
+        {
+            continue;
+        }
+
+        if( by_pid ? __control.pid == pid : strncmp( __control.ident, process, sizeof( __control.ident ) ) == 0 )
+        {
+            snprintf( path, size, "%s", candidate );
+            found++;
+        }
+    }
+    closedir( dir );
+
+    if( found > 1 )
+    {
+        fprintf( stderr, "tinylogctl: %s: more than one process, use the pid\n", process );
+    }
+
+    return found == 1;
+}
+
+/**
+** Threshold of the categories matching the pattern, in the attached control block.
+*/
+static void __set_categories( const char *pattern, const int threshold )
+{
+    const unsigned count = __atomic_load_n( &__log_control.category_count, __ATOMIC_ACQUIRE );
+
+    for( unsigned i = 1; i < count && i < TINYLOG_MAX_CATEGORIES; i++ )
+    {
+        // the names aren't guaranteed to be terminated
+        char name[ TINYLOG_CATEGORY_NAME_SIZE ];
+        snprintf( name, sizeof( name ), "%.*s", (int) sizeof( name ) - 1, __log_control.category_names[ i ] );
+
+        if( fnmatch( pattern, name, 0 ) == 0 )
+        {
+            __atomic_store_n( &__log_control.category_thresholds[ i ], threshold, __ATOMIC_SEQ_CST );
+        }
+    }
+
+    __tinylog_update_categories();
+}
+
+/**
+** Apply a setting to the attached control block.
+*/
+static bool __apply( const char *setting )
+{
+    const char *value = strchr( setting, '=' );
+    if( value == NULL )
+    {
+        return false;
+    }
+    const size_t key_len = value++ - setting;
+
+    if( key_len == 9 && strncmp( setting, "threshold", key_len ) == 0 )
+    {
+        const int level = __parse_level( value );
+        if( level >= 0 )
+        {
+            set_log_threshold( level );
+            return true;
+        }
+    }
+    else if( key_len == 4 && strncmp( setting, "dest", key_len ) == 0 )
+    {
+        const log_dest_t dest = __parse_dest( value );
+        if( dest != 0 )
+        {
+            set_log_dest( dest );
+            return true;
+        }
+    }
+    else if( key_len == 11 && strncmp( setting, "dev_logging", key_len ) == 0 )
+    {
+        const int on = __parse_switch( value );
+        if( on >= 0 )
+        {
+            set_dev_logging( on );
+            return true;
+        }
+    }
+    else if( key_len == 11 && strncmp( setting, "thread_info", key_len ) == 0 )
+    {
+        const int on = __parse_switch( value );
+        if( on >= 0 )
+        {
+            set_log_thread_info( on );
+            return true;
+        }
+    }
+    else if( key_len > 9 && strncmp( setting, "category:", 9 ) == 0 && key_len - 9 < TINYLOG_CATEGORY_NAME_SIZE )
+    {
+        char pattern[ TINYLOG_CATEGORY_NAME_SIZE ];
+        snprintf( pattern, sizeof( pattern ), "%.*s", (int) ( key_len - 9 ), setting + 9 );
+
+        const int level = strcmp( value, "default" ) == 0 ? LOG_THRESHOLD_DEFAULT : __parse_level( value );
+        if( level != -1 || strcmp( value, "default" ) == 0 )
+        {
+            __set_categories( pattern, level );
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main( int argc, char **argv )
+{
+    if( argc < 2 )
+    {
+        return __list();
+    }
+
+    if( strcmp( argv[ 1 ], "-h" ) == 0 || strcmp( argv[ 1 ], "--help" ) == 0 )
+    {
+        printf( "usage: tinylogctl [<pid>|<ident>|<path> [threshold=<level>] [dest=<dest>]\n"
+                "                  [dev_logging=on|off] [thread_info=on|off] [category:<pattern>=<level>|default] ...]\n" );
+        return EXIT_SUCCESS;
+    }
+
+    char path[ TINYLOG_CONTROL_PATH_SIZE ];
+    if( !__find( argv[ 1 ], path, sizeof( path ) ) )
+    {
+        fprintf( stderr, "tinylogctl: %s: no such process sharing its configuration\n", argv[ 1 ] );
+        return EXIT_FAILURE;
+    }
+
+    if( argc == 2 )
+    {
+        if( !__read_control( path, &__control ) )
+        {
+            fprintf( stderr, "tinylogctl: %s: not a control block\n", path );
+            return EXIT_FAILURE;
+        }
+        __show( &__control );
+
+        return EXIT_SUCCESS;
+    }
+
+    // from now on the setters of tinylog change the configuration of the process
+    if( !__tinylog_control_attach( path ) )
+    {
+        fprintf( stderr, "tinylogctl: %s: %s\n", path, strerror( errno ) );
+        return EXIT_FAILURE;
+    }
+
+    int result = EXIT_SUCCESS;
+    for( int i = 2; i < argc; i++ )
+    {
+        if( !__apply( argv[ i ] ) )
+        {
+            fprintf( stderr, "tinylogctl: invalid setting: %s\n", argv[ i ] );
+            result = EXIT_FAILURE;
+        }
+    }
+
+    __show( &__log_control );
+
+    return result;
+}
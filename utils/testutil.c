@@ -21,11 +21,13 @@
 #include "testutil.h"
 
 const char* USAGE=
-"Usage: %s [-h] [-d] [-s] [-v]\n"
+"Usage: %s [-h] [-a] [-d] [-s] [-f file] [-v]\n"
 "\n"
 "   -h   Display this help screen\n"
+"   -a   Write messages asynchronously by a background thread\n"
 "   -e   Output all messages on stderr\n"
 "   -s   Output messages to syslog (up to LOG_DEBUG)\n"
+"   -f   Output all messages to the given log file\n"
 "   -d   Turn on dev_logging (prints __FUNCTION__ & __LINE__)\n"
 "   -v   Increase log level (default is LOG_WARNING)\n"
 "\n"
@@ -39,6 +41,8 @@ log_conf_t parseopt( const int argc, char* const argv[], const char *usage )
     log_conf.log_threshold = LOG_WARNING;
     log_conf.log_dest = 0;
     log_conf.dev_logging = false;
+    log_conf.async = false;
+    log_conf.log_file = NULL;
 
     int c;
 
@@ -48,14 +52,21 @@ log_conf_t parseopt( const int argc, char* const argv[], const char *usage )
     }
 
     // Parse the commandline options and setup basic settings..
-    while ((c = getopt(argc, argv, "esdhv")) != -1) {
+    while ((c = getopt(argc, argv, "aesf:dhv")) != -1) {
         switch (c) {
+        case 'a':
+            log_conf.async = true;
+            break;
         case 'e':
             log_conf.log_dest |= STDERR;
             break;
         case 's':
             log_conf.log_dest |= SYSLOG;
             break;
+        case 'f':
+            log_conf.log_dest |= LOGFILE;
+            log_conf.log_file = optarg;
+            break;
         case 'd':
             log_conf.dev_logging = true;
             break;
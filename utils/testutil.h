@@ -31,11 +31,13 @@
 extern const char* USAGE;
 /*
  =
-"Usage: %s [-h] [-d] [-s] [-v]\n"
+"Usage: %s [-h] [-a] [-d] [-s] [-f file] [-v]\n"
 "\n"
 "   -h   Display this help screen\n"
+"   -a   Write messages asynchronously by a background thread\n"
 "   -e   Output all messages on stderr\n"
 "   -s   Output messages to syslog (up to LOG_DEBUG)\n"
+"   -f   Output all messages to the given log file\n"
 "   -d   Turn on dev_logging (prints __FUNCTION__ & __LINE__)\n"
 "   -v   Increase log level (default is LOG_WARNING)\n"
 "\n"
@@ -46,6 +48,8 @@ struct LogConf {
     int log_threshold;
     log_dest_t log_dest;
     bool dev_logging;
+    bool async;
+    const char *log_file;
 };
 typedef struct LogConf log_conf_t;
 